@@ -163,7 +163,8 @@ enum class FunctionKind {
     Logarithm,
     Hypotenuse,
     Max,
-    Min
+    Min,
+    Polygamma       // polygamma(n, x), the nth derivative of digamma
 };
 struct CallNode {
     FunctionKind fKind;
@@ -182,6 +183,7 @@ struct CallNode {
             case FunctionKind::Hypotenuse: return "hypot";
             case FunctionKind::Max: return "max";
             case FunctionKind::Min: return "min";
+            case FunctionKind::Polygamma: return "polygamma";
             default: return "Unknown Call";
         }
     }
@@ -250,9 +252,8 @@ class AST {
             return addNode(CallNode{ fKind, args, pos });
         }
 
-        const std::string toString() const {
-            return toString(root, 0);
-        }
+        // the indented tree dump, see printer.h
+        const std::string toString() const;
     
     private:
         template <class T>
@@ -262,33 +263,6 @@ class AST {
             arena.emplace_back(std::move(t));
             return id;
         }
-
-        std::string toString(NodeID id, u8 depth) const {
-            std::string indent(2*depth, ' ');
-            std::string result;
-            
-            std::visit([&](auto& node) {
-                using T = std::decay_t<decltype(node)>;
-                if constexpr (std::is_same_v<T, RationalNode>) {
-                    if (node.denominator == 1) result += indent + std::to_string(node.numerator) + "\n";
-                    else result += indent + node.toString() + "\n";
-                } else result += indent + node.toString() + "\n";
-
-                if constexpr (std::is_same_v<T, BinaryOpNode>) {
-                    result += toString(node.left, depth + 1);
-                    result += toString(node.right, depth + 1);
-                }
-                if constexpr (std::is_same_v<T, UnaryOpNode>) {
-                    result += toString(node.inner, depth + 1);
-                }
-                if constexpr (std::is_same_v<T, CallNode>) {
-                    for (const NodeID& arg : node.args) {
-                        result += toString(arg, depth + 1);
-                    }
-                }
-            }, at(id).kind);
-            return result;
-        }
 };
 
 #endif
\ No newline at end of file
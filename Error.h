@@ -3,6 +3,8 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
+#include <expected>
 
 struct LexerError : public std::runtime_error {
     size_t pos;
@@ -22,4 +24,38 @@ struct TransformerError : public std::runtime_error {
         : std::runtime_error(message), pos(pos) {}
 };
 
-#endif
\ No newline at end of file
+struct EvaluatorError : public std::runtime_error {
+    size_t pos;
+    EvaluatorError(size_t pos, const std::string& message)
+        : std::runtime_error(message), pos(pos) {}
+};
+
+/*
+Non-throwing errors
+
+Malformed input is normal input for some callers, and
+unwinding the stack for every bad line is slow. The try_()
+versions of Tokenize, parse, and transform record what
+went wrong as Diagnostics instead of throwing, and keep
+going where they can, so one input can report several
+problems at once.
+*/
+enum class ErrorStage {
+    Lexer,
+    Parser,
+    Transformer,
+    Evaluator
+};
+
+struct Diagnostic {
+    ErrorStage stage;
+    size_t pos;     // offset into the original input, or UnknownPos
+    std::string message;
+};
+
+using Diagnostics = std::vector<Diagnostic>;
+
+template <class T>
+using Result = std::expected<T, Diagnostics>;
+
+#endif
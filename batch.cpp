@@ -0,0 +1,198 @@
+#include "batch.h"
+
+#include <thread>
+#include <atomic>
+
+void TokenBatch::clear() {
+    types.clear();
+    offsets.clear();
+    lengths.clear();
+    numberIndex.clear();
+    numbers.clear();
+    exprStart.assign(1, 0);
+    errors.clear();
+}
+
+void TokenBatch::append(const TokenBatch& other) {
+    u32 tokenBase = (u32)types.size();
+    u32 numberBase = (u32)numbers.size();
+    size_t exprBase = expressionCount();
+
+    types.insert(types.end(), other.types.begin(), other.types.end());
+    offsets.insert(offsets.end(), other.offsets.begin(), other.offsets.end());
+    lengths.insert(lengths.end(), other.lengths.begin(), other.lengths.end());
+    numbers.insert(numbers.end(), other.numbers.begin(), other.numbers.end());
+
+    numberIndex.reserve(numberIndex.size() + other.numberIndex.size());
+    for (const u32& n : other.numberIndex) {
+        numberIndex.push_back(n == noNumber ? noNumber : n + numberBase);
+    }
+
+    exprStart.reserve(exprStart.size() + other.expressionCount());
+    for (size_t i = 1; i < other.exprStart.size(); i++) {
+        exprStart.push_back(other.exprStart[i] + tokenBase);
+    }
+
+    for (const BatchLexerError& e : other.errors) {
+        errors.push_back({ e.expression + exprBase, e.pos, e.message });
+    }
+}
+
+void TokenBatch::expand(const size_t& i, const std::string& input, std::vector<Token>& out) const {
+    out.clear();
+    out.reserve(last(i) - first(i));
+
+    for (u32 t = first(i); t < last(i); t++) {
+        // commands start at the '\', which isn't part of the lexeme
+        size_t start = offsets[t] + (types[t] == TokenType::Command ? 1 : 0);
+        std::string lexeme = types[t] == TokenType::End ? "End" : input.substr(start, lengths[t]);
+
+        if (numberIndex[t] != noNumber) out.push_back(Token{ types[t], std::move(lexeme), offsets[t], numbers[numberIndex[t]] });
+        else out.push_back(Token{ types[t], std::move(lexeme), offsets[t], std::nullopt });
+    }
+}
+
+void TokenizeRange(const std::vector<std::string>& inputs, const size_t& first, const size_t& last, TokenBatch& batch, const bool& exactNumbers) {
+    Diagnostics diagnostics;
+    LexerMachine lexer(exactNumbers, &diagnostics);
+    std::optional<Token> token;
+
+    for (size_t e = first; e < last; e++) {
+        const std::string& input = inputs[e];
+        lexer.reset();
+        diagnostics.clear();
+
+        size_t tokenMark = batch.types.size();
+        size_t numberMark = batch.numbers.size();
+
+        for (size_t i = 0; i <= input.size() && !lexer.finished(); i++) {
+            unsigned char c = (i < input.size()) ? static_cast<unsigned char>(input[i]) : '\0';
+
+            bool consumed;
+            do {
+                consumed = lexer.feed(c, i, token);
+                if (!token) continue;
+
+                batch.types.push_back(token->type);
+                batch.offsets.push_back((u32)token->pos);
+                batch.lengths.push_back(token->is(TokenType::End) ? 0 : (u32)token->lexeme.size());
+                if (token->number) {
+                    batch.numberIndex.push_back((u32)batch.numbers.size());
+                    batch.numbers.push_back(*token->number);
+                } else {
+                    batch.numberIndex.push_back(TokenBatch::noNumber);
+                }
+                token.reset();
+            } while (!consumed);
+        }
+
+        if (!diagnostics.empty()) {
+            // roll back whatever this expression got through
+            batch.types.resize(tokenMark);
+            batch.offsets.resize(tokenMark);
+            batch.lengths.resize(tokenMark);
+            batch.numberIndex.resize(tokenMark);
+            batch.numbers.resize(numberMark);
+            for (const Diagnostic& d : diagnostics) {
+                batch.errors.push_back({ e, d.pos, d.message });
+            }
+        }
+
+        batch.exprStart.push_back((u32)batch.types.size());
+    }
+}
+
+void TokenizeBatch(const std::vector<std::string>& inputs, TokenBatch& batch, const bool& exactNumbers) {
+    batch.clear();
+    TokenizeRange(inputs, 0, inputs.size(), batch, exactNumbers);
+}
+
+void TokenizeBatchParallel(const std::vector<std::string>& inputs, TokenBatch& batch, std::vector<TokenBatch>& scratch, const size_t& threadCount, const bool& exactNumbers) {
+    size_t threads = std::max<size_t>(1, std::min(threadCount, inputs.size()));
+    if (threads == 1) {
+        TokenizeBatch(inputs, batch, exactNumbers);
+        return;
+    }
+
+    scratch.resize(threads);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+
+    // contiguous ranges so appending in thread order keeps input order
+    size_t chunk = (inputs.size() + threads - 1) / threads;
+    for (size_t t = 0; t < threads; t++) {
+        size_t first = std::min(inputs.size(), t * chunk);
+        size_t last = std::min(inputs.size(), first + chunk);
+        workers.emplace_back([&, t, first, last]() {
+            scratch[t].clear();
+            TokenizeRange(inputs, first, last, scratch[t], exactNumbers);
+        });
+    }
+    for (std::thread& w : workers) w.join();
+
+    batch.clear();
+    for (size_t t = 0; t < threads; t++) {
+        batch.append(scratch[t]);
+    }
+}
+
+void ParseBatch::clear() {
+    for (AST& ast : arenas) {
+        ast.arena.clear();
+        ast.root = NodeID::None();
+    }
+    items.clear();
+}
+
+void ParseBatchParallel(std::span<const std::string> inputs, ParseBatch& batch, const size_t& threadCount) {
+    size_t threads = std::max<size_t>(1, std::min(threadCount, inputs.size()));
+
+    batch.clear();
+    if (batch.parsers.size() < threads) batch.parsers.resize(threads);
+    if (batch.arenas.size() < threads) batch.arenas.resize(threads);
+    batch.items.resize(inputs.size());
+
+    // small enough to balance, big enough that the counter isn't contended
+    constexpr size_t CHUNK = 32;
+    std::atomic<size_t> next = 0;
+
+    auto work = [&](const size_t& t) {
+        Parser& parser = batch.parsers[t];
+        AST& ast = batch.arenas[t];
+
+        while (true) {
+            size_t first = next.fetch_add(CHUNK, std::memory_order_relaxed);
+            if (first >= inputs.size()) break;
+            size_t last = std::min(inputs.size(), first + CHUNK);
+
+            for (size_t i = first; i < last; i++) {
+                ParsedItem& item = batch.items[i];
+                item.arena = t;
+                item.errors.clear();
+
+                size_t mark = ast.arena.size();
+                Result<NodeID> result = parser.tryParse(inputs[i], ast);
+                if (result) {
+                    item.root = *result;
+                } else {
+                    // drop whatever got built before the error
+                    ast.arena.erase(ast.arena.begin() + mark, ast.arena.end());
+                    item.root = NodeID::None();
+                    item.errors = std::move(result.error());
+                }
+            }
+        }
+    };
+
+    if (threads == 1) {
+        work(0);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back(work, t);
+    }
+    for (std::thread& w : workers) w.join();
+}
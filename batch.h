@@ -0,0 +1,141 @@
+/*
+Batch Tokenizing
+
+Tokenize() is great for one expression at a time, but
+when there are hundreds of thousands of tiny formulas
+to get through, every call allocating its own vector of
+Tokens (each with its own lexeme string!) adds up fast.
+
+TokenBatch stores every token of every expression in one
+flat structure-of-arrays buffer instead:
+
+    types   [ Number, Plus, Identifier, End, Command, ... ]
+    offsets [ 0,      2,    4,          5,   0,       ... ]
+    lengths [ 1,      1,    1,          0,   3,       ... ]
+                                             ^ expression 1 starts here
+
+plus exprStart, which holds the first token index of each
+expression (and one extra entry for the end of the last one).
+Offsets are relative to the start of their own expression, so
+a token's lexeme is just input.substr(offset, length), except
+for commands, whose offset points at the '\' that isn't part
+of the lexeme.
+
+Number values are only stored for number tokens, in the
+numbers array, and numberIndex points into it (noNumber
+for everything else).
+
+Clearing a batch keeps all the capacity, so reusing one
+across calls stops allocating once it's big enough. For
+parallel runs, each thread tokenizes its own range of
+inputs into its own batch, and the batches get appended
+together in input order at the end.
+
+--
+Batch Parsing
+
+ParseBatch does the same thing one step further. Each worker
+thread owns a Parser and an AST arena, and every expression it
+parses goes into that same arena, so one arena ends up holding
+hundreds of roots. Both get reused on the next call, which means
+after the first batch nothing allocates unless an arena has to
+grow.
+
+Workers grab small chunks of inputs off a shared counter instead
+of fixed ranges, so one thread stuck on a few huge formulas doesn't
+hold the rest up. Every result goes into its own slot in items,
+which keeps them in input order no matter which worker got there:
+
+    items[i] = { arena, root, errors }
+                 ^ which worker's AST the root lives in
+
+Items that fail get their nodes rolled back out of the arena
+and keep their Diagnostics instead.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "lexer.h"
+#include "parser.h"
+
+#include <span>
+
+struct BatchLexerError {
+    size_t expression;  // index of the input that failed
+    size_t pos;
+    std::string message;
+};
+
+struct TokenBatch {
+    static constexpr u32 noNumber = (u32)-1;
+
+    // one entry per token across every expression
+    std::vector<TokenType> types;
+    std::vector<u32> offsets;
+    std::vector<u32> lengths;
+    std::vector<u32> numberIndex;
+
+    // values of the number tokens, in token order
+    std::vector<Number> numbers;
+
+    // first token of each expression, plus one past the last token
+    std::vector<u32> exprStart = { 0 };
+
+    // inputs that failed to lex have no tokens at all
+    std::vector<BatchLexerError> errors;
+
+    size_t tokenCount() const { return types.size(); }
+    size_t expressionCount() const { return exprStart.size() - 1; }
+
+    // token index range [first, last) for expression i
+    u32 first(const size_t& i) const { return exprStart[i]; }
+    u32 last(const size_t& i) const { return exprStart[i + 1]; }
+
+    // empties the batch but keeps its capacity for reuse
+    void clear();
+
+    // copies the tokens of other onto the end of this batch
+    void append(const TokenBatch& other);
+
+    // rebuilds the Token objects of expression i (input is the original text)
+    void expand(const size_t& i, const std::string& input, std::vector<Token>& out) const;
+};
+
+// tokenizes inputs[first, last) onto the end of batch
+void TokenizeRange(const std::vector<std::string>& inputs, const size_t& first, const size_t& last, TokenBatch& batch, const bool& exactNumbers = true);
+
+// tokenizes every input into batch, which is cleared first
+void TokenizeBatch(const std::vector<std::string>& inputs, TokenBatch& batch, const bool& exactNumbers = true);
+
+// same as TokenizeBatch, but splits the inputs into contiguous ranges across threads
+// scratch holds one batch per thread and can be kept around between calls
+void TokenizeBatchParallel(const std::vector<std::string>& inputs, TokenBatch& batch, std::vector<TokenBatch>& scratch, const size_t& threadCount, const bool& exactNumbers = true);
+
+struct ParsedItem {
+    size_t arena = 0;               // index into ParseBatch::arenas
+    NodeID root = NodeID::None();
+    Diagnostics errors;             // empty if the input parsed
+
+    bool ok() const { return errors.empty(); }
+};
+
+struct ParseBatch {
+    // one per worker, kept between calls
+    std::vector<Parser> parsers;
+    std::vector<AST> arenas;
+
+    // one per input, in input order
+    std::vector<ParsedItem> items;
+
+    // the AST that item i's root lives in
+    const AST& ast(const size_t& i) const { return arenas[items[i].arena]; }
+
+    // empties every arena and the items but keeps their capacity
+    void clear();
+};
+
+// parses every input into batch across threadCount workers, batch is cleared first
+void ParseBatchParallel(std::span<const std::string> inputs, ParseBatch& batch, const size_t& threadCount);
+
+#endif
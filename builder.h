@@ -0,0 +1,189 @@
+/*
+Expression Builder
+
+When the expression comes from code instead of a person,
+writing it out as LaTeX just so the lexer and parser can
+take it apart again is wasted work. Builder skips both and
+calls the AST add_()s directly, with operator overloading so
+it still reads like math:
+
+    AST ast;
+    Builder b(ast);
+    Expr x = b.var("x");
+    ast.root = (pow(x, 2) + 3 * x - b.frac(1, 2)).id;
+
+builds the same tree as parsing "x^2 + 3x - \frac{1}{2}".
+
+An Expr is just a NodeID plus the AST it lives in, so it's
+cheap to copy and every operator appends exactly one node.
+Nothing is ever rewritten in place, so reusing an Expr in two
+places makes both parents point at the same node, same as
+shared leaves in a Document.
+
+Everything lives in namespace builder. Builder and Expr are
+pulled out into the global namespace, and the functions are
+found through their Expr arguments, so sin(x) and pow(x, 2)
+work as written without adding a ::sin next to <cmath>'s.
+max(a, b, c) works the same way, but max({ a, b, c }) has to be
+builder::max, since a braced list doesn't count for that.
+
+Plain numbers mix in on either side. Integers become rationals
+and floating point becomes reals, so x * 0.5 stays a real
+(use b.frac(1, 2) for the exact version, which is what the
+parser would have made of "0.5").
+*/
+
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include "AST.h"
+
+#include <concepts>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+
+namespace builder {
+
+struct Expr {
+    AST* ast;
+    NodeID id;
+};
+
+class Builder {
+    public:
+        explicit Builder(AST& ast) : _ast(&ast) {}
+
+        Expr var(const std::string& name, const size_t& pos = UnknownPos) const {
+            return { _ast, _ast->addIdentifier(name, pos) };
+        }
+        Expr num(const i64& value, const size_t& pos = UnknownPos) const {
+            return { _ast, _ast->addRational(value, 1, pos) };
+        }
+        Expr frac(const i64& numerator, const i64& denominator, const size_t& pos = UnknownPos) const {
+            if (denominator == 0) throw std::invalid_argument("Builder::frac with a zero denominator");
+            // neither can be flipped (or gcd'd) at the bottom of the range, the parser won't make one either
+            if (numerator == std::numeric_limits<i64>::min() || denominator == std::numeric_limits<i64>::min())
+                throw std::invalid_argument("Builder::frac with an i64 that can't be negated");
+            // the sign goes on top like the parser puts it, so frac(1, -2) and \frac{1}{-2} come out the same
+            if (denominator < 0) return { _ast, _ast->addRational(-numerator, -denominator, pos) };
+            return { _ast, _ast->addRational(numerator, denominator, pos) };
+        }
+        Expr real(const double& value, const size_t& pos = UnknownPos) const {
+            return { _ast, _ast->addReal(value, pos) };
+        }
+
+        Expr pi() const { return { _ast, _ast->addConstant(ConstantKind::PI) }; }
+        Expr e() const { return { _ast, _ast->addConstant(ConstantKind::E) }; }
+        Expr i() const { return { _ast, _ast->addConstant(ConstantKind::I) }; }
+
+        // any function, for the ones without a helper below
+        Expr call(const FunctionKind& fKind, std::initializer_list<Expr> args) const {
+            std::vector<NodeID> ids;
+            ids.reserve(args.size());
+            for (const Expr& a : args) ids.push_back(own(a).id);
+            return { _ast, _ast->addCall(fKind, ids) };
+        }
+
+        // wraps an existing node of this AST, like one the parser made
+        Expr wrap(const NodeID& id) const { return { _ast, id }; }
+
+    private:
+        AST* _ast;
+
+        const Expr& own(const Expr& a) const {
+            if (a.ast != _ast) throw std::invalid_argument("Expr belongs to a different AST");
+            return a;
+        }
+};
+
+namespace detail {
+    inline AST* same(const Expr& a, const Expr& b) {
+        if (a.ast != b.ast) throw std::invalid_argument("Exprs belong to different ASTs");
+        return a.ast;
+    }
+
+    inline Expr binary(const BinaryOpKind& bKind, const Expr& a, const Expr& b) {
+        AST* ast = same(a, b);
+        return { ast, ast->addBinaryOp(bKind, a.id, b.id) };
+    }
+
+    inline Expr unary(const UnaryOpKind& uKind, const Expr& a) {
+        return { a.ast, a.ast->addUnaryOp(uKind, a.id) };
+    }
+
+    inline Expr call(const FunctionKind& fKind, std::initializer_list<Expr> args) {
+        if (args.size() == 0) throw std::invalid_argument("Function call needs at least one argument");
+        return Builder(*args.begin()->ast).call(fKind, args);
+    }
+
+    // integers become rationals, floating point becomes reals
+    template <class N>
+    Expr number(AST* ast, const N& value) {
+        if constexpr (std::integral<N>) return { ast, ast->addRational(static_cast<i64>(value), 1) };
+        else return { ast, ast->addReal(static_cast<double>(value)) };
+    }
+}
+
+template <class N>
+concept BuilderNumber = std::integral<N> || std::floating_point<N>;
+
+// arithmetic
+
+inline Expr operator+(const Expr& a, const Expr& b) { return detail::binary(BinaryOpKind::Add, a, b); }
+inline Expr operator-(const Expr& a, const Expr& b) { return detail::binary(BinaryOpKind::Subtract, a, b); }
+inline Expr operator*(const Expr& a, const Expr& b) { return detail::binary(BinaryOpKind::Multiply, a, b); }
+inline Expr operator/(const Expr& a, const Expr& b) { return detail::binary(BinaryOpKind::Divide, a, b); }
+inline Expr operator-(const Expr& a) { return detail::unary(UnaryOpKind::Negate, a); }
+
+template <BuilderNumber N> Expr operator+(const Expr& a, const N& b) { return a + detail::number(a.ast, b); }
+template <BuilderNumber N> Expr operator-(const Expr& a, const N& b) { return a - detail::number(a.ast, b); }
+template <BuilderNumber N> Expr operator*(const Expr& a, const N& b) { return a * detail::number(a.ast, b); }
+template <BuilderNumber N> Expr operator/(const Expr& a, const N& b) { return a / detail::number(a.ast, b); }
+template <BuilderNumber N> Expr operator+(const N& a, const Expr& b) { return detail::number(b.ast, a) + b; }
+template <BuilderNumber N> Expr operator-(const N& a, const Expr& b) { return detail::number(b.ast, a) - b; }
+template <BuilderNumber N> Expr operator*(const N& a, const Expr& b) { return detail::number(b.ast, a) * b; }
+template <BuilderNumber N> Expr operator/(const N& a, const Expr& b) { return detail::number(b.ast, a) / b; }
+
+// '^' binds looser than '+' in C++, so power gets a function instead of an operator
+inline Expr pow(const Expr& base, const Expr& exponent) { return detail::binary(BinaryOpKind::Power, base, exponent); }
+template <BuilderNumber N> Expr pow(const Expr& base, const N& exponent) { return pow(base, detail::number(base.ast, exponent)); }
+template <BuilderNumber N> Expr pow(const N& base, const Expr& exponent) { return pow(detail::number(exponent.ast, base), exponent); }
+
+// same for '=', which can't be overloaded to make a node
+inline Expr eq(const Expr& a, const Expr& b) { return detail::binary(BinaryOpKind::Equals, a, b); }
+template <BuilderNumber N> Expr eq(const Expr& a, const N& b) { return eq(a, detail::number(a.ast, b)); }
+
+inline Expr factorial(const Expr& a) { return detail::unary(UnaryOpKind::Factorial, a); }
+inline Expr percent(const Expr& a) { return detail::unary(UnaryOpKind::Percent, a); }
+
+// functions, same node shapes the parser makes
+
+inline Expr sin(const Expr& a) { return detail::call(FunctionKind::Sine, { a }); }
+inline Expr cos(const Expr& a) { return detail::call(FunctionKind::Cosine, { a }); }
+inline Expr tan(const Expr& a) { return detail::call(FunctionKind::Tangent, { a }); }
+inline Expr exp(const Expr& a) { return detail::call(FunctionKind::Exponential, { a }); }
+inline Expr ln(const Expr& a) { return detail::call(FunctionKind::NaturalLogarithm, { a }); }
+inline Expr log(const Expr& a) { return detail::call(FunctionKind::Logarithm, { a }); }
+inline Expr abs(const Expr& a) { return detail::call(FunctionKind::AbsoluteValue, { a }); }
+inline Expr atan2(const Expr& y, const Expr& x) { return detail::call(FunctionKind::Atan2, { y, x }); }
+inline Expr hypot(const Expr& a, const Expr& b) { return detail::call(FunctionKind::Hypotenuse, { a, b }); }
+// a braced list brings no namespace along for ADL, so max({ a, b }) needs builder::
+inline Expr max(std::initializer_list<Expr> args) { return detail::call(FunctionKind::Max, args); }
+inline Expr min(std::initializer_list<Expr> args) { return detail::call(FunctionKind::Min, args); }
+template <std::same_as<Expr>... Rest> Expr max(const Expr& a, const Rest&... rest) { return detail::call(FunctionKind::Max, { a, rest... }); }
+template <std::same_as<Expr>... Rest> Expr min(const Expr& a, const Rest&... rest) { return detail::call(FunctionKind::Min, { a, rest... }); }
+
+// sqrt(x) = x^(1/2), like \sqrt{x}
+inline Expr sqrt(const Expr& a) { return pow(a, Expr{ a.ast, a.ast->addRational(1, 2) }); }
+
+// psi^(n)(x), and psi(x) = polygamma(0, x)
+inline Expr polygamma(const Expr& n, const Expr& x) { return detail::call(FunctionKind::Polygamma, { n, x }); }
+inline Expr digamma(const Expr& a) { return polygamma(Expr{ a.ast, a.ast->addRational(0, 1) }, a); }
+
+}
+
+using builder::Builder;
+using builder::Expr;
+
+#endif
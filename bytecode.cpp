@@ -0,0 +1,404 @@
+#include "bytecode.h"
+
+#include <bit>
+#include <cstring>
+#include <numbers>
+#include <unordered_map>
+
+static const char* opName(const OpCode& op) {
+    switch (op) {
+        case OpCode::Add: return "add";
+        case OpCode::Subtract: return "sub";
+        case OpCode::Multiply: return "mul";
+        case OpCode::Divide: return "div";
+        case OpCode::Power: return "pow";
+        case OpCode::PowerRoot: return "powroot";
+        case OpCode::Negate: return "neg";
+        case OpCode::Factorial: return "fact";
+        case OpCode::Percent: return "percent";
+        case OpCode::Sine: return "sin";
+        case OpCode::Cosine: return "cos";
+        case OpCode::Tangent: return "tan";
+        case OpCode::Atan2: return "atan2";
+        case OpCode::AbsoluteValue: return "abs";
+        case OpCode::Exponential: return "exp";
+        case OpCode::NaturalLogarithm: return "ln";
+        case OpCode::Logarithm: return "log";
+        case OpCode::LogarithmBase: return "logb";
+        case OpCode::Hypotenuse: return "hypot";
+        case OpCode::Max: return "max";
+        case OpCode::Min: return "min";
+        case OpCode::Polygamma: return "polygamma";
+    }
+    return "?";
+}
+
+static bool isUnary(const OpCode& op) {
+    switch (op) {
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+        case OpCode::Power:
+        case OpCode::PowerRoot:
+        case OpCode::Atan2:
+        case OpCode::LogarithmBase:
+        case OpCode::Hypotenuse:
+        case OpCode::Max:
+        case OpCode::Min:
+        case OpCode::Polygamma: return false;
+        default: return true;
+    }
+}
+
+static size_t nodePos(const AST& ast, const NodeID& id) {
+    return std::visit([](const auto& node) { return node.pos; }, ast.at(id).kind);
+}
+
+// builds a Program out of one subtree, registers are numbered per kind until finish() lays them out
+class ProgramCompiler {
+    public:
+        ProgramCompiler(const AST& ast) : _ast(ast) {}
+
+        Program compile(const NodeID& root) {
+            if (root.isNone()) throw EvaluatorError(UnknownPos, "Nothing to compile");
+
+            countUses(root);
+            // the root is never consumed, so its register can't get handed out again
+            _uses[root.i]++;
+
+            std::vector<std::pair<NodeID, bool>> tasks = { { root, false } };
+            while (!tasks.empty()) {
+                auto [id, expanded] = tasks.back();
+                tasks.pop_back();
+                if (_values.count(id.i)) continue;
+
+                if (!expanded) {
+                    tasks.push_back({ id, true });
+                    forEachChild(id, [&](const NodeID& child) {
+                        if (!_values.count(child.i)) tasks.push_back({ child, false });
+                    });
+                    continue;
+                }
+                _values[id.i] = { compileNode(id), _uses[id.i] };
+            }
+
+            return finish(_values[root.i].value);
+        }
+
+    private:
+        enum class Kind : u8 { Constant, Variable, Temporary };
+
+        struct Value {
+            Kind kind;
+            u32 index;
+        };
+
+        struct Computed {
+            Value value;
+            u32 remaining;     // parents that haven't read it yet
+        };
+
+        struct Pending {
+            OpCode op;
+            u8 flag;
+            Value dst, a, b;
+        };
+
+        const AST& _ast;
+        std::unordered_map<size_t, u32> _uses;
+        std::unordered_map<size_t, Computed> _values;
+
+        std::vector<double> _constants;
+        std::unordered_map<u64, u32> _constantIndex;   // by bits, so -0.0 and NaNs stay distinct
+        std::vector<std::string> _variables;
+        std::unordered_map<std::string, u32> _variableIndex;
+
+        std::vector<Pending> _code;
+        std::vector<u32> _freeTemps;
+        u32 _tempCount = 0;
+
+        template <class F>
+        void forEachChild(const NodeID& id, F f) const {
+            std::visit([&](const auto& node) {
+                using T = std::decay_t<decltype(node)>;
+                if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                    f(node.left);
+                    f(node.right);
+                }
+                if constexpr (std::is_same_v<T, UnaryOpNode>) f(node.inner);
+                if constexpr (std::is_same_v<T, CallNode>) {
+                    for (const NodeID& arg : node.args) f(arg);
+                }
+            }, _ast.at(id).kind);
+        }
+
+        // how many parents read each node, a shared node only gets its children counted once
+        void countUses(const NodeID& root) {
+            std::vector<NodeID> stack = { root };
+            _uses[root.i] = 0;
+            while (!stack.empty()) {
+                NodeID id = stack.back();
+                stack.pop_back();
+                forEachChild(id, [&](const NodeID& child) {
+                    if (child.isNone() || child.i >= _ast.arena.size()) {
+                        throw EvaluatorError(nodePos(_ast, id), "Missing operand");
+                    }
+                    if (_uses[child.i]++ == 0) stack.push_back(child);
+                });
+            }
+        }
+
+        Value constant(const double& value) {
+            auto [it, inserted] = _constantIndex.try_emplace(std::bit_cast<u64>(value), (u32)_constants.size());
+            if (inserted) _constants.push_back(value);
+            return { Kind::Constant, it->second };
+        }
+
+        Value variable(const std::string& name) {
+            auto [it, inserted] = _variableIndex.try_emplace(name, (u32)_variables.size());
+            if (inserted) _variables.push_back(name);
+            return { Kind::Variable, it->second };
+        }
+
+        void release(const Value& v) {
+            if (v.kind == Kind::Temporary) _freeTemps.push_back(v.index);
+        }
+
+        // reads a child's value, freeing its register after the last parent has
+        Value consume(const NodeID& id) {
+            Computed& c = _values.at(id.i);
+            if (--c.remaining == 0) release(c.value);
+            return c.value;
+        }
+
+        // operands have to be consumed/released before this, so dst can reuse one of their registers
+        Value emit(const OpCode& op, const u8& flag, const Value& a, const Value& b) {
+            if (a.kind == Kind::Constant && b.kind == Kind::Constant) {
+                return constant(applyOp(op, flag, _constants[a.index], _constants[b.index]));
+            }
+
+            Value dst{ Kind::Temporary, 0 };
+            if (!_freeTemps.empty()) {
+                dst.index = _freeTemps.back();
+                _freeTemps.pop_back();
+            } else dst.index = _tempCount++;
+
+            _code.push_back({ op, flag, dst, a, b });
+            return dst;
+        }
+
+        Value unary(const OpCode& op, const NodeID& inner) {
+            Value a = consume(inner);
+            return emit(op, 0, a, a);
+        }
+
+        Value compileNode(const NodeID& id) {
+            const ASTNode& node = _ast.at(id);
+
+            if (const RationalNode* r = std::get_if<RationalNode>(&node.kind)) {
+                return constant((double)r->numerator / (double)r->denominator);
+            }
+            if (const RealNode* r = std::get_if<RealNode>(&node.kind)) return constant(r->value);
+            if (const IdentifierNode* n = std::get_if<IdentifierNode>(&node.kind)) return variable(n->name);
+            if (const ConstantNode* c = std::get_if<ConstantNode>(&node.kind)) {
+                switch (c->cKind) {
+                    case ConstantKind::PI: return constant(std::numbers::pi);
+                    case ConstantKind::E: return constant(std::numbers::e);
+                    case ConstantKind::I: throw EvaluatorError(c->pos, "i has no real value");
+                }
+            }
+
+            if (const BinaryOpNode* b = std::get_if<BinaryOpNode>(&node.kind)) {
+                OpCode op = OpCode::Add;
+                u8 flag = 0;
+                switch (b->bKind) {
+                    case BinaryOpKind::Add: op = OpCode::Add; break;
+                    case BinaryOpKind::Subtract: op = OpCode::Subtract; break;
+                    case BinaryOpKind::Multiply: op = OpCode::Multiply; break;
+                    case BinaryOpKind::Divide: op = OpCode::Divide; break;
+                    case BinaryOpKind::Equals: op = OpCode::Subtract; break;
+                    case BinaryOpKind::Power: {
+                        op = OpCode::Power;
+                        const RationalNode* r = std::get_if<RationalNode>(&_ast.at(b->right).kind);
+                        if (r && r->denominator != 1 && r->denominator % 2 != 0) {
+                            op = OpCode::PowerRoot;
+                            flag = r->numerator % 2 != 0;
+                        }
+                        break;
+                    }
+                }
+                Value left = consume(b->left);
+                Value right = consume(b->right);
+                // x^2 as x*x, which is what Power does anyway but cheaper
+                if (op == OpCode::Power && right.kind == Kind::Constant && _constants[right.index] == 2) {
+                    return emit(OpCode::Multiply, 0, left, left);
+                }
+                return emit(op, flag, left, right);
+            }
+
+            if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&node.kind)) {
+                switch (u->uKind) {
+                    case UnaryOpKind::Negate: return unary(OpCode::Negate, u->inner);
+                    case UnaryOpKind::Factorial: return unary(OpCode::Factorial, u->inner);
+                    case UnaryOpKind::Percent: return unary(OpCode::Percent, u->inner);
+                }
+            }
+
+            const CallNode& call = std::get<CallNode>(node.kind);
+            const std::vector<NodeID>& args = call.args;
+            auto arity = [&](const size_t& n) {
+                if (args.size() != n) throw EvaluatorError(call.pos, "Wrong number of arguments to " + call.toString());
+            };
+            if (args.empty()) throw EvaluatorError(call.pos, "Function call without arguments");
+
+            switch (call.fKind) {
+                case FunctionKind::Sine: arity(1); return unary(OpCode::Sine, args[0]);
+                case FunctionKind::Cosine: arity(1); return unary(OpCode::Cosine, args[0]);
+                case FunctionKind::Tangent: arity(1); return unary(OpCode::Tangent, args[0]);
+                case FunctionKind::AbsoluteValue: arity(1); return unary(OpCode::AbsoluteValue, args[0]);
+                case FunctionKind::Exponential: arity(1); return unary(OpCode::Exponential, args[0]);
+                case FunctionKind::NaturalLogarithm: arity(1); return unary(OpCode::NaturalLogarithm, args[0]);
+                case FunctionKind::Logarithm: {
+                    if (args.size() == 1) return unary(OpCode::Logarithm, args[0]);
+                    arity(2);
+                    Value x = consume(args[0]);
+                    Value base = consume(args[1]);
+                    return emit(OpCode::LogarithmBase, 0, x, base);
+                }
+                case FunctionKind::Atan2: {
+                    arity(2);
+                    Value y = consume(args[0]);
+                    Value x = consume(args[1]);
+                    return emit(OpCode::Atan2, 0, y, x);
+                }
+                case FunctionKind::Polygamma: {
+                    arity(2);
+                    Value order = consume(args[0]);
+                    Value x = consume(args[1]);
+                    return emit(OpCode::Polygamma, 0, order, x);
+                }
+                case FunctionKind::Hypotenuse:
+                case FunctionKind::Max:
+                case FunctionKind::Min: {
+                    OpCode op = call.fKind == FunctionKind::Max ? OpCode::Max
+                              : call.fKind == FunctionKind::Min ? OpCode::Min : OpCode::Hypotenuse;
+                    // hypot(x) = |x| and max(x) = max(x, x)
+                    if (args.size() == 1) return unary(op == OpCode::Hypotenuse ? OpCode::AbsoluteValue : op, args[0]);
+
+                    // a chain of two-arg ops, each arg consumed only right before it's read
+                    Value acc = consume(args[0]);
+                    Value next = consume(args[1]);
+                    acc = emit(op, 0, acc, next);
+                    for (size_t i = 2; i < args.size(); i++) {
+                        release(acc);
+                        next = consume(args[i]);
+                        acc = emit(op, 0, acc, next);
+                    }
+                    return acc;
+                }
+            }
+            throw EvaluatorError(call.pos, "Unknown function");
+        }
+
+        // drops constants that only fed compile-time folding and gives every register its final number
+        Program finish(const Value& result) {
+            std::vector<u32> constantRegister(_constants.size(), ~0u);
+            Program program;
+
+            auto mark = [&](const Value& v) {
+                if (v.kind != Kind::Constant || constantRegister[v.index] != ~0u) return;
+                constantRegister[v.index] = (u32)program._constants.size();
+                program._constants.push_back(_constants[v.index]);
+            };
+            for (const Pending& p : _code) {
+                mark(p.a);
+                mark(p.b);
+            }
+            mark(result);
+
+            u32 variableBase = (u32)program._constants.size();
+            u32 tempBase = variableBase + (u32)_variables.size();
+            auto reg = [&](const Value& v) -> u32 {
+                switch (v.kind) {
+                    case Kind::Constant: return constantRegister[v.index];
+                    case Kind::Variable: return variableBase + v.index;
+                    case Kind::Temporary: return tempBase + v.index;
+                }
+                return 0;
+            };
+
+            program._code.reserve(_code.size());
+            for (const Pending& p : _code) program._code.push_back({ p.op, p.flag, reg(p.dst), reg(p.a), reg(p.b) });
+            program._variables = std::move(_variables);
+            program._registerCount = tempBase + _tempCount;
+            program._result = reg(result);
+            return program;
+        }
+};
+
+std::optional<size_t> Program::slot(std::string_view name) const {
+    for (size_t i = 0; i < _variables.size(); i++) {
+        if (_variables[i] == name) return i;
+    }
+    return std::nullopt;
+}
+
+double Program::run(const double* vars, double* registers) const {
+    if (!_constants.empty()) std::memcpy(registers, _constants.data(), _constants.size() * sizeof(double));
+    if (!_variables.empty()) std::memcpy(registers + _constants.size(), vars, _variables.size() * sizeof(double));
+
+    for (const Instruction& in : _code) {
+        registers[in.dst] = applyOp(in.op, in.flag, registers[in.a], registers[in.b]);
+    }
+    return registers[_result];
+}
+
+double Program::run(std::span<const double> vars) const {
+    if (vars.size() < _variables.size()) throw EvaluatorError(UnknownPos, "Not enough variable values");
+
+    thread_local std::vector<double> registers;
+    if (registers.size() < _registerCount) registers.resize(_registerCount);
+    return run(vars.data(), registers.data());
+}
+
+double Program::run(const Bindings& bindings) const {
+    thread_local std::vector<double> vars;
+    vars.clear();
+    for (const std::string& name : _variables) {
+        auto it = bindings.find(name);
+        if (it == bindings.end()) throw EvaluatorError(UnknownPos, "Unbound variable: \"" + name + "\"");
+        vars.push_back(it->second);
+    }
+    return run(std::span<const double>(vars));
+}
+
+std::string Program::toString() const {
+    std::string out;
+    for (size_t i = 0; i < _constants.size(); i++) {
+        out += "r" + std::to_string(i) + " = " + std::to_string(_constants[i]) + "\n";
+    }
+    for (size_t i = 0; i < _variables.size(); i++) {
+        out += "r" + std::to_string(_constants.size() + i) + " = " + _variables[i] + "\n";
+    }
+    for (const Instruction& in : _code) {
+        out += "r" + std::to_string(in.dst) + " = " + opName(in.op) + " r" + std::to_string(in.a);
+        if (!isUnary(in.op)) out += ", r" + std::to_string(in.b);
+        if (in.op == OpCode::PowerRoot && in.flag) out += " (odd)";
+        out += "\n";
+    }
+    out += "result r" + std::to_string(_result) + "\n";
+    return out;
+}
+
+Program compile(const AST& ast, const NodeID& id) {
+    return ProgramCompiler(ast).compile(id);
+}
+
+Result<Program> tryCompile(const AST& ast, const NodeID& id) {
+    try {
+        return compile(ast, id);
+    } catch (const EvaluatorError& e) {
+        return std::unexpected(Diagnostics{ { ErrorStage::Evaluator, e.pos, e.what() } });
+    }
+}
@@ -0,0 +1,154 @@
+/*
+Bytecode Compiler & VM
+
+Walking the tree is fine for evaluating something once, but
+doing it millions of times with different variable values
+means visiting a std::variant and chasing NodeIDs around the
+arena for every node, every time. compile() does that walk
+once and flattens the tree into a Program: a list of register
+instructions that a tight loop can run over and over.
+
+    "x^2 + 3x - \frac{1}{2}"   ->   r0 = 3        constants
+                                     r1 = 2
+                                     r2 = 1/2
+                                     r3 = x        variables
+                                     r4 = r0 * r3  code
+                                     r5 = r3 ^ r1
+                                     r4 = r5 + r4
+                                     r4 = r4 - r2
+
+Registers are laid out as constants, then variables, then
+temporaries. Constants are pooled, so every distinct value is
+stored once no matter how often it shows up, and instructions
+read them straight out of their register, there's no "load".
+Each variable gets a slot, and running a Program just copies
+the constants and the slot values in before the loop starts.
+
+Temporaries get reused as soon as nothing needs them anymore,
+so even a huge expression only needs a handful of them. Shared
+subtrees (from a Builder, or a Document's shared leaves) are
+only computed once. Anything that doesn't depend on a variable,
+like sqrt(2) * pi, is worked out at compile time and just
+becomes another constant.
+
+The math is exactly the evaluator's (see evaluator.h), and a
+Program never changes after compile(), so one Program can be
+run from any number of threads at once, each with its own
+registers.
+*/
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "evaluator.h"
+
+#include <span>
+#include <string_view>
+
+enum class OpCode : u8 {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Power,
+    PowerRoot,      // x^(p/q) with odd q, flag is set if p is odd
+    Negate,
+    Factorial,
+    Percent,
+    Sine,
+    Cosine,
+    Tangent,
+    Atan2,
+    AbsoluteValue,
+    Exponential,
+    NaturalLogarithm,
+    Logarithm,      // base 10
+    LogarithmBase,  // ln a / ln b
+    Hypotenuse,
+    Max,
+    Min,
+    Polygamma       // a is the order
+};
+
+// dst = op(a, b), unary ops ignore b
+struct Instruction {
+    OpCode op;
+    u8 flag = 0;
+    u32 dst = 0;
+    u32 a = 0;
+    u32 b = 0;
+};
+
+// what a single instruction computes, shared by the VM and constant folding
+inline double applyOp(const OpCode& op, const u8& flag, const double& a, const double& b) {
+    switch (op) {
+        case OpCode::Add: return a + b;
+        case OpCode::Subtract: return a - b;
+        case OpCode::Multiply: return a * b;
+        case OpCode::Divide: return a / b;
+        // x*x is exact, pow can be an ulp off
+        case OpCode::Power: return b == 2 ? a * a : std::pow(a, b);
+        case OpCode::PowerRoot: {
+            if (a >= 0) return std::pow(a, b);
+            double magnitude = std::pow(-a, b);
+            return flag ? -magnitude : magnitude;
+        }
+        case OpCode::Negate: return -a;
+        case OpCode::Factorial: return std::tgamma(a + 1);
+        case OpCode::Percent: return a / 100;
+        case OpCode::Sine: return std::sin(a);
+        case OpCode::Cosine: return std::cos(a);
+        case OpCode::Tangent: return std::tan(a);
+        case OpCode::Atan2: return std::atan2(a, b);
+        case OpCode::AbsoluteValue: return std::fabs(a);
+        case OpCode::Exponential: return std::exp(a);
+        case OpCode::NaturalLogarithm: return std::log(a);
+        case OpCode::Logarithm: return std::log10(a);
+        case OpCode::LogarithmBase: return std::log(a) / std::log(b);
+        case OpCode::Hypotenuse: return std::hypot(a, b);
+        case OpCode::Max: return std::fmax(a, b);
+        case OpCode::Min: return std::fmin(a, b);
+        case OpCode::Polygamma: return polygamma(a, b);
+    }
+    return 0;
+}
+
+class Program {
+    public:
+        // registers needed to run, constants + variables + temporaries
+        size_t registerCount() const { return _registerCount; }
+        const std::vector<Instruction>& code() const { return _code; }
+        const std::vector<double>& constants() const { return _constants; }
+        // variable names in slot order
+        const std::vector<std::string>& variables() const { return _variables; }
+        // the register the result ends up in
+        u32 result() const { return _result; }
+
+        // slot of a variable, nullopt if the expression doesn't use it
+        std::optional<size_t> slot(std::string_view name) const;
+
+        // vars in slot order, registers has to hold registerCount() doubles
+        double run(const double* vars, double* registers) const;
+        // same, with this thread's own scratch registers
+        double run(std::span<const double> vars) const;
+        // looks every variable up by name, throws EvaluatorError if one is missing
+        double run(const Bindings& bindings) const;
+
+        // one instruction per line, for debugging
+        std::string toString() const;
+
+    private:
+        std::vector<Instruction> _code;
+        std::vector<double> _constants;
+        std::vector<std::string> _variables;
+        u32 _registerCount = 0;
+        u32 _result = 0;
+
+        friend class ProgramCompiler;
+};
+
+// compiles the subtree at id, throws EvaluatorError for things with no real value like i
+Program compile(const AST& ast, const NodeID& id);
+Result<Program> tryCompile(const AST& ast, const NodeID& id);
+
+#endif
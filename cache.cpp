@@ -0,0 +1,296 @@
+#include "cache.h"
+#include "serialize.h"
+#include "transformer.h"
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TransformCache::TransformCache(const size_t& capacity) : _capacity(std::max<size_t>(1, capacity)) {}
+
+std::optional<NodeID> TransformCache::lookup(const u64& hash, const AST& input, const NodeID& id, AST& output) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (auto it = _index.find(hash); it != _index.end()) {
+            Entry& entry = *it->second;
+            if (structurallyEqual(entry.ast, entry.key, input, id)) {
+                _stats.hits++;
+                _entries.splice(_entries.begin(), _entries, it->second);
+                return cloneSubtree(entry.ast, entry.value, output);
+            }
+            _stats.collisions++;
+        }
+
+        if (!_file) {
+            _stats.misses++;
+            return std::nullopt;
+        }
+    }
+
+    // the file has its own locking, no need to hold everyone else up while reading it
+    std::optional<NodeID> found = _file->lookup(hash, input, id, output);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!found) {
+        _stats.misses++;
+        return std::nullopt;
+    }
+    _stats.hits++;
+    _stats.fileHits++;
+
+    Entry entry{ hash, AST{}, NodeID::None(), NodeID::None() };
+    entry.key = cloneSubtree(input, id, entry.ast);
+    entry.value = cloneSubtree(output, *found, entry.ast);
+    remember(std::move(entry));
+    return found;
+}
+
+void TransformCache::insert(const u64& hash, const AST& input, const NodeID& id, const AST& result, const NodeID& resultID) {
+    Entry entry{ hash, AST{}, NodeID::None(), NodeID::None() };
+    entry.key = cloneSubtree(input, id, entry.ast);
+    entry.value = cloneSubtree(result, resultID, entry.ast);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        remember(std::move(entry));
+    }
+
+    if (_file) _file->insert(hash, input, id, result, resultID);
+}
+
+void TransformCache::remember(Entry entry) {
+    // a colliding or stale entry just gets replaced
+    if (auto it = _index.find(entry.hash); it != _index.end()) {
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+    if (_entries.size() >= _capacity) {
+        _index.erase(_entries.back().hash);
+        _entries.pop_back();
+        _stats.evictions++;
+    }
+
+    u64 hash = entry.hash;
+    _entries.push_front(std::move(entry));
+    _index[hash] = _entries.begin();
+    _stats.insertions++;
+}
+
+size_t TransformCache::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+CacheStats TransformCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void TransformCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.clear();
+    _stats = CacheStats{};
+}
+
+bool TransformCache::persistTo(const std::string& path, const size_t& slotCount, const size_t& dataBytes) {
+    auto file = std::make_unique<MappedCacheFile>();
+    if (!file->open(path, slotCount, dataBytes)) return false;
+    _file = std::move(file);
+    return true;
+}
+
+// the file
+
+static constexpr u64 CACHE_FILE_MAGIC = 0x3130484341434d54ULL;     // "TMCACH01"
+static constexpr u32 CACHE_FILE_VERSION = 2;
+static constexpr size_t MAX_PROBES = 8;
+
+struct MappedCacheFile::Header {
+    u64 magic;
+    u32 version;
+    u32 slotCount;
+    u32 rulesVersion;   // TRANSFORM_RULES_VERSION of whoever made the file
+    u32 reserved;
+    u64 dataBytes;
+    u64 dataEnd;        // bytes of the data region in use, only written under flock
+};
+
+struct MappedCacheFile::Slot {
+    u64 hash;           // 0 means empty, published last
+    u64 record;         // offset of the record in the data region
+};
+
+struct RecordHeader {
+    u64 hash;
+    u32 keyLength;
+    u32 valueLength;
+    u64 checksum;
+};
+
+// FNV-1a, only has to catch torn writes, not attackers
+static u64 checksum(std::string_view key, std::string_view value) {
+    u64 h = 0xcbf29ce484222325ULL;
+    for (std::string_view part : { key, value }) {
+        for (const char& c : part) {
+            h ^= static_cast<u8>(c);
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+// hash 0 marks an empty slot
+static u64 fileHash(const u64& hash) { return hash == 0 ? 1 : hash; }
+
+MappedCacheFile::~MappedCacheFile() {
+    close();
+}
+
+MappedCacheFile::Header* MappedCacheFile::header() const { return reinterpret_cast<Header*>(_base); }
+MappedCacheFile::Slot* MappedCacheFile::slots() const { return reinterpret_cast<Slot*>(_base + sizeof(Header)); }
+u8* MappedCacheFile::data() const { return _base + sizeof(Header) + header()->slotCount * sizeof(Slot); }
+
+bool MappedCacheFile::open(const std::string& path, const size_t& slotCount, const size_t& dataBytes) {
+    close();
+    if (slotCount == 0 || slotCount > 0xffffffffULL) return false;
+
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) return false;
+
+    // whoever creates the file fills in the header before anyone else can look at it
+    flock(_fd, LOCK_EX);
+
+    struct stat st;
+    bool ok = fstat(_fd, &st) == 0;
+    bool fresh = ok && st.st_size == 0;
+    size_t size = fresh ? sizeof(Header) + slotCount * sizeof(Slot) + dataBytes : (size_t)st.st_size;
+
+    if (ok && fresh) ok = ftruncate(_fd, (off_t)size) == 0;
+    if (ok && size < sizeof(Header)) ok = false;
+
+    if (ok) {
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (base == MAP_FAILED) ok = false;
+        else {
+            _base = static_cast<u8*>(base);
+            _size = size;
+        }
+    }
+
+    if (ok && fresh) {
+        Header* h = header();
+        h->version = CACHE_FILE_VERSION;
+        h->slotCount = (u32)slotCount;
+        h->rulesVersion = TRANSFORM_RULES_VERSION;
+        h->dataBytes = dataBytes;
+        h->dataEnd = 0;
+        std::atomic_ref<u64>(h->magic).store(CACHE_FILE_MAGIC, std::memory_order_release);
+    }
+
+    if (ok) {
+        // an existing file has to be one of ours, made by the same rules, and its sizes have to add up
+        const Header* h = header();
+        ok = h->magic == CACHE_FILE_MAGIC && h->version == CACHE_FILE_VERSION && h->rulesVersion == TRANSFORM_RULES_VERSION && h->slotCount > 0
+            && sizeof(Header) + (size_t)h->slotCount * sizeof(Slot) + h->dataBytes == _size;
+    }
+
+    flock(_fd, LOCK_UN);
+    if (!ok) close();
+    return ok;
+}
+
+void MappedCacheFile::close() {
+    if (_base) munmap(_base, _size);
+    if (_fd >= 0) ::close(_fd);
+    _base = nullptr;
+    _size = 0;
+    _fd = -1;
+}
+
+std::optional<NodeID> MappedCacheFile::lookup(const u64& hash, const AST& input, const NodeID& id, AST& output) const {
+    if (!_base) return std::nullopt;
+
+    const Header* h = header();
+    u64 target = fileHash(hash);
+    std::string key;
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        Slot& slot = slots()[(target + probe) % h->slotCount];
+        u64 slotHash = std::atomic_ref<u64>(slot.hash).load(std::memory_order_acquire);
+        if (slotHash == 0) return std::nullopt;
+        if (slotHash != target) continue;
+
+        // the record was finished before the hash got published
+        u64 offset = std::atomic_ref<u64>(slot.record).load(std::memory_order_acquire);
+        if (offset > h->dataBytes || h->dataBytes - offset < sizeof(RecordHeader)) continue;
+
+        RecordHeader record;
+        std::memcpy(&record, data() + offset, sizeof(RecordHeader));
+        if ((u64)record.keyLength + record.valueLength > h->dataBytes - offset - sizeof(RecordHeader)) continue;
+
+        const char* bytes = reinterpret_cast<const char*>(data() + offset + sizeof(RecordHeader));
+        std::string_view storedKey(bytes, record.keyLength);
+        std::string_view storedValue(bytes + record.keyLength, record.valueLength);
+        if (checksum(storedKey, storedValue) != record.checksum) continue;
+
+        if (key.empty()) serializeSubtree(input, id, key);
+        if (storedKey != key) continue;
+
+        // a bad value leaves some junk nodes in output, but no root pointing at them
+        if (std::optional<NodeID> value = deserializeSubtree(storedValue, output)) return value;
+    }
+    return std::nullopt;
+}
+
+bool MappedCacheFile::insert(const u64& hash, const AST& input, const NodeID& id, const AST& result, const NodeID& resultID) {
+    if (!_base) return false;
+
+    std::string key, value;
+    serializeSubtree(input, id, key);
+    serializeSubtree(result, resultID, value);
+    if (key.size() > 0xffffffffULL || value.size() > 0xffffffffULL) return false;
+
+    Header* h = header();
+    u64 target = fileHash(hash);
+    size_t recordSize = sizeof(RecordHeader) + key.size() + value.size();
+    // keeps every RecordHeader 8-byte aligned
+    size_t alignedSize = (recordSize + 7) & ~(size_t)7;
+
+    // flock only keeps other processes out, threads sharing this fd need the mutex too
+    std::lock_guard<std::mutex> lock(_writeMutex);
+    flock(_fd, LOCK_EX);
+
+    bool inserted = false;
+    u64 dataEnd = std::atomic_ref<u64>(h->dataEnd).load(std::memory_order_acquire);
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        Slot& slot = slots()[(target + probe) % h->slotCount];
+        u64 slotHash = std::atomic_ref<u64>(slot.hash).load(std::memory_order_acquire);
+        if (slotHash == target) break;  // some process already put it there
+        if (slotHash != 0) continue;
+
+        if (h->dataBytes - dataEnd < alignedSize) break;
+
+        RecordHeader record{ target, (u32)key.size(), (u32)value.size(), checksum(key, value) };
+        u8* out = data() + dataEnd;
+        std::memcpy(out, &record, sizeof(RecordHeader));
+        std::memcpy(out + sizeof(RecordHeader), key.data(), key.size());
+        std::memcpy(out + sizeof(RecordHeader) + key.size(), value.data(), value.size());
+
+        std::atomic_ref<u64>(h->dataEnd).store(dataEnd + alignedSize, std::memory_order_release);
+        std::atomic_ref<u64>(slot.record).store(dataEnd, std::memory_order_release);
+        std::atomic_ref<u64>(slot.hash).store(target, std::memory_order_release);
+        inserted = true;
+        break;
+    }
+
+    flock(_fd, LOCK_UN);
+    return inserted;
+}
@@ -0,0 +1,161 @@
+/*
+Transform Cache
+
+The same little subexpressions show up over and over in real
+input, like \sin(\frac{\pi}{6}), \ln(x^2), or (x + 1) in every
+other polynomial, and transform() runs its whole fixed-point
+loop on each of them every time.
+
+TransformCache remembers the answer. It maps the structural
+hash of an input subtree (see structuralHashes in nodetools) to
+its fully transformed result:
+
+    hash(sin(pi/6))  ->  1/2
+
+Each entry keeps its own copy of the input subtree too, so a
+hash collision gets caught by a structurallyEqual check and is
+just a miss instead of a wrong answer.
+
+It's bounded. Entries sit in a list in least-recently-used
+order, and once it's full, a new entry pushes out the one at
+the back. Lookups and inserts lock a mutex, so one cache can be
+shared by every thread of a batch job.
+
+transform(input, output, &cache) looks whole inputs up in it,
+see transformer.h.
+
+--
+Persisting it
+
+A cache that only lives in memory starts cold every time the
+process does. persistTo() backs it with a MappedCacheFile, a
+fixed-size file that every process mmaps and shares:
+
+    [ header | slots (hash, record offset) ... | records ... ]
+
+Slots are an open-addressed hash table (a few probes, then give
+up), records are appended to the data region and never move:
+
+    record: hash, key length, value length, checksum, key, value
+
+where key and value are subtrees in the serialize.h format.
+The key is what gets compared on lookup, since equal structure
+means equal bytes.
+
+Readers never lock. A writer takes flock() on the file so only
+one process appends at a time, writes the whole record, and only
+then publishes it by storing the record offset and then the hash
+into the slot with release stores. A reader that sees the hash
+(acquire) is guaranteed to see a finished record. The checksum
+catches anything left half written by a crash. The file is
+append-only, so once it's full new results just stay in memory.
+
+What's in the file is only right for the transformer that wrote
+it. The header records TRANSFORM_RULES_VERSION (see
+transformer.h), and a file from other rules is turned away by
+persistTo() rather than served, so after the passes change the
+old file has to be deleted or a new path used.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "nodetools.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+struct CacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t collisions = 0;  // same hash, different tree, counted as misses too
+    size_t insertions = 0;
+    size_t evictions = 0;
+    size_t fileHits = 0;    // hits that came from the persisted file, included in hits
+
+    double hitRate() const {
+        size_t lookups = hits + misses;
+        return lookups == 0 ? 0.0 : (double)hits / (double)lookups;
+    }
+};
+
+// the shared, append-only file behind a persistent TransformCache
+class MappedCacheFile {
+    public:
+        MappedCacheFile() = default;
+        ~MappedCacheFile();
+        MappedCacheFile(const MappedCacheFile&) = delete;
+        MappedCacheFile& operator=(const MappedCacheFile&) = delete;
+
+        // opens or creates path, an existing file keeps the sizes it was created with
+        // returns false if it can't be opened, isn't a cache file, or was written under other transform rules
+        bool open(const std::string& path, const size_t& slotCount = 1 << 16, const size_t& dataBytes = 64 << 20);
+        void close();
+        bool isOpen() const { return _base != nullptr; }
+
+        // same as TransformCache::lookup
+        std::optional<NodeID> lookup(const u64& hash, const AST& input, const NodeID& id, AST& output) const;
+        // false if there's no free slot near hash or no room left for the record
+        bool insert(const u64& hash, const AST& input, const NodeID& id, const AST& result, const NodeID& resultID);
+
+    private:
+        struct Header;
+        struct Slot;
+
+        int _fd = -1;
+        u8* _base = nullptr;
+        size_t _size = 0;
+        std::mutex _writeMutex;
+
+        Header* header() const;
+        Slot* slots() const;
+        u8* data() const;
+};
+
+class TransformCache {
+    public:
+        // capacity is in entries
+        explicit TransformCache(const size_t& capacity = 4096);
+
+        // on a hit, clones the cached result into output and returns it
+        std::optional<NodeID> lookup(const u64& hash, const AST& input, const NodeID& id, AST& output);
+
+        // remembers that input's subtree at id transforms into result's subtree at resultID
+        void insert(const u64& hash, const AST& input, const NodeID& id, const AST& result, const NodeID& resultID);
+
+        size_t capacity() const { return _capacity; }
+        size_t size() const;
+        CacheStats stats() const;
+
+        // drops every entry and resets the stats, doesn't touch a persisted file
+        void clear();
+
+        // also keeps results in the shared file at path, see MappedCacheFile
+        bool persistTo(const std::string& path, const size_t& slotCount = 1 << 16, const size_t& dataBytes = 64 << 20);
+
+    private:
+        struct Entry {
+            u64 hash;
+            AST ast;        // holds both the key and the value trees
+            NodeID key;
+            NodeID value;
+        };
+
+        size_t _capacity;
+
+        // front is the most recently used
+        std::list<Entry> _entries;
+        std::unordered_map<u64, std::list<Entry>::iterator> _index;
+        CacheStats _stats;
+        mutable std::mutex _mutex;
+
+        std::unique_ptr<MappedCacheFile> _file;
+
+        // puts an entry at the front, evicting if full, _mutex has to be held
+        void remember(Entry entry);
+};
+
+#endif
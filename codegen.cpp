@@ -0,0 +1,527 @@
+#include "codegen.h"
+#include "nodetools.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+// every shared object exports these, whatever formula is in it
+static constexpr const char* ENTRY_NAME = "expression";
+// more than this many different formulas on one hash is not a collision anymore
+static constexpr size_t MAX_PROBES = 4;
+
+NativeProgram::~NativeProgram() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (_handle) dlclose(_handle);
+#endif
+}
+
+NativeProgram::NativeProgram(NativeProgram&& other) noexcept {
+    *this = std::move(other);
+}
+
+NativeProgram& NativeProgram::operator=(NativeProgram&& other) noexcept {
+    if (this == &other) return *this;
+#if defined(__unix__) || defined(__APPLE__)
+    if (_handle) dlclose(_handle);
+#endif
+    _handle = std::exchange(other._handle, nullptr);
+    _function = std::exchange(other._function, nullptr);
+    _columns = std::exchange(other._columns, nullptr);
+    _variables = std::move(other._variables);
+    _path = std::move(other._path);
+    return *this;
+}
+
+// an exact C literal, %a round trips where %g wouldn't
+static std::string literal(const double& value) {
+    if (std::isnan(value)) return "NAN";
+    if (std::isinf(value)) return value < 0 ? "(-INFINITY)" : "INFINITY";
+
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%a", value);
+    return value < 0 || std::signbit(value) ? "(" + std::string(buffer) + ")" : std::string(buffer);
+}
+
+// how a register reads in C, constants are written in place so cc can fold them
+static std::string operand(const Program& program, const u32& r) {
+    size_t constantCount = program.constants().size();
+    if (r < constantCount) return literal(program.constants()[r]);
+    if (r < constantCount + program.variables().size()) return "v" + std::to_string(r - constantCount);
+    return "r" + std::to_string(r);
+}
+
+static std::string expression(const Program& program, const Instruction& in) {
+    std::string a = operand(program, in.a);
+    std::string b = operand(program, in.b);
+
+    switch (in.op) {
+        case OpCode::Add: return a + " + " + b;
+        case OpCode::Subtract: return a + " - " + b;
+        case OpCode::Multiply: return a + " * " + b;
+        case OpCode::Divide: return a + " / " + b;
+        case OpCode::Power: return "mc_pow(" + a + ", " + b + ")";
+        case OpCode::PowerRoot: return "mc_root(" + a + ", " + b + ", " + std::to_string(in.flag) + ")";
+        case OpCode::Negate: return "-" + a;
+        case OpCode::Factorial: return "tgamma(" + a + " + 1)";
+        case OpCode::Percent: return a + " / 100";
+        case OpCode::Sine: return "sin(" + a + ")";
+        case OpCode::Cosine: return "cos(" + a + ")";
+        case OpCode::Tangent: return "tan(" + a + ")";
+        case OpCode::Atan2: return "atan2(" + a + ", " + b + ")";
+        // exact, so it can stay inline even without builtins
+        case OpCode::AbsoluteValue: return "__builtin_fabs(" + a + ")";
+        case OpCode::Exponential: return "exp(" + a + ")";
+        case OpCode::NaturalLogarithm: return "log(" + a + ")";
+        case OpCode::Logarithm: return "log10(" + a + ")";
+        case OpCode::LogarithmBase: return "log(" + a + ") / log(" + b + ")";
+        case OpCode::Hypotenuse: return "hypot(" + a + ", " + b + ")";
+        case OpCode::Max: return "fmax(" + a + ", " + b + ")";
+        case OpCode::Min: return "fmin(" + a + ", " + b + ")";
+        case OpCode::Polygamma: return "mc_polygamma(" + a + ", " + b + ")";
+    }
+    return a;
+}
+
+static bool isIdentifier(const std::string& name) {
+    if (name.empty() || std::isdigit((unsigned char)name[0])) return false;
+    for (char c : name) {
+        if (!std::isalnum((unsigned char)c) && c != '_') return false;
+    }
+    return true;
+}
+
+std::string generateC(const Program& program, const std::string& name) {
+    if (!isIdentifier(name)) throw EvaluatorError(UnknownPos, "Not a C identifier: \"" + name + "\"");
+
+    size_t variableCount = program.variables().size();
+    std::ostringstream out;
+
+    out << "// generated, variables in slot order:";
+    for (size_t v = 0; v < variableCount; v++) out << (v ? ", " : " ") << program.variables()[v];
+    out << "\n\n";
+
+    // same as applyOp, x*x is exact and pow can be an ulp off
+    out << "#include <math.h>\n"
+           "#include <stddef.h>\n"
+           "\n"
+           "static inline double mc_pow(double a, double b) {\n"
+           "    return b == 2 ? a * a : pow(a, b);\n"
+           "}\n"
+           "\n"
+           "static inline double mc_root(double a, double b, int odd) {\n"
+           "    if (a >= 0) return pow(a, b);\n"
+           "    double magnitude = pow(-a, b);\n"
+           "    return odd ? -magnitude : magnitude;\n"
+           "}\n"
+           "\n";
+
+    // polygamma() from the evaluator, step for step so it rounds the same, only if it's needed
+    bool polygamma = std::any_of(program.code().begin(), program.code().end(), [](const Instruction& in) { return in.op == OpCode::Polygamma; });
+    if (polygamma) {
+        out << "static double mc_polygamma(double order, double x) {\n"
+               "    static const double bernoulli[] = { 1.0 / 6, -1.0 / 30, 1.0 / 42, -1.0 / 30, 5.0 / 66, -691.0 / 2730, 7.0 / 6 };\n"
+               "    if (isnan(order) || isnan(x)) return NAN;\n"
+               "    if (order < 0 || order != floor(order)) return NAN;\n"
+               "    if (x <= 0 && x == floor(x)) return NAN;\n"
+               "    if (order == 0) {\n"
+               "        double y = x;\n"
+               "        double result = 0;\n"
+               "        if (y < 0) {\n"
+               "            result -= 0x1.921fb54442d18p+1 / tan(0x1.921fb54442d18p+1 * y);\n"
+               "            y = 1 - y;\n"
+               "        }\n"
+               "        while (y < 10) {\n"
+               "            result -= 1 / y;\n"
+               "            y += 1;\n"
+               "        }\n"
+               "        double inv2 = 1 / (y * y);\n"
+               "        double series = inv2 * (1.0 / 12 - inv2 * (1.0 / 120 - inv2 * (1.0 / 252 - inv2 * (1.0 / 240 - inv2 * (1.0 / 132)))));\n"
+               "        return result + log(y) - 0.5 / y - series;\n"
+               "    }\n"
+               "    double s = order + 1;\n"
+               "    double y = x;\n"
+               "    double zeta = 0;\n"
+               "    while (y < 10 + order) {\n"
+               "        zeta += pow(y, -s);\n"
+               "        y += 1;\n"
+               "    }\n"
+               "    zeta += pow(y, 1 - s) / (s - 1) + 0.5 * pow(y, -s);\n"
+               "    double inv2 = 1 / (y * y);\n"
+               "    double term = s * pow(y, -s - 1) / 2;\n"
+               "    for (int k = 1; k <= 7; k++) {\n"
+               "        zeta += bernoulli[k - 1] * term;\n"
+               "        term *= (s + 2 * k - 1) * (s + 2 * k) / ((2 * k + 1) * (2 * k + 2)) * inv2;\n"
+               "    }\n"
+               "    double sign = fmod(order, 2) == 1 ? 1 : -1;\n"
+               "    return sign * tgamma(s) * zeta;\n"
+               "}\n"
+               "\n";
+    }
+
+    // the Program itself, with every variable as a parameter so both entry points can inline it
+    out << "static inline double " << name << "_eval(";
+    if (variableCount == 0) out << "void";
+    for (size_t v = 0; v < variableCount; v++) out << (v ? ", " : "") << "double v" << v;
+    out << ") {\n";
+
+    std::vector<bool> declared(program.registerCount(), false);
+    for (const Instruction& in : program.code()) {
+        out << "    ";
+        if (!declared[in.dst]) {
+            out << "double ";
+            declared[in.dst] = true;
+        }
+        out << "r" << in.dst << " = " << expression(program, in) << ";\n";
+    }
+    out << "    return " << operand(program, program.result()) << ";\n"
+           "}\n"
+           "\n";
+
+    out << "double " << name << "(const double* vars) {\n"
+           "    return " << name << "_eval(";
+    for (size_t v = 0; v < variableCount; v++) out << (v ? ", " : "") << "vars[" << v << "]";
+    out << ");\n"
+           "}\n"
+           "\n";
+
+    out << "void " << name << "_columns(const double* const* columns, double* restrict out, size_t rows) {\n";
+    for (size_t v = 0; v < variableCount; v++) out << "    const double* restrict c" << v << " = columns[" << v << "];\n";
+    out << "    for (size_t i = 0; i < rows; i++) out[i] = " << name << "_eval(";
+    for (size_t v = 0; v < variableCount; v++) out << (v ? ", " : "") << "c" << v << "[i]";
+    out << ");\n"
+           "}\n";
+
+    return out.str();
+}
+
+std::string generateC(const AST& ast, const NodeID& id, const std::string& name) {
+    return generateC(compile(ast, id), name);
+}
+
+// what the formula and the way it's built hash to, names its files in the cache directory
+static u64 cacheKey(const AST& ast, const NodeID& id, const CodegenOptions& options) {
+    u64 key = hashCombine(structuralHash(ast, id), std::hash<std::string>{}(options.compiler));
+    for (const std::string& flag : options.flags) key = hashCombine(key, std::hash<std::string>{}(flag));
+    return key;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// $XDG_CACHE_HOME/mathcodegen, or ~/.cache/mathcodegen, never anywhere shared like /tmp
+static std::string cacheDirectory(const CodegenOptions& options) {
+    if (!options.cacheDir.empty()) return options.cacheDir;
+
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0] == '/') return std::string(xdg) + "/mathcodegen";
+
+    const char* home = std::getenv("HOME");
+    if (!home || !*home) {
+        const passwd* user = getpwuid(geteuid());
+        home = user ? user->pw_dir : nullptr;
+    }
+    if (!home || !*home) throw EvaluatorError(UnknownPos, "No home directory for the native code cache, set CodegenOptions::cacheDir");
+    return std::string(home) + "/.cache/mathcodegen";
+}
+
+// makes directory (0700) if it isn't there, and refuses it unless only this user can write to it
+static void openPrivateDirectory(const std::string& directory) {
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(directory).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, error);
+    if (error || (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)) {
+        throw EvaluatorError(UnknownPos, "Can't create cache directory " + directory);
+    }
+
+    // lstat, a symlink to somewhere else doesn't count
+    struct stat st;
+    if (lstat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        throw EvaluatorError(UnknownPos, "Cache directory " + directory + " isn't a directory");
+    }
+    if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        throw EvaluatorError(UnknownPos, "Cache directory " + directory + " has to be owned by this user and not writable by anyone else");
+    }
+}
+
+// FNV-1a over every byte, so a .so that isn't exactly what was built (torn, swapped, left over) never gets loaded
+static u64 digest(std::string_view bytes) {
+    u64 h = 0xcbf29ce484222325ULL;
+    for (const char& c : bytes) {
+        h ^= static_cast<u8>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// what a .sum file says: the .so's digest and size, and the source it was built from
+struct ObjectSum {
+    u64 digest = 0;
+    u64 size = 0;
+    std::string source;
+};
+
+static std::string formatSum(const ObjectSum& sum) {
+    char line[64];
+    std::snprintf(line, sizeof(line), "%016llx %llu\n", (unsigned long long)sum.digest, (unsigned long long)sum.size);
+    return line + sum.source;
+}
+
+static std::optional<ObjectSum> parseSum(const std::string& contents) {
+    size_t newline = contents.find('\n');
+    if (newline == std::string::npos) return std::nullopt;
+
+    unsigned long long digest = 0, size = 0;
+    if (std::sscanf(contents.c_str(), "%16llx %llu", &digest, &size) != 2) return std::nullopt;
+    return ObjectSum{ digest, size, contents.substr(newline + 1) };
+}
+
+// opens path without following a link, only if it's a plain file of this user's
+static int openOwned(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static std::optional<std::string> readAll(const int& fd) {
+    std::string bytes;
+    char buffer[1 << 16];
+    off_t offset = 0;
+    while (true) {
+        ssize_t n = pread(fd, buffer, sizeof(buffer), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return std::nullopt;
+        if (n == 0) return bytes;
+        bytes.append(buffer, (size_t)n);
+        offset += n;
+    }
+}
+
+static std::optional<ObjectSum> readSum(const std::string& path) {
+    int fd = openOwned(path);
+    if (fd < 0) return std::nullopt;
+    std::optional<std::string> contents = readAll(fd);
+    close(fd);
+    return contents ? parseSum(*contents) : std::nullopt;
+}
+
+// dlopen()s path only if its bytes are the ones sum was written for, nullptr otherwise
+// (not through /proc/self/fd, glibc takes a reused fd's name for the object it already loaded under it)
+// only this user can write to the directory, so nobody else gets to swap it in between
+static void* openVerified(const std::string& path, const ObjectSum& sum) {
+    int fd = openOwned(path);
+    if (fd < 0) return nullptr;
+    std::optional<std::string> bytes = readAll(fd);
+    close(fd);
+
+    if (!bytes || bytes->size() != sum.size || digest(*bytes) != sum.digest) return nullptr;
+    return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool writeFile(const std::string& path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << contents;
+    file.close();
+    return !file.fail();
+}
+
+// runs the compiler on source, loads what it made and only then puts it at stem.so with its stem.sum
+// everything the compiler prints goes into the exception
+static void* buildSharedObject(const std::string& source, const std::string& stem, const CodegenOptions& options) {
+    // built under names of its own and renamed over, so nobody sees half a file
+    static std::atomic<u64> counter = 0;
+    std::string temp = stem + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    std::string cPath = temp + ".c";
+    std::string soPath = temp + ".so";
+    std::string sumPath = temp + ".sum";
+    std::string logPath = temp + ".log";
+
+    auto cleanup = [&]() {
+        unlink(cPath.c_str());
+        unlink(soPath.c_str());
+        unlink(sumPath.c_str());
+        unlink(logPath.c_str());
+    };
+
+    if (!writeFile(cPath, source)) {
+        cleanup();
+        throw EvaluatorError(UnknownPos, "Can't write " + cPath);
+    }
+
+    std::vector<std::string> args = { options.compiler };
+    args.insert(args.end(), options.flags.begin(), options.flags.end());
+    for (const char* arg : { "-fPIC", "-shared", "-o" }) args.push_back(arg);
+    args.push_back(soPath);
+    args.push_back(cPath);
+    args.push_back("-lm");
+
+    std::vector<char*> argv;
+    for (std::string& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    pid_t pid = 0;
+    int spawned = posix_spawnp(&pid, options.compiler.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) {
+        cleanup();
+        throw EvaluatorError(UnknownPos, "Can't run C compiler \"" + options.compiler + "\"");
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) break;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::string log = readFile(logPath);
+        cleanup();
+        throw EvaluatorError(UnknownPos, "C compiler failed: " + log);
+    }
+
+    // the sum is of the bytes that get loaded here
+    int fd = openOwned(soPath);
+    std::optional<std::string> bytes = fd >= 0 ? readAll(fd) : std::nullopt;
+    if (fd >= 0) close(fd);
+    ObjectSum sum{ bytes ? digest(*bytes) : 0, bytes ? bytes->size() : 0, source };
+    void* handle = bytes ? openVerified(soPath, sum) : nullptr;
+    if (!handle) {
+        const char* reason = dlerror();
+        cleanup();
+        throw EvaluatorError(UnknownPos, "Can't load " + soPath + (reason ? std::string(": ") + reason : ""));
+    }
+
+    // the .so goes in first, and the .sum that vouches for it last
+    bool ok = rename(soPath.c_str(), (stem + ".so").c_str()) == 0
+           && writeFile(sumPath, formatSum(sum))
+           && rename(sumPath.c_str(), (stem + ".sum").c_str()) == 0;
+    // only kept for people to look at
+    rename(cPath.c_str(), (stem + ".c").c_str());
+    cleanup();
+    if (!ok) {
+        dlclose(handle);
+        throw EvaluatorError(UnknownPos, "Can't write " + stem + ".so");
+    }
+    return handle;
+}
+
+// finds or builds the shared object for source and loads it, path is where it was found
+static void* loadNative(const std::string& source, const u64& key, const CodegenOptions& options, std::string& path) {
+    std::string directory = cacheDirectory(options);
+    openPrivateDirectory(directory);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+
+    // a colliding formula moves over to the next name, like an open-addressed table
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        std::string stem = directory + "/" + name + (probe ? "-" + std::to_string(probe) : "");
+        path = stem + ".so";
+
+        std::optional<ObjectSum> sum = readSum(stem + ".sum");
+        // another formula's
+        if (sum && sum->source != source) continue;
+        if (sum) {
+            if (void* handle = openVerified(path, *sum)) return handle;
+        }
+
+        // not there, half there, or not matching its sum, built over either way
+        return buildSharedObject(source, stem, options);
+    }
+    throw EvaluatorError(UnknownPos, "Too many different formulas on cache key " + std::string(name));
+}
+
+NativeProgram compileNative(const AST& ast, const NodeID& id, const CodegenOptions& options) {
+    Program program = compile(ast, id);
+
+    NativeProgram native;
+    native._handle = loadNative(generateC(program, ENTRY_NAME), cacheKey(ast, id, options), options, native._path);
+    native._function = (NativeFunction)dlsym(native._handle, ENTRY_NAME);
+    native._columns = (NativeColumnsFunction)dlsym(native._handle, (std::string(ENTRY_NAME) + "_columns").c_str());
+    native._variables = program.variables();
+    if (!native._function || !native._columns) throw EvaluatorError(UnknownPos, "Missing entry points in " + native._path);
+    return native;
+}
+
+#else
+
+NativeProgram compileNative(const AST&, const NodeID&, const CodegenOptions&) {
+    throw EvaluatorError(UnknownPos, "Native code generation isn't supported on this platform");
+}
+
+#endif
+
+std::shared_ptr<const NativeProgram> NativeCache::get(const AST& ast, const NodeID& id) {
+    u64 key = cacheKey(ast, id, _options);
+    std::string source = generateC(ast, id, ENTRY_NAME);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto [begin, end] = _entries.equal_range(key);
+        bool collided = begin != end;
+        for (auto it = begin; it != end; it++) {
+            if (it->second.source == source) {
+                _stats.hits++;
+                return it->second.program;
+            }
+        }
+        _stats.misses++;
+        if (collided) _stats.collisions++;
+    }
+
+    // cc can take a while, other threads keep going in the meantime
+    auto program = std::make_shared<const NativeProgram>(compileNative(ast, id, _options));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto [begin, end] = _entries.equal_range(key);
+    for (auto it = begin; it != end; it++) {
+        // someone else got there first
+        if (it->second.source == source) return it->second.program;
+    }
+    _entries.insert({ key, { std::move(source), program } });
+    return program;
+}
+
+size_t NativeCache::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+NativeCacheStats NativeCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
@@ -0,0 +1,162 @@
+/*
+C Code Generation
+
+The JIT is quick to build but only does what it can work out in
+one linear pass. For formulas that stay the same for weeks it's
+worth paying a real C compiler once and getting its full
+optimizer instead. generateC() writes a compiled Program out as
+a standalone C file with two functions in it:
+
+    double f(const double* vars);
+    void f_columns(const double* const* columns, double* out, size_t rows);
+
+The first one is a single row, vars in the Program's slot order
+like everywhere else. The second one runs the same code over
+whole columns, the way evaluateColumns() does, as one plain loop
+the compiler is free to unroll and vectorize.
+
+Every register of the Program becomes a local, constants are
+written out as hex float literals so nothing gets lost on the
+way, and every op turns into the same libm call applyOp makes.
+The generated file is compiled without -ffast-math, with
+contraction off (no fused multiply-adds) and without builtins,
+so cc can't fold a libm call into something close to it, and
+its results are the VM's results.
+
+compileNative() then runs the system compiler on that file to
+get a shared object and dlopen()s it:
+
+    NativeProgram native = compileNative(ast, ast.root);
+    double vars[] = { 2.0 };            // in native.variables() order
+    double value = native(vars);
+
+--
+Caching
+
+Running cc takes a good fraction of a second, so every shared
+object is kept in a cache directory, named after the structural
+hash of the expression (see structuralHashes in nodetools) mixed
+with the compiler and its flags:
+
+    <cacheDir>/3f9a0c1d2e4b5a67.so
+    <cacheDir>/3f9a0c1d2e4b5a67.sum
+    <cacheDir>/3f9a0c1d2e4b5a67.c     (just for reading)
+
+Loading a shared object runs code, so nothing gets dlopen()ed
+before it's been checked. The directory defaults to
+$XDG_CACHE_HOME/mathcodegen or ~/.cache/mathcodegen, is made
+0700, and is refused (custom ones too) unless it's owned by this
+user and nobody else can write to it. Next to every .so is a .sum
+with the digest and size of its bytes and the code it was built
+from. The .so has to match the digest before it gets loaded.
+
+If the code in the .sum isn't byte for byte what would be
+generated now, it was a hash collision, and the formula moves on
+to 3f9a0c1d2e4b5a67-1.so and so on. A .so that's missing or
+doesn't match its .sum gets built over. New files are built under
+a temporary name and renamed into place, the .sum last, so several
+processes can share a directory.
+
+NativeCache keeps the loaded ones around in memory on top of
+that, so asking for the same formula again doesn't even touch
+the disk. Only available where there's dlopen, NATIVE_SUPPORTED
+is false everywhere else and compileNative throws.
+*/
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "bytecode.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+inline constexpr bool NATIVE_SUPPORTED = true;
+#else
+inline constexpr bool NATIVE_SUPPORTED = false;
+#endif
+
+// takes the variable values in slot order
+using NativeFunction = double (*)(const double* vars);
+// columns[i] holds rows values for variables()[i], same as evaluateColumns
+using NativeColumnsFunction = void (*)(const double* const* columns, double* out, size_t rows);
+
+struct CodegenOptions {
+    std::string compiler = "cc";
+    // contraction stays off, an fma rounds differently than the VM, and without builtins
+    // cc can't swap pow(x, -1) for 1 / x, which isn't always what libm gives either
+    std::vector<std::string> flags = { "-O3", "-march=native", "-ffp-contract=off", "-fno-builtin" };
+    // empty means $XDG_CACHE_HOME/mathcodegen, or ~/.cache/mathcodegen, has to be private to this user
+    std::string cacheDir;
+};
+
+// owns the dlopen() handle, so the function pointers are only good while this is alive
+class NativeProgram {
+    public:
+        NativeProgram() = default;
+        ~NativeProgram();
+        NativeProgram(NativeProgram&& other) noexcept;
+        NativeProgram& operator=(NativeProgram&& other) noexcept;
+        NativeProgram(const NativeProgram&) = delete;
+        NativeProgram& operator=(const NativeProgram&) = delete;
+
+        NativeFunction function() const { return _function; }
+        NativeColumnsFunction columns() const { return _columns; }
+        double operator()(const double* vars) const { return _function(vars); }
+
+        // variable names in slot order, same as the Program's
+        const std::vector<std::string>& variables() const { return _variables; }
+        // the shared object it was loaded from
+        const std::string& path() const { return _path; }
+
+    private:
+        void* _handle = nullptr;
+        NativeFunction _function = nullptr;
+        NativeColumnsFunction _columns = nullptr;
+        std::vector<std::string> _variables;
+        std::string _path;
+
+        friend NativeProgram compileNative(const AST& ast, const NodeID& id, const CodegenOptions& options);
+};
+
+// C source defining name() and name_columns(), name has to be a valid C identifier
+std::string generateC(const Program& program, const std::string& name);
+std::string generateC(const AST& ast, const NodeID& id, const std::string& name);
+
+// compiles (or finds in options.cacheDir) the subtree at id and loads it
+// throws EvaluatorError if it doesn't compile to a Program, or cc or dlopen fail
+NativeProgram compileNative(const AST& ast, const NodeID& id, const CodegenOptions& options = {});
+
+struct NativeCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;      // went to compileNative, which may still find it on disk
+    size_t collisions = 0;  // same hash, different code, counted as misses too
+};
+
+// the loaded NativePrograms of one process, safe to share between threads
+class NativeCache {
+    public:
+        explicit NativeCache(const CodegenOptions& options = {}) : _options(options) {}
+
+        // compiles on a miss, the result stays loaded as long as the cache or a caller holds it
+        std::shared_ptr<const NativeProgram> get(const AST& ast, const NodeID& id);
+
+        size_t size() const;
+        NativeCacheStats stats() const;
+        const CodegenOptions& options() const { return _options; }
+
+    private:
+        struct Entry {
+            std::string source;
+            std::shared_ptr<const NativeProgram> program;
+        };
+
+        CodegenOptions _options;
+        std::unordered_multimap<u64, Entry> _entries;
+        NativeCacheStats _stats;
+        mutable std::mutex _mutex;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "columns.h"
+
+#include <algorithm>
+#include <type_traits>
+
+// AVX-512 and AVX2 versions of the tile kernel, picked once at load time
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define TILE_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define TILE_KERNEL
+#endif
+
+// d can be the same tile as a or b, but never partly overlaps one, so every lane is independent
+#define TILE_LOOP(expr)                                     \
+    _Pragma("GCC ivdep")                                    \
+    for (size_t i = 0; i < COLUMN_TILE; i++) d[i] = (expr); \
+    break;
+
+// one instruction over one tile, the fixed trip count lets these vectorize without a scalar tail
+TILE_KERNEL
+static void runTile(const OpCode op, const u8 flag, double* d, const double* a, const double* b) {
+    switch (op) {
+        case OpCode::Add: TILE_LOOP(a[i] + b[i])
+        case OpCode::Subtract: TILE_LOOP(a[i] - b[i])
+        case OpCode::Multiply: TILE_LOOP(a[i] * b[i])
+        case OpCode::Divide: TILE_LOOP(a[i] / b[i])
+        case OpCode::Negate: TILE_LOOP(-a[i])
+        case OpCode::Percent: TILE_LOOP(a[i] / 100)
+        case OpCode::AbsoluteValue: TILE_LOOP(std::fabs(a[i]))
+        // the rest are libm calls, one element at a time
+        default: {
+            for (size_t i = 0; i < COLUMN_TILE; i++) d[i] = applyOp(op, flag, a[i], b[i]);
+            break;
+        }
+    }
+}
+
+#undef TILE_LOOP
+
+template <class T>
+static void evaluateTiles(const Program& program, std::span<const T* const> columns, T* out, const size_t& rows) {
+    const std::vector<double>& constants = program.constants();
+    size_t constantCount = constants.size();
+    size_t variableCount = program.variables().size();
+
+    if (columns.size() < variableCount) throw EvaluatorError(UnknownPos, "Not enough variable columns");
+    if (rows == 0) return;
+
+    // a tile per register, variables only use theirs for copies
+    thread_local std::vector<double> scratch;
+    if (scratch.size() < program.registerCount() * COLUMN_TILE) scratch.resize(program.registerCount() * COLUMN_TILE);
+
+    // where every register's tile is this time around
+    thread_local std::vector<double*> reg;
+    reg.assign(program.registerCount(), nullptr);
+    for (size_t r = 0; r < program.registerCount(); r++) reg[r] = scratch.data() + r * COLUMN_TILE;
+
+    // constants never get written, so they're filled in once for the whole run
+    for (size_t c = 0; c < constantCount; c++) std::fill_n(reg[c], COLUMN_TILE, constants[c]);
+
+    for (size_t start = 0; start < rows; start += COLUMN_TILE) {
+        size_t count = std::min(COLUMN_TILE, rows - start);
+
+        for (size_t v = 0; v < variableCount; v++) {
+            double* tile = scratch.data() + (constantCount + v) * COLUMN_TILE;
+            if constexpr (std::is_same_v<T, double>) {
+                // read in place, the kernels never write to a variable's register
+                if (count == COLUMN_TILE) {
+                    reg[constantCount + v] = const_cast<double*>(columns[v] + start);
+                    continue;
+                }
+            }
+            std::copy_n(columns[v] + start, count, tile);
+            std::fill(tile + count, tile + COLUMN_TILE, 0.0);
+            reg[constantCount + v] = tile;
+        }
+
+        for (const Instruction& in : program.code()) runTile(in.op, in.flag, reg[in.dst], reg[in.a], reg[in.b]);
+
+        const double* result = reg[program.result()];
+        for (size_t i = 0; i < count; i++) out[start + i] = (T)result[i];
+    }
+}
+
+void evaluateColumns(const Program& program, std::span<const double* const> columns, double* out, const size_t& rows) {
+    evaluateTiles<double>(program, columns, out, rows);
+}
+
+void evaluateColumns(const Program& program, std::span<const float* const> columns, float* out, const size_t& rows) {
+    evaluateTiles<float>(program, columns, out, rows);
+}
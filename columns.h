@@ -0,0 +1,44 @@
+/*
+Columnar Evaluation
+
+Program::run does one row at a time, so for every row it goes
+through the whole dispatch loop again and every op only does a
+single scalar bit of math. When the same formula runs over a
+whole dataset, it's much faster to flip it around: run each
+instruction over a whole block of rows before moving on to the
+next one.
+
+    columns:   x = [ x0 x1 x2 ... ]
+               y = [ y0 y1 y2 ... ]
+
+    r4 = x * y      r4[0..256) = x[0..256) * y[0..256)
+    r4 = r4 + 1     r4[0..256) = r4[0..256) + 1
+    ...
+
+Rows go through in tiles of COLUMN_TILE at a time. That's
+small enough that every register's tile stays in cache while
+the whole program runs over it, and big enough that the
+dispatch is nothing next to the math. Each op is a plain loop
+over a tile, which the compiler turns into AVX2 or AVX-512
+where the machine has it (picked at load time on x86-64 GCC
+builds, plain SSE2 otherwise). Ops that end up in libm, like
+sin or pow, still go element by element.
+
+Variable columns are read in place, nothing gets copied except
+for the last partial tile. Float columns work too, they're
+widened to double per tile so the results match the double
+version before being rounded back down.
+*/
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include "bytecode.h"
+
+inline constexpr size_t COLUMN_TILE = 256;
+
+// columns[i] holds rows values for program.variables()[i], results go into out[0..rows)
+void evaluateColumns(const Program& program, std::span<const double* const> columns, double* out, const size_t& rows);
+void evaluateColumns(const Program& program, std::span<const float* const> columns, float* out, const size_t& rows);
+
+#endif
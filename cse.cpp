@@ -0,0 +1,155 @@
+#include "cse.h"
+#include "nodetools.h"
+
+#include <bit>
+
+// same node, children compared by NodeID since they're already unique
+static bool shallowEqual(const ASTNode& a, const ASTNode& b) {
+    if (a.kind.index() != b.kind.index()) return false;
+
+    return std::visit([&](const auto& nodeA) -> bool {
+        using T = std::decay_t<decltype(nodeA)>;
+        const T& nodeB = std::get<T>(b.kind);
+
+        if constexpr (std::is_same_v<T, ConstantNode>) return nodeA.cKind == nodeB.cKind;
+        // bit for bit, 0.0 and -0.0 are different numbers to divide by
+        if constexpr (std::is_same_v<T, RealNode>) return std::bit_cast<u64>(nodeA.value) == std::bit_cast<u64>(nodeB.value);
+        if constexpr (std::is_same_v<T, RationalNode>) return nodeA.numerator == nodeB.numerator && nodeA.denominator == nodeB.denominator;
+        if constexpr (std::is_same_v<T, IdentifierNode>) return nodeA.name == nodeB.name;
+        if constexpr (std::is_same_v<T, BinaryOpNode>) {
+            return nodeA.bKind == nodeB.bKind && nodeA.left.i == nodeB.left.i && nodeA.right.i == nodeB.right.i;
+        }
+        if constexpr (std::is_same_v<T, UnaryOpNode>) return nodeA.uKind == nodeB.uKind && nodeA.inner.i == nodeB.inner.i;
+        if constexpr (std::is_same_v<T, CallNode>) {
+            if (nodeA.fKind != nodeB.fKind || nodeA.args.size() != nodeB.args.size()) return false;
+            for (size_t i = 0; i < nodeA.args.size(); i++) {
+                if (nodeA.args[i].i != nodeB.args[i].i) return false;
+            }
+            return true;
+        }
+        return false;
+    }, a.kind);
+}
+
+template <class F>
+static void forEachChild(const ASTNode& node, F f) {
+    std::visit([&](const auto& n) {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr (std::is_same_v<T, BinaryOpNode>) {
+            f(n.left);
+            f(n.right);
+        }
+        if constexpr (std::is_same_v<T, UnaryOpNode>) f(n.inner);
+        if constexpr (std::is_same_v<T, CallNode>) {
+            for (const NodeID& arg : n.args) f(arg);
+        }
+    }, node.kind);
+}
+
+NodeID CommonSubexpressions::intern(const ASTNode& node) {
+    // the children's output NodeIDs stand in for their hashes, they're unique by now
+    u64 children[2] = { 0, 0 };
+    std::vector<u64> args;
+    const u64* childHashes = children;
+    if (const BinaryOpNode* b = std::get_if<BinaryOpNode>(&node.kind)) {
+        children[0] = b->left.i;
+        children[1] = b->right.i;
+    } else if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&node.kind)) {
+        children[0] = u->inner.i;
+    } else if (const CallNode* c = std::get_if<CallNode>(&node.kind)) {
+        for (const NodeID& arg : c->args) args.push_back(arg.i);
+        childHashes = args.data();
+    }
+
+    std::vector<NodeID>& candidates = _table[nodeHash(node, childHashes)];
+    for (const NodeID& candidate : candidates) {
+        if (shallowEqual(_output->at(candidate), node)) {
+            _merged++;
+            return candidate;
+        }
+    }
+
+    NodeID id = std::visit([&](const auto& n) -> NodeID {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr (std::is_same_v<T, ConstantNode>) return _output->addConstant(n.cKind, n.pos);
+        if constexpr (std::is_same_v<T, RealNode>) return _output->addReal(n.value, n.pos);
+        if constexpr (std::is_same_v<T, RationalNode>) return _output->addRational(n.numerator, n.denominator, n.pos);
+        if constexpr (std::is_same_v<T, IdentifierNode>) return _output->addIdentifier(n.name, n.pos);
+        if constexpr (std::is_same_v<T, BinaryOpNode>) return _output->addBinaryOp(n.bKind, n.left, n.right, n.pos);
+        if constexpr (std::is_same_v<T, UnaryOpNode>) return _output->addUnaryOp(n.uKind, n.inner, n.pos);
+        if constexpr (std::is_same_v<T, CallNode>) return _output->addCall(n.fKind, n.args, n.pos);
+    }, node.kind);
+
+    candidates.push_back(id);
+    _size++;
+    return id;
+}
+
+NodeID CommonSubexpressions::add(const AST& input, const NodeID& id) {
+    if (id.isNone()) return NodeID::None();
+
+    // the input can be a DAG already, each of its nodes only gets looked at once
+    _mapped.assign(input.arena.size(), NodeID::None());
+    _tasks.clear();
+    _tasks.push_back({ id, false });
+
+    while (!_tasks.empty()) {
+        auto [current, expanded] = _tasks.back();
+        _tasks.pop_back();
+        if (!_mapped[current.i].isNone()) continue;
+
+        const ASTNode& node = input.at(current);
+        if (!expanded) {
+            _tasks.push_back({ current, true });
+            forEachChild(node, [&](const NodeID& child) {
+                if (!child.isNone() && _mapped[child.i].isNone()) _tasks.push_back({ child, false });
+            });
+            continue;
+        }
+
+        // the same node with its children swapped for their output versions
+        ASTNode copy = node;
+        auto remap = [&](NodeID& child) {
+            if (!child.isNone()) child = _mapped[child.i];
+        };
+        if (BinaryOpNode* b = std::get_if<BinaryOpNode>(&copy.kind)) {
+            remap(b->left);
+            remap(b->right);
+        } else if (UnaryOpNode* u = std::get_if<UnaryOpNode>(&copy.kind)) {
+            remap(u->inner);
+        } else if (CallNode* c = std::get_if<CallNode>(&copy.kind)) {
+            for (NodeID& arg : c->args) remap(arg);
+        }
+        _mapped[current.i] = intern(copy);
+    }
+
+    return _mapped[id.i];
+}
+
+NodeID eliminateCommonSubexpressions(const AST& input, const NodeID& id, AST& output) {
+    CommonSubexpressions cse(output);
+    NodeID result = cse.add(input, id);
+    if (id.i == input.root.i) output.root = result;
+    return result;
+}
+
+size_t uniqueNodeCount(const AST& ast, const NodeID& id) {
+    if (id.isNone()) return 0;
+
+    std::vector<bool> seen(ast.arena.size(), false);
+    std::vector<NodeID> stack = { id };
+    seen[id.i] = true;
+    size_t count = 0;
+
+    while (!stack.empty()) {
+        NodeID current = stack.back();
+        stack.pop_back();
+        count++;
+        forEachChild(ast.at(current), [&](const NodeID& child) {
+            if (child.isNone() || seen[child.i]) return;
+            seen[child.i] = true;
+            stack.push_back(child);
+        });
+    }
+    return count;
+}
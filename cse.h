@@ -0,0 +1,83 @@
+/*
+Common Subexpression Elimination
+
+transform() hands back a tree, so a formula that says
+\sqrt{x^2+y^2} three times has three copies of it, and every
+backend works it out three times. This pass turns the tree into
+a DAG where every distinct subtree is stored exactly once, and
+everything that used a copy points at that one node instead:
+
+          +                         +
+        /   \                     /   \
+       /     \                   |     |
+     sqrt    sqrt        ->       \   /
+      |       |                   sqrt
+      +       +                    |
+     / \     / \                   +
+   x^2 y^2 x^2 y^2                / \
+                                x^2 y^2
+
+It's hash-consing. The input is walked bottom-up, and by the
+time a node comes up its children are already unique nodes of
+the output, so checking whether the output has it already is a
+shallow compare: same kind, same value, same child NodeIDs. A
+table keyed by nodeHash() of that finds the candidates.
+
+Structurally equal is a bit looser than the math wants here,
+0.0 and -0.0 only share a node if they have the same sign bit,
+since 1/0.0 and 1/-0.0 aren't the same number. Positions are
+the first copy's.
+
+Every backend computes a shared node once. The bytecode
+compiler gives it one register, so compile(), jitCompile() and
+generateC() all get that for free. The tree-walking Evaluator
+remembers each node's value for the rest of the run, which
+costs a plain tree next to nothing. Anything that walks the
+result as a tree (the printers, structurallyEqual, the
+transformer) still works, it just sees the copies again.
+
+One CommonSubexpressions can take several roots into the same
+output AST, so subterms shared between different formulas are
+stored once too.
+*/
+
+#ifndef CSE_H
+#define CSE_H
+
+#include "AST.h"
+
+#include <unordered_map>
+
+class CommonSubexpressions {
+    public:
+        explicit CommonSubexpressions(AST& output) : _output(&output) {}
+
+        // copies the subtree at id into the output, reusing every node that's already there
+        NodeID add(const AST& input, const NodeID& id);
+        // node's children have to be output nodes already, returns the one copy of it
+        NodeID intern(const ASTNode& node);
+
+        AST& output() const { return *_output; }
+        // distinct nodes in the output so far
+        size_t size() const { return _size; }
+        // input nodes that turned out to be copies of one already in the output
+        size_t merged() const { return _merged; }
+
+    private:
+        AST* _output;
+        // shallow hash -> output nodes with that hash
+        std::unordered_map<u64, std::vector<NodeID>> _table;
+        // input id -> output id, for the add() that's running
+        std::vector<NodeID> _mapped;
+        std::vector<std::pair<NodeID, bool>> _tasks;
+        size_t _size = 0;
+        size_t _merged = 0;
+};
+
+// the subtree at id as a DAG in output, sets output.root if it's the input's root
+NodeID eliminateCommonSubexpressions(const AST& input, const NodeID& id, AST& output);
+
+// nodes reachable from id, a shared one only counts once
+size_t uniqueNodeCount(const AST& ast, const NodeID& id);
+
+#endif
@@ -0,0 +1,323 @@
+#include "derivative.h"
+#include "cse.h"
+
+#include <algorithm>
+
+// builds the derivative of one copied input, every node interned into the same DAG
+class Differentiator {
+    public:
+        Differentiator(const std::string& variable, AST& output) : _variable(variable), _cse(output), _ast(output) {}
+
+        NodeID run(const AST& input, const NodeID& id) {
+            size_t start = _ast.arena.size();
+            NodeID root = _cse.add(input, id);
+            if (root.isNone()) return root;
+
+            // only the copied input has derivatives, everything after it is derivative
+            size_t inputSize = _ast.arena.size();
+            markDependencies(start, inputSize);
+            _derivative.assign(inputSize, NodeID::None());
+
+            std::vector<std::pair<NodeID, bool>> tasks = { { root, false } };
+            while (!tasks.empty()) {
+                auto [current, expanded] = tasks.back();
+                tasks.pop_back();
+                if (!_derivative[current.i].isNone()) continue;
+
+                if (!_depends[current.i]) {
+                    _derivative[current.i] = zero();
+                    continue;
+                }
+                if (!expanded) {
+                    tasks.push_back({ current, true });
+                    forEachChild(current, [&](const NodeID& child) {
+                        if (_derivative[child.i].isNone()) tasks.push_back({ child, false });
+                    });
+                    continue;
+                }
+                _derivative[current.i] = derive(current);
+            }
+            return _derivative[root.i];
+        }
+
+    private:
+        std::string _variable;
+        CommonSubexpressions _cse;
+        AST& _ast;
+        std::vector<NodeID> _derivative;
+        std::vector<bool> _depends;
+
+        template <class F>
+        void forEachChild(const NodeID& id, F f) const {
+            std::visit([&](const auto& node) {
+                using T = std::decay_t<decltype(node)>;
+                if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                    f(node.left);
+                    f(node.right);
+                }
+                if constexpr (std::is_same_v<T, UnaryOpNode>) f(node.inner);
+                if constexpr (std::is_same_v<T, CallNode>) {
+                    for (const NodeID& arg : node.args) f(arg);
+                }
+            }, _ast.at(id).kind);
+        }
+
+        // whether each copied node has the variable anywhere under it, children come before parents in the arena
+        void markDependencies(const size_t& start, const size_t& end) {
+            _depends.assign(end, false);
+            for (size_t i = start; i < end; i++) {
+                NodeID id{ i };
+                if (const IdentifierNode* n = std::get_if<IdentifierNode>(&_ast.at(id).kind)) {
+                    _depends[i] = n->name == _variable;
+                    continue;
+                }
+                bool depends = false;
+                forEachChild(id, [&](const NodeID& child) {
+                    if (child.isNone() || child.i >= i) throw TransformerError(nodePos(id), "Missing operand");
+                    depends = depends || _depends[child.i];
+                });
+                _depends[i] = depends;
+            }
+        }
+
+        size_t nodePos(const NodeID& id) const {
+            return std::visit([](const auto& node) { return node.pos; }, _ast.at(id).kind);
+        }
+
+        NodeID derivativeOf(const NodeID& id) const { return _derivative[id.i]; }
+
+        // building blocks, interned and with 0s and 1s dropped on the spot
+        NodeID rational(const i64& numerator, const i64& denominator = 1) {
+            return _cse.intern(RationalNode{ numerator, denominator, UnknownPos });
+        }
+        NodeID zero() { return rational(0); }
+        NodeID one() { return rational(1); }
+
+        bool isZero(const NodeID& id) const {
+            const RationalNode* r = std::get_if<RationalNode>(&_ast.at(id).kind);
+            return r && r->numerator == 0;
+        }
+        bool isOne(const NodeID& id) const {
+            const RationalNode* r = std::get_if<RationalNode>(&_ast.at(id).kind);
+            return r && r->numerator == r->denominator;
+        }
+
+        NodeID binary(const BinaryOpKind& bKind, const NodeID& left, const NodeID& right) {
+            return _cse.intern(BinaryOpNode{ bKind, left, right, UnknownPos });
+        }
+        NodeID call(const FunctionKind& fKind, const std::vector<NodeID>& args) {
+            return _cse.intern(CallNode{ fKind, args, UnknownPos });
+        }
+        NodeID call(const FunctionKind& fKind, const NodeID& arg) { return call(fKind, std::vector<NodeID>{ arg }); }
+
+        NodeID add(const NodeID& a, const NodeID& b) {
+            if (isZero(a)) return b;
+            if (isZero(b)) return a;
+            return binary(BinaryOpKind::Add, a, b);
+        }
+        NodeID negate(const NodeID& a) {
+            if (isZero(a)) return a;
+            return _cse.intern(UnaryOpNode{ UnaryOpKind::Negate, a, UnknownPos });
+        }
+        NodeID subtract(const NodeID& a, const NodeID& b) {
+            if (isZero(b)) return a;
+            if (isZero(a)) return negate(b);
+            return binary(BinaryOpKind::Subtract, a, b);
+        }
+        NodeID multiply(const NodeID& a, const NodeID& b) {
+            if (isZero(a) || isZero(b)) return zero();
+            if (isOne(a)) return b;
+            if (isOne(b)) return a;
+            return binary(BinaryOpKind::Multiply, a, b);
+        }
+        NodeID divide(const NodeID& a, const NodeID& b) {
+            if (isZero(a)) return a;
+            if (isOne(b)) return a;
+            return binary(BinaryOpKind::Divide, a, b);
+        }
+        NodeID square(const NodeID& a) { return binary(BinaryOpKind::Power, a, rational(2)); }
+
+        // b - 1, worked out if b is a number
+        NodeID minusOne(const NodeID& b) {
+            if (const RationalNode* r = std::get_if<RationalNode>(&_ast.at(b).kind)) {
+                return rational(r->numerator - r->denominator, r->denominator);
+            }
+            return subtract(b, one());
+        }
+        // n + 1, same
+        NodeID plusOne(const NodeID& n) {
+            if (const RationalNode* r = std::get_if<RationalNode>(&_ast.at(n).kind)) {
+                return rational(r->numerator + r->denominator, r->denominator);
+            }
+            return add(n, one());
+        }
+
+        // 1 if gap <= 0, 0 if it's more, since 0^0 = 1 and 0^x = 0, no 0 / 0 at a tie like a sign would have
+        // a NaN gap counts as floor, max() drops it
+        NodeID step(const NodeID& gap, const NodeID& floor) {
+            return binary(BinaryOpKind::Power, zero(), call(FunctionKind::Max, std::vector<NodeID>{ gap, floor }));
+        }
+
+        // d if keep is 1 and NaN if it's 0, by way of sqrt(keep - 1), for max() to drop
+        NodeID onlyIf(const NodeID& d, const NodeID& keep) {
+            return add(d, binary(BinaryOpKind::Power, subtract(keep, one()), rational(1, 2)));
+        }
+
+        // 1 if x is NaN and 0 otherwise, inf included: clamping to [0, 1] drops a NaN at whichever end comes first
+        NodeID isNaN(const NodeID& x) {
+            NodeID low = call(FunctionKind::Max, std::vector<NodeID>{ call(FunctionKind::Min, std::vector<NodeID>{ x, one() }), zero() });
+            NodeID high = call(FunctionKind::Min, std::vector<NodeID>{ call(FunctionKind::Max, std::vector<NodeID>{ x, zero() }), one() });
+            return subtract(low, high);
+        }
+
+        NodeID derive(const NodeID& id) {
+            // copied out, interning new nodes can move the arena
+            const AST& ast = _ast;
+            ASTNode node = ast.at(id);
+
+            if (std::holds_alternative<IdentifierNode>(node.kind)) return one();
+
+            if (const BinaryOpNode* b = std::get_if<BinaryOpNode>(&node.kind)) {
+                NodeID a = b->left, c = b->right;
+                NodeID da = derivativeOf(a), dc = derivativeOf(c);
+
+                switch (b->bKind) {
+                    case BinaryOpKind::Add: return add(da, dc);
+                    case BinaryOpKind::Subtract: return subtract(da, dc);
+                    case BinaryOpKind::Multiply: return add(multiply(da, c), multiply(a, dc));
+                    case BinaryOpKind::Divide: return divide(subtract(multiply(da, c), multiply(a, dc)), square(c));
+                    case BinaryOpKind::Equals: return binary(BinaryOpKind::Equals, da, dc);
+                    case BinaryOpKind::Power: {
+                        if (!_depends[c.i]) return multiply(multiply(c, binary(BinaryOpKind::Power, a, minusOne(c))), da);
+
+                        NodeID lnA = call(FunctionKind::NaturalLogarithm, a);
+                        if (!_depends[a.i]) return multiply(multiply(id, lnA), dc);
+                        return multiply(id, add(multiply(dc, lnA), divide(multiply(c, da), a)));
+                    }
+                }
+            }
+
+            if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&node.kind)) {
+                NodeID da = derivativeOf(u->inner);
+                switch (u->uKind) {
+                    case UnaryOpKind::Negate: return negate(da);
+                    case UnaryOpKind::Percent: return _cse.intern(UnaryOpNode{ UnaryOpKind::Percent, da, UnknownPos });
+                    // a! = gamma(a + 1), and gamma' = gamma psi
+                    case UnaryOpKind::Factorial: {
+                        NodeID psi = call(FunctionKind::Polygamma, std::vector<NodeID>{ zero(), plusOne(u->inner) });
+                        return multiply(multiply(id, psi), da);
+                    }
+                }
+            }
+
+            const CallNode& c = std::get<CallNode>(node.kind);
+            if (c.args.empty()) throw TransformerError(c.pos, "Function call without arguments");
+            NodeID a = c.args[0];
+            NodeID da = derivativeOf(a);
+
+            auto arity = [&](const size_t& n) {
+                if (c.args.size() != n) throw TransformerError(c.pos, "Wrong number of arguments to " + c.toString());
+            };
+
+            switch (c.fKind) {
+                case FunctionKind::Sine: arity(1); return multiply(call(FunctionKind::Cosine, a), da);
+                case FunctionKind::Cosine: arity(1); return negate(multiply(call(FunctionKind::Sine, a), da));
+                case FunctionKind::Tangent: arity(1); return multiply(add(one(), square(id)), da);
+                case FunctionKind::AbsoluteValue: arity(1); return multiply(divide(a, id), da);
+                case FunctionKind::Exponential: arity(1); return multiply(id, da);
+                case FunctionKind::NaturalLogarithm: arity(1); return divide(da, a);
+                case FunctionKind::Atan2: {
+                    arity(2);
+                    NodeID x = c.args[1];
+                    NodeID dx = derivativeOf(x);
+                    return divide(subtract(multiply(x, da), multiply(a, dx)), add(square(x), square(a)));
+                }
+                case FunctionKind::Logarithm: {
+                    if (c.args.size() == 1) return divide(da, multiply(a, call(FunctionKind::NaturalLogarithm, rational(10))));
+                    arity(2);
+                    NodeID base = c.args[1];
+                    NodeID lnBase = call(FunctionKind::NaturalLogarithm, base);
+                    if (!_depends[base.i]) return divide(da, multiply(a, lnBase));
+
+                    // ln(a) / ln(b)
+                    NodeID lnA = call(FunctionKind::NaturalLogarithm, a);
+                    NodeID dLnA = divide(da, a);
+                    NodeID dLnBase = divide(derivativeOf(base), base);
+                    return divide(subtract(multiply(dLnA, lnBase), multiply(lnA, dLnBase)), square(lnBase));
+                }
+                case FunctionKind::Polygamma: {
+                    arity(2);
+                    // only whole orders exist, so there's nothing to take along n
+                    if (_depends[a.i]) throw TransformerError(c.pos, "Can't differentiate polygamma along its order");
+                    NodeID x = c.args[1];
+                    return multiply(call(FunctionKind::Polygamma, std::vector<NodeID>{ plusOne(a), x }), derivativeOf(x));
+                }
+                case FunctionKind::Hypotenuse: {
+                    NodeID sum = zero();
+                    for (const NodeID& arg : c.args) sum = add(sum, multiply(arg, derivativeOf(arg)));
+                    return divide(sum, id);
+                }
+                case FunctionKind::Max:
+                case FunctionKind::Min: {
+                    // max(a, b)' = db + (da - db) [a >= b], one more arg at a time
+                    // args are interned, so a repeated one is the same NodeID and gets left out
+                    std::vector<NodeID> args;
+                    for (const NodeID& arg : c.args) {
+                        if (std::find_if(args.begin(), args.end(), [&](const NodeID& seen) { return seen.i == arg.i; }) == args.end()) args.push_back(arg);
+                    }
+
+                    bool isMax = c.fKind == FunctionKind::Max;
+                    NodeID partial = a;
+                    NodeID dPartial = da;
+                    for (size_t k = 1; k < args.size(); k++) {
+                        NodeID b = args[k];
+                        NodeID db = derivativeOf(b);
+                        bool last = k + 1 == args.size() && args.size() == c.args.size();
+                        NodeID next = last ? id : call(c.fKind, std::vector<NodeID>(args.begin(), args.begin() + k + 1));
+
+                        // fmax and fmin drop a NaN, so its derivative goes to the other side, and to the partial if both are
+                        // the gap is NaN then, and the floor is 1 only if the partial is NaN and b isn't
+                        // the side that lost is made NaN and dropped too, so its NaN or inf derivative can't leak in like 0 * NaN would
+                        if (!isZero(dPartial) || !isZero(db)) {
+                            NodeID floor = subtract(isNaN(partial), isNaN(next));
+                            NodeID keep = step(isMax ? subtract(b, partial) : subtract(partial, b), floor);
+                            dPartial = call(FunctionKind::Max, std::vector<NodeID>{ onlyIf(dPartial, keep), onlyIf(db, subtract(one(), keep)) });
+                        }
+                        partial = next;
+                    }
+                    return dPartial;
+                }
+            }
+            return zero();
+        }
+};
+
+NodeID differentiateRaw(const AST& input, const NodeID& id, const std::string& variable, AST& output) {
+    return Differentiator(variable, output).run(input, id);
+}
+
+Result<NodeID> tryDifferentiate(const AST& input, const NodeID& id, const std::string& variable, AST& output, TransformCache* cache) {
+    AST raw;
+    try {
+        raw.root = differentiateRaw(input, id, variable, raw);
+    } catch (const TransformerError& e) {
+        return std::unexpected(Diagnostics{ { ErrorStage::Transformer, e.pos, e.what() } });
+    }
+    if (raw.root.isNone()) return std::unexpected(Diagnostics{ { ErrorStage::Transformer, UnknownPos, "Nothing to differentiate" } });
+
+    AST simplified;
+    Result<NodeID> result = tryTransform(raw, simplified, cache);
+    if (!result) return result;
+
+    output.root = eliminateCommonSubexpressions(simplified, simplified.root, output);
+    return output.root;
+}
+
+NodeID differentiate(const AST& input, const NodeID& id, const std::string& variable, AST& output, TransformCache* cache) {
+    Result<NodeID> result = tryDifferentiate(input, id, variable, output, cache);
+    if (!result) {
+        const Diagnostic& d = result.error().front();
+        throw TransformerError(d.pos, d.message);
+    }
+    return *result;
+}
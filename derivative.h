@@ -0,0 +1,97 @@
+/*
+Symbolic Differentiation
+
+differentiate() takes the derivative of an expression with
+respect to one variable, as another expression:
+
+    AST ast = parse("x^2 \sin(x)");
+    AST d;
+    differentiate(ast, ast.root, "x", d);    // 2x sin(x) + x^2 cos(x)
+
+It goes bottom-up over the input with the usual rules, every
+node's derivative built out of its children's:
+
+    a + b, a - b        da + db, da - db
+    a * b               da b + a db
+    a / b               (da b - a db) / b^2
+    a ^ b               b a^(b - 1) da           b constant
+                        a^b ln(a) db             a constant
+                        a^b (db ln(a) + b da / a)
+    a = b               da = db
+    -a, a%              -da, da%
+    sin, cos, tan       cos(a) da, -sin(a) da, (1 + tan(a)^2) da
+    atan2(y, x)         (x dy - y dx) / (x^2 + y^2)
+    abs(a)              a / abs(a) da, 0 / 0 = NaN at 0
+    exp, ln             exp(a) da, da / a
+    log(a), log(a, b)   da / (a ln(10)), and the quotient rule on ln(a) / ln(b)
+    hypot(a, b, ...)    (a da + b db + ...) / hypot(a, b, ...), NaN at 0
+    max(a, b), min      da where a wins, db where b does, folded over the args
+    a!                  a! polygamma(0, a + 1) da
+    polygamma(n, a)     polygamma(n + 1, a) da
+
+There are no comparisons in the language, so "where a wins" is
+s = 0^max(b - a, 0), 1 where a wins and 0 where b does. Where
+they're equal it's a's derivative, not the 0 / 0 an abs(a - b)
+would give. max() and min() drop a NaN argument and return the
+other one, so the derivative has to follow. b - a is NaN then,
+and max(NaN, 0) would pick a even when a is the NaN one, so the 0
+becomes 1 in exactly that case (a clamp to [0, 1] turns NaN into
+1 at one end and 0 at the other, see isNaN in derivative.cpp).
+The two sides are put together as
+
+    max(da + (s - 1)^(1/2), db + (-s)^(1/2))
+
+where the side that lost gets sqrt(-1) = NaN added, which max()
+drops, so a NaN or inf derivative on that side can't leak in the
+way 0 * NaN would.
+
+At 0, abs and hypot come out as 0 / 0 = NaN here, while
+compileGradient() (see gradient.h) gives 0.
+
+polygamma(0, a) is digamma, psi = gamma' / gamma, and the
+polygammas are its derivatives, so a! and all of them always have
+one. The only thing that throws a TransformerError is a polygamma
+whose order depends on the variable, since orders are whole
+numbers.
+
+Anything that doesn't depend on the variable (checked once per
+node up front) has a derivative of 0 without looking inside it,
+and 0s and 1s get dropped as the derivative is built, so the
+product rule doesn't leave a trail of "0 * b + a * 1" around.
+
+--
+Not blowing up
+
+Written out as a tree, derivatives grow fast. The product rule
+copies both factors, the chain rule copies the inside, and
+nesting those multiplies it out. Here nothing is ever copied.
+The input goes into a CommonSubexpressions first, and every
+node of the derivative is interned into the same one (see
+cse.h), so "a" in "da b + a db" is the one node a, cos(u) in
+the chain rule points at the same u as sin(u), and the
+derivative of a shared subtree is only taken once. The raw
+derivative is a DAG no more than a constant factor bigger than
+the input.
+
+Then it goes through transform() for the real simplification,
+and back through eliminateCommonSubexpressions(), so what comes
+out is a simplified DAG that any backend can run directly.
+transform() still works on it as a tree, so an input that only
+fits as a DAG (like a Builder expression reusing itself at
+every level) should use differentiateRaw() instead.
+*/
+
+#ifndef DERIVATIVE_H
+#define DERIVATIVE_H
+
+#include "transformer.h"
+
+// d/d variable of the subtree at id, transformed, as a DAG in output, sets output.root
+// throws TransformerError for a polygamma order with the variable in it, or if transform() fails
+NodeID differentiate(const AST& input, const NodeID& id, const std::string& variable, AST& output, TransformCache* cache = nullptr);
+Result<NodeID> tryDifferentiate(const AST& input, const NodeID& id, const std::string& variable, AST& output, TransformCache* cache = nullptr);
+
+// the same before transform(), hash-consed into output along with a copy of the input
+NodeID differentiateRaw(const AST& input, const NodeID& id, const std::string& variable, AST& output);
+
+#endif
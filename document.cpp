@@ -0,0 +1,67 @@
+#include "document.h"
+
+#include <cctype>
+
+std::vector<NodeID> Document::roots() const {
+    std::vector<NodeID> out;
+    out.reserve(statements.size());
+    for (const Statement& s : statements) {
+        if (s.ok()) out.push_back(s.root);
+    }
+    return out;
+}
+
+bool Document::hasErrors() const {
+    for (const Statement& s : statements) {
+        if (!s.ok()) return true;
+    }
+    return false;
+}
+
+void Document::clear() {
+    ast.arena.clear();
+    ast.root = NodeID::None();
+    statements.clear();
+    _leaves.clear();
+}
+
+static bool isBlank(const std::string& text, const size_t& first, const size_t& last) {
+    for (size_t i = first; i < last; i++) {
+        if (!std::isspace(static_cast<unsigned char>(text[i]))) return false;
+    }
+    return true;
+}
+
+void parseDocument(const std::string& text, Document& doc, const bool& shareLeaves) {
+    doc.clear();
+
+    // every statement reserves for itself too, this just skips the first few regrows
+    doc.ast.reserve(text.size() / 2 + 8);
+
+    size_t first = 0;
+    while (first <= text.size()) {
+        size_t last = first;
+        while (last < text.size() && text[last] != '\n' && text[last] != ';') last++;
+
+        if (!isBlank(text, first, last)) {
+            Statement s{ first, last - first, NodeID::None(), {} };
+            size_t mark = doc.ast.arena.size();
+
+            Result<NodeID> result = doc._parser.tryParse(text, first, last, doc.ast, shareLeaves ? &doc._leaves : nullptr);
+            if (result) {
+                s.root = *result;
+            } else {
+                // nothing can point at a failed statement's nodes, so they go
+                doc.ast.arena.erase(doc.ast.arena.begin() + mark, doc.ast.arena.end());
+                doc._leaves.forget(mark);
+                s.errors = std::move(result.error());
+            }
+            doc.statements.push_back(std::move(s));
+        }
+
+        first = last + 1;
+    }
+
+    // there's no single root, use statements instead
+    doc.ast.root = NodeID::None();
+}
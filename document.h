@@ -0,0 +1,68 @@
+/*
+Documents
+
+A document is a whole file of equations, one per line or
+separated by ';':
+
+    y = 2x + 1
+    x^2 + y^2 = 1; z = \frac{x}{y}
+
+Instead of an AST per equation, every statement gets parsed
+into one shared arena, and the document keeps a list of where
+each statement's root is and where it came from in the text.
+That means one allocation that grows a few times instead of
+one per equation, and a pass over the whole document is just
+a walk over one arena.
+
+Positions are never rebased. The parser lexes straight out of
+the document text between the statement's bounds, so node and
+error positions are already offsets into the whole file.
+
+With shareLeaves on, the same identifier, number or constant
+is only ever stored once, so every "x" in the file is the same
+node:
+
+    "x + 1; 2x"     arena: [ x, 1, x+1, 2, 2*x ]
+                              ^-----------------^ both point at node 0
+
+Shared leaves keep the position of their first use, which is
+fine for errors (those come from the parser, not the nodes) but
+worth knowing before mutating nodes in place.
+*/
+
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "parser.h"
+
+struct Statement {
+    size_t offset;      // where the statement starts in the document text
+    size_t length;
+    NodeID root = NodeID::None();
+    Diagnostics errors; // positions are offsets into the whole document
+
+    bool ok() const { return errors.empty(); }
+};
+
+class Document {
+    public:
+        AST ast;
+        std::vector<Statement> statements;
+
+        // every root that parsed, in document order
+        std::vector<NodeID> roots() const;
+        // true if any statement failed
+        bool hasErrors() const;
+        // empties everything but keeps the capacity
+        void clear();
+
+    private:
+        friend void parseDocument(const std::string& text, Document& doc, const bool& shareLeaves);
+        LeafTable _leaves;
+        Parser _parser;
+};
+
+// splits text on '\n' and ';' and parses every non-blank statement into doc, which is cleared first
+void parseDocument(const std::string& text, Document& doc, const bool& shareLeaves = true);
+
+#endif
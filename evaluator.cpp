@@ -0,0 +1,274 @@
+#include "evaluator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+double polygamma(const double& order, const double& x) {
+    if (std::isnan(order) || std::isnan(x)) return NAN;
+    if (order < 0 || order != std::floor(order)) return NAN;
+    // poles at 0, -1, -2, ...
+    if (x <= 0 && x == std::floor(x)) return NAN;
+
+    if (order == 0) {
+        // psi(x) = psi(1 - x) - pi cot(pi x), then psi(x) = psi(x + 1) - 1/x up past 10,
+        // where the asymptotic series is good to an ulp or so
+        double y = x;
+        double result = 0;
+        if (y < 0) {
+            result -= std::numbers::pi / std::tan(std::numbers::pi * y);
+            y = 1 - y;
+        }
+        while (y < 10) {
+            result -= 1 / y;
+            y += 1;
+        }
+        double inv2 = 1 / (y * y);
+        double series = inv2 * (1.0 / 12 - inv2 * (1.0 / 120 - inv2 * (1.0 / 252 - inv2 * (1.0 / 240 - inv2 * (1.0 / 132)))));
+        return result + std::log(y) - 0.5 / y - series;
+    }
+
+    // psi^(n)(x) = (-1)^(n + 1) n! zeta(n + 1, x), with the Hurwitz zeta summed up past 10 + n
+    // and Euler-Maclaurin for the rest
+    static constexpr double BERNOULLI[] = { 1.0 / 6, -1.0 / 30, 1.0 / 42, -1.0 / 30, 5.0 / 66, -691.0 / 2730, 7.0 / 6 };
+    double s = order + 1;
+    double y = x;
+    double zeta = 0;
+    while (y < 10 + order) {
+        zeta += std::pow(y, -s);
+        y += 1;
+    }
+    zeta += std::pow(y, 1 - s) / (s - 1) + 0.5 * std::pow(y, -s);
+
+    // B2k / (2k)! s (s + 1) ... (s + 2k - 2) / y^(s + 2k - 1)
+    double inv2 = 1 / (y * y);
+    double term = s * std::pow(y, -s - 1) / 2;
+    for (int k = 1; k <= 7; k++) {
+        zeta += BERNOULLI[k - 1] * term;
+        term *= (s + 2 * k - 1) * (s + 2 * k) / ((2 * k + 1) * (2 * k + 2)) * inv2;
+    }
+    double sign = std::fmod(order, 2) == 1 ? 1 : -1;
+    return sign * std::tgamma(s) * zeta;
+}
+
+// x^(p/q), which has a real answer for negative x if q is odd
+static double power(const AST& ast, const NodeID& exponentID, const double& base, const double& exponent) {
+    if (base < 0) {
+        const RationalNode* r = std::get_if<RationalNode>(&ast.at(exponentID).kind);
+        if (r && r->denominator != 1 && r->denominator % 2 != 0) {
+            double magnitude = std::pow(-base, exponent);
+            return r->numerator % 2 != 0 ? -magnitude : magnitude;
+        }
+    }
+    // same as the bytecode, x*x is exact and pow can be an ulp off
+    if (exponent == 2) return base * base;
+    return std::pow(base, exponent);
+}
+
+static size_t nodePos(const AST& ast, const NodeID& id) {
+    return std::visit([](const auto& node) { return node.pos; }, ast.at(id).kind);
+}
+
+bool Evaluator::run(const AST& ast, const NodeID& id, const Bindings& bindings, double& result, Failure& failure) {
+    _tasks.clear();
+    _values.clear();
+
+    if (id.isNone()) {
+        failure = { id, "Nothing to evaluate" };
+        return false;
+    }
+    _tasks.push_back({ id, false });
+
+    // a new stamp instead of clearing, only once it wraps around do the old ones have to go
+    if (_memo.size() < ast.arena.size()) _memo.resize(ast.arena.size(), { 0, 0 });
+    if (++_run == 0) {
+        std::fill(_memo.begin(), _memo.end(), Memo{ 0, 0 });
+        _run = 1;
+    }
+
+    while (!_tasks.empty()) {
+        Task task = _tasks.back();
+        _tasks.pop_back();
+        const ASTNode& node = ast.at(task.id);
+
+        // leaves go straight onto the value stack
+        if (const RationalNode* r = std::get_if<RationalNode>(&node.kind)) {
+            _values.push_back((double)r->numerator / (double)r->denominator);
+            continue;
+        }
+        if (const RealNode* r = std::get_if<RealNode>(&node.kind)) {
+            _values.push_back(r->value);
+            continue;
+        }
+        if (const IdentifierNode* n = std::get_if<IdentifierNode>(&node.kind)) {
+            auto it = bindings.find(n->name);
+            if (it == bindings.end()) {
+                failure = { task.id, "Unbound variable" };
+                return false;
+            }
+            _values.push_back(it->second);
+            continue;
+        }
+        if (const ConstantNode* c = std::get_if<ConstantNode>(&node.kind)) {
+            switch (c->cKind) {
+                case ConstantKind::PI: _values.push_back(std::numbers::pi); break;
+                case ConstantKind::E: _values.push_back(std::numbers::e); break;
+                case ConstantKind::I: {
+                    failure = { task.id, "i has no real value" };
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        // first visit queues the children, left first, then comes back for the parent
+        if (!task.expanded) {
+            // unless it's shared and already done
+            if (_memo[task.id.i].stamp == _run) {
+                _values.push_back(_memo[task.id.i].value);
+                continue;
+            }
+            _tasks.push_back({ task.id, true });
+            if (const BinaryOpNode* b = std::get_if<BinaryOpNode>(&node.kind)) {
+                _tasks.push_back({ b->right, false });
+                _tasks.push_back({ b->left, false });
+            } else if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&node.kind)) {
+                _tasks.push_back({ u->inner, false });
+            } else if (const CallNode* c = std::get_if<CallNode>(&node.kind)) {
+                if (c->args.empty()) {
+                    failure = { task.id, "Function call without arguments" };
+                    return false;
+                }
+                for (size_t i = c->args.size(); i-- > 0;) _tasks.push_back({ c->args[i], false });
+            }
+            continue;
+        }
+
+        if (const BinaryOpNode* b = std::get_if<BinaryOpNode>(&node.kind)) {
+            double right = _values.back();
+            _values.pop_back();
+            double& left = _values.back();
+
+            switch (b->bKind) {
+                case BinaryOpKind::Add: left += right; break;
+                case BinaryOpKind::Subtract: left -= right; break;
+                case BinaryOpKind::Multiply: left *= right; break;
+                case BinaryOpKind::Divide: left /= right; break;
+                case BinaryOpKind::Power: left = power(ast, b->right, left, right); break;
+                case BinaryOpKind::Equals: left -= right; break;
+            }
+            remember(task.id, left);
+            continue;
+        }
+
+        if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&node.kind)) {
+            double& inner = _values.back();
+            switch (u->uKind) {
+                case UnaryOpKind::Negate: inner = -inner; break;
+                case UnaryOpKind::Factorial: inner = std::tgamma(inner + 1); break;
+                case UnaryOpKind::Percent: inner /= 100; break;
+            }
+            remember(task.id, inner);
+            continue;
+        }
+
+        const CallNode& call = std::get<CallNode>(node.kind);
+        size_t count = call.args.size();
+        double* args = _values.data() + (_values.size() - count);
+
+        // how many args each kind takes, 0 for any
+        size_t arity = 1;
+        switch (call.fKind) {
+            case FunctionKind::Atan2:
+            case FunctionKind::Polygamma: arity = 2; break;
+            case FunctionKind::Logarithm: arity = count == 2 ? 2 : 1; break;
+            case FunctionKind::Hypotenuse:
+            case FunctionKind::Max:
+            case FunctionKind::Min: arity = 0; break;
+            default: break;
+        }
+        if (arity != 0 && count != arity) {
+            failure = { task.id, "Wrong number of arguments" };
+            return false;
+        }
+
+        double value = 0;
+        switch (call.fKind) {
+            case FunctionKind::Sine: value = std::sin(args[0]); break;
+            case FunctionKind::Cosine: value = std::cos(args[0]); break;
+            case FunctionKind::Tangent: value = std::tan(args[0]); break;
+            case FunctionKind::Atan2: value = std::atan2(args[0], args[1]); break;
+            case FunctionKind::AbsoluteValue: value = std::fabs(args[0]); break;
+            case FunctionKind::Exponential: value = std::exp(args[0]); break;
+            case FunctionKind::NaturalLogarithm: value = std::log(args[0]); break;
+            case FunctionKind::Logarithm: {
+                value = count == 2 ? std::log(args[0]) / std::log(args[1]) : std::log10(args[0]);
+                break;
+            }
+            case FunctionKind::Hypotenuse: {
+                for (size_t i = 0; i < count; i++) value = std::hypot(value, args[i]);
+                break;
+            }
+            case FunctionKind::Max: {
+                value = args[0];
+                for (size_t i = 1; i < count; i++) value = std::fmax(value, args[i]);
+                break;
+            }
+            case FunctionKind::Min: {
+                value = args[0];
+                for (size_t i = 1; i < count; i++) value = std::fmin(value, args[i]);
+                break;
+            }
+            case FunctionKind::Polygamma: value = polygamma(args[0], args[1]); break;
+        }
+
+        _values.resize(_values.size() - count);
+        _values.push_back(value);
+        remember(task.id, value);
+    }
+
+    result = _values.back();
+    return true;
+}
+
+std::string Evaluator::describe(const AST& ast, const Failure& failure) const {
+    std::string msg = failure.message;
+    if (failure.id.isNone()) return msg;
+
+    if (const IdentifierNode* n = std::get_if<IdentifierNode>(&ast.at(failure.id).kind)) {
+        msg += ": \"" + n->name + "\"";
+    } else if (const CallNode* c = std::get_if<CallNode>(&ast.at(failure.id).kind)) {
+        msg += " to " + c->toString();
+    }
+    return msg;
+}
+
+double Evaluator::evaluate(const AST& ast, const NodeID& id, const Bindings& bindings) {
+    double result = 0;
+    Failure failure;
+    if (!run(ast, id, bindings, result, failure)) {
+        size_t pos = failure.id.isNone() ? UnknownPos : nodePos(ast, failure.id);
+        throw EvaluatorError(pos, describe(ast, failure));
+    }
+    return result;
+}
+
+Result<double> Evaluator::tryEvaluate(const AST& ast, const NodeID& id, const Bindings& bindings) {
+    double result = 0;
+    Failure failure;
+    if (!run(ast, id, bindings, result, failure)) {
+        size_t pos = failure.id.isNone() ? UnknownPos : nodePos(ast, failure.id);
+        return std::unexpected(Diagnostics{ { ErrorStage::Evaluator, pos, describe(ast, failure) } });
+    }
+    return result;
+}
+
+double evaluate(const AST& ast, const NodeID& id, const Bindings& bindings) {
+    thread_local Evaluator evaluator;
+    return evaluator.evaluate(ast, id, bindings);
+}
+
+Result<double> tryEvaluate(const AST& ast, const NodeID& id, const Bindings& bindings) {
+    thread_local Evaluator evaluator;
+    return evaluator.tryEvaluate(ast, id, bindings);
+}
@@ -0,0 +1,98 @@
+/*
+Numeric Evaluator
+
+Everything before this keeps math exact. The evaluator is
+where it finally turns into a double: give it a tree and
+values for its identifiers and it works out the number.
+
+    AST ast = parse("x^2 + 3x - \frac{1}{2}");
+    Bindings vars = { { "x", 2.0 } };
+    evaluate(ast, ast.root, vars);      // 9.5
+
+Every node kind has a value:
+
+    Constant    pi and e, i throws since there's no real value
+    Rational    numerator / denominator
+    Identifier  looked up in the bindings, unbound throws
+    Equals      left - right, so a solution of a = b is a zero
+    Factorial   tgamma(x + 1), which also covers non-integers
+    Percent     x / 100
+    log         base 10, or log(x, b) if the call has a base arg
+    hypot/max/min take any number of args
+    polygamma   polygamma(n, x), the nth derivative of digamma
+                psi(x) = gamma'(x) / gamma(x), NaN unless n is a
+                whole number, and at the poles 0, -1, -2, ...
+
+Everything else is what <cmath> does, including inf and NaN
+for things like 1/0 and ln(-1) instead of errors. The one
+exception is a negative number to a rational power with an odd
+denominator, which has a real root, so (-8)^(1/3) is -2 and not
+NaN like std::pow would say.
+
+Like the parser, an Evaluator keeps its own stacks instead of
+recursing, so deep trees are fine, and reusing one means no
+allocations at all once the stacks have grown to fit. Only
+failing allocates, for the message.
+
+A node with more than one parent (a DAG out of cse.h, or a
+Builder Expr used twice) is only worked out once per run. The
+value of every operator and call gets remembered by NodeID with
+the run's stamp on it, so the second parent just picks it up.
+*/
+
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include "AST.h"
+#include "Error.h"
+
+#include <unordered_map>
+
+// identifier name -> value
+using Bindings = std::unordered_map<std::string, double>;
+
+class Evaluator {
+    public:
+        // value of the subtree at id, throws EvaluatorError
+        double evaluate(const AST& ast, const NodeID& id, const Bindings& bindings);
+        // non-throwing version, the error comes back as a Diagnostic
+        Result<double> tryEvaluate(const AST& ast, const NodeID& id, const Bindings& bindings);
+
+    private:
+        struct Task {
+            NodeID id;
+            bool expanded;      // children are already on the value stack
+        };
+
+        // what went wrong, turned into a message only if someone asks
+        struct Failure {
+            NodeID id = NodeID::None();
+            const char* message = nullptr;
+        };
+
+        std::vector<Task> _tasks;
+        std::vector<double> _values;
+        // value of every node this run has finished, good if its stamp is this run's
+        struct Memo {
+            double value;
+            u32 stamp;
+        };
+        std::vector<Memo> _memo;
+        u32 _run = 0;
+
+        void remember(const NodeID& id, const double& value) {
+            _memo[id.i] = { value, _run };
+        }
+
+        bool run(const AST& ast, const NodeID& id, const Bindings& bindings, double& result, Failure& failure);
+        std::string describe(const AST& ast, const Failure& failure) const;
+};
+
+// psi^(n)(x), what a polygamma call works out to here and in the bytecode
+double polygamma(const double& order, const double& x);
+
+// one-off versions using a per-thread Evaluator, so they don't allocate either once warmed up
+double evaluate(const AST& ast, const NodeID& id, const Bindings& bindings = {});
+Result<double> tryEvaluate(const AST& ast, const NodeID& id, const Bindings& bindings = {});
+
+#endif
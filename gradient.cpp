@@ -0,0 +1,186 @@
+#include "gradient.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numbers>
+
+// unary instructions have b = a, it doesn't get an adjoint of its own
+static bool isUnary(const OpCode& op) {
+    switch (op) {
+        case OpCode::Negate:
+        case OpCode::Factorial:
+        case OpCode::Percent:
+        case OpCode::Sine:
+        case OpCode::Cosine:
+        case OpCode::Tangent:
+        case OpCode::AbsoluteValue:
+        case OpCode::Exponential:
+        case OpCode::NaturalLogarithm:
+        case OpCode::Logarithm: return true;
+        default: return false;
+    }
+}
+
+GradientProgram compileGradient(const Program& program) {
+    GradientProgram gradient;
+    gradient._constants = program.constants();
+    gradient._variables = program.variables();
+
+    const std::vector<Instruction>& code = program.code();
+    u32 inputs = (u32)(gradient._constants.size() + gradient._variables.size());
+    gradient._valueCount = inputs + (u32)code.size();
+
+    // which value each register holds right now, constants and variables are their own registers
+    std::vector<u32> current(program.registerCount(), 0);
+    for (u32 r = 0; r < inputs; r++) current[r] = r;
+
+    std::vector<bool> active(gradient._valueCount, false);
+    for (u32 v = (u32)gradient._constants.size(); v < inputs; v++) active[v] = true;
+
+    gradient._tape.reserve(code.size());
+    for (size_t k = 0; k < code.size(); k++) {
+        const Instruction& in = code[k];
+        bool unary = isUnary(in.op);
+
+        GradientProgram::Step step{ in.op, in.flag };
+        step.a = current[in.a];
+        step.b = unary ? step.a : current[in.b];
+        step.activeA = active[step.a];
+        step.activeB = !unary && active[step.b];
+        // same as differentiate(), orders are whole numbers
+        if (in.op == OpCode::Polygamma && step.activeA) throw EvaluatorError(UnknownPos, "Can't differentiate polygamma along its order");
+
+        u32 value = inputs + (u32)k;
+        active[value] = step.activeA || step.activeB;
+        current[in.dst] = value;
+        gradient._tape.push_back(step);
+    }
+
+    gradient._result = current[program.result()];
+    return gradient;
+}
+
+GradientProgram compileGradient(const AST& ast, const NodeID& id) {
+    return compileGradient(compile(ast, id));
+}
+
+double GradientProgram::run(const double* vars, double* gradient, double* scratch) const {
+    double* values = scratch;
+    double* adjoints = scratch + _valueCount;
+    size_t first = _constants.size();
+    size_t inputs = first + _variables.size();
+
+    if (!_constants.empty()) std::memcpy(values, _constants.data(), _constants.size() * sizeof(double));
+    if (!_variables.empty()) std::memcpy(values + first, vars, _variables.size() * sizeof(double));
+
+    // forward, every step into a value of its own
+    double* out = values + inputs;
+    for (size_t k = 0; k < _tape.size(); k++) {
+        const Step& s = _tape[k];
+        out[k] = applyOp(s.op, s.flag, values[s.a], values[s.b]);
+    }
+    double result = values[_result];
+
+    // reverse, constants never get an adjoint so they're left alone
+    std::fill(adjoints + first, adjoints + _valueCount, 0.0);
+    adjoints[_result] = 1;
+
+    for (size_t k = _tape.size(); k-- > 0;) {
+        double g = adjoints[inputs + k];
+        // nothing downstream reads it, or the step doesn't depend on a variable at all
+        if (g == 0) continue;
+
+        const Step& s = _tape[k];
+        double a = values[s.a];
+        double b = values[s.b];
+        double r = out[k];
+        double da = 0, db = 0;
+
+        switch (s.op) {
+            case OpCode::Add: da = 1; db = 1; break;
+            case OpCode::Subtract: da = 1; db = -1; break;
+            case OpCode::Multiply: da = b; db = a; break;
+            case OpCode::Divide: da = 1 / b; db = -r / b; break;
+            case OpCode::Power:
+                if (s.activeA) da = b == 2 ? 2 * a : b * std::pow(a, b - 1);
+                // 0^b is 0 from both sides once b > 0, not 0 * -inf
+                if (s.activeB) db = r == 0 ? 0 : r * std::log(a);
+                break;
+            case OpCode::PowerRoot:
+                // x^(p/q)' = p/q x^((p - q)/q), and p - q is odd exactly when p isn't
+                if (s.activeA) da = b * applyOp(OpCode::PowerRoot, !s.flag, a, b - 1);
+                if (s.activeB) db = r == 0 ? 0 : r * std::log(std::fabs(a));
+                break;
+            case OpCode::Negate: da = -1; break;
+            case OpCode::Factorial: da = r * polygamma(0, a + 1); break;
+            case OpCode::Percent: da = 1.0 / 100; break;
+            case OpCode::Sine: da = std::cos(a); break;
+            case OpCode::Cosine: da = -std::sin(a); break;
+            case OpCode::Tangent: da = 1 + r * r; break;
+            case OpCode::Atan2: {
+                double d = a * a + b * b;
+                da = b / d;
+                db = -a / d;
+                break;
+            }
+            // NaN stays NaN
+            case OpCode::AbsoluteValue: da = a > 0 ? 1 : a < 0 ? -1 : a == 0 ? 0 : a; break;
+            case OpCode::Exponential: da = r; break;
+            case OpCode::NaturalLogarithm: da = 1 / a; break;
+            case OpCode::Logarithm: da = 1 / (a * std::numbers::ln10); break;
+            case OpCode::LogarithmBase: {
+                double lnB = std::log(b);
+                da = 1 / (a * lnB);
+                db = -r / (b * lnB);
+                break;
+            }
+            case OpCode::Hypotenuse:
+                if (r != 0) {
+                    da = a / r;
+                    db = b / r;
+                }
+                break;
+            // the same one fmax and fmin picked
+            case OpCode::Max:
+            case OpCode::Min: {
+                bool first = (s.op == OpCode::Max ? a >= b : a <= b) || std::isnan(b);
+                da = first ? 1 : 0;
+                db = first ? 0 : 1;
+                break;
+            }
+            case OpCode::Polygamma: db = polygamma(a + 1, b); break;
+        }
+
+        if (s.activeA) adjoints[s.a] += g * da;
+        if (s.activeB) adjoints[s.b] += g * db;
+    }
+
+    if (!_variables.empty()) std::memcpy(gradient, adjoints + first, _variables.size() * sizeof(double));
+    return result;
+}
+
+double GradientProgram::run(std::span<const double> vars, std::span<double> gradient) const {
+    if (vars.size() < _variables.size()) throw EvaluatorError(UnknownPos, "Not enough variable values");
+    if (gradient.size() < _variables.size()) throw EvaluatorError(UnknownPos, "Not enough room for the gradient");
+
+    thread_local std::vector<double> scratch;
+    if (scratch.size() < scratchSize()) scratch.resize(scratchSize());
+    return run(vars.data(), gradient.data(), scratch.data());
+}
+
+double GradientProgram::run(const Bindings& bindings, Bindings& gradient) const {
+    thread_local std::vector<double> vars;
+    thread_local std::vector<double> partials;
+    vars.clear();
+    for (const std::string& name : _variables) {
+        auto it = bindings.find(name);
+        if (it == bindings.end()) throw EvaluatorError(UnknownPos, "Unbound variable: \"" + name + "\"");
+        vars.push_back(it->second);
+    }
+    partials.resize(_variables.size());
+
+    double result = run(std::span<const double>(vars), std::span<double>(partials));
+    for (const auto& [name, value] : bindings) gradient[name] = 0;
+    for (size_t i = 0; i < _variables.size(); i++) gradient[_variables[i]] = partials[i];
+    return result;
+}
@@ -0,0 +1,107 @@
+/*
+Reverse-Mode Gradients
+
+differentiate() (see derivative.h) gives the derivative with
+respect to one variable as a formula. For a fit with hundreds of
+parameters that's hundreds of derivatives to build and run, and
+finite differences are hundreds of evaluations that are only
+good to half the digits. compileGradient() gets every partial
+derivative at once, for a few times the cost of one run:
+
+    GradientProgram g = compileGradient(ast, ast.root);
+    double vars[] = { 2.0, 3.0 };       // in g.variables() order
+    double grad[2];
+    double value = g.run(vars, grad);   // grad[i] = d/d variables()[i]
+
+It works off the Program's instructions. The forward sweep runs
+them like the VM does, but keeps every value around. Then a
+reverse sweep goes over them last to first, carrying each value's
+adjoint: d result / d value. An instruction hands its adjoint
+to its operands, times its own local derivative:
+
+    r = a * b       adj[a] += adj[r] * b
+                    adj[b] += adj[r] * a
+
+When it gets back to the top, the variables' adjoints are the
+gradient. Each instruction is visited once per sweep, whatever
+the number of variables.
+
+A Program reuses its temporary registers as soon as it can, so
+by the end, most of the values the reverse sweep needs have been
+overwritten. compileGradient() renumbers it into a tape where
+every instruction writes a value of its own:
+
+    r4 = r0 * r3        v4 = v0 * v3
+    r5 = r3 ^ r1   ->   v5 = v3 ^ v1
+    r4 = r5 + r4        v6 = v5 + v4
+
+Operands that don't depend on any variable (constants and
+whatever was computed only from them) are marked once at compile
+time, so the reverse sweep never works out a derivative nobody
+reads. x^2 doesn't take a log of x for the exponent's sake.
+Instructions whose adjoint is exactly 0 are skipped, so a 0 * inf
+from a branch max() didn't pick can't turn the gradient into NaN.
+
+Where a function has a corner, the gradient picks:
+
+    abs(a), hypot   0 at 0
+    max(a, b), min  all to a at a tie, and to whichever one isn't
+                    NaN, same as the value
+
+a! uses digamma, (a!)' = a! polygamma(0, a + 1), same as
+differentiate(). A polygamma whose order depends on a variable
+has no derivative, so compileGradient() throws for it.
+
+A GradientProgram never changes after it's made, so it can be run
+from any number of threads at once, each with its own scratch.
+*/
+
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include "bytecode.h"
+
+class GradientProgram {
+    public:
+        // variable names in slot order, same as the Program's
+        const std::vector<std::string>& variables() const { return _variables; }
+        // doubles of scratch a run needs
+        size_t scratchSize() const { return 2 * _valueCount; }
+        // instructions on the tape
+        size_t size() const { return _tape.size(); }
+
+        // value at vars, gradient[i] = d/d variables()[i], scratch has to hold scratchSize() doubles
+        double run(const double* vars, double* gradient, double* scratch) const;
+        // same, with this thread's own scratch
+        double run(std::span<const double> vars, std::span<double> gradient) const;
+        // every variable looked up by name, gradient gets a partial for every bound one, 0 if the expression doesn't use it
+        // throws EvaluatorError if a variable is missing
+        double run(const Bindings& bindings, Bindings& gradient) const;
+
+    private:
+        // like an Instruction, but every one writes value constants + variables + its index on the tape
+        struct Step {
+            OpCode op;
+            u8 flag = 0;
+            // whether a and b depend on a variable, so their adjoints are worth working out
+            bool activeA = false;
+            bool activeB = false;
+            u32 a = 0;
+            u32 b = 0;
+        };
+
+        std::vector<Step> _tape;
+        std::vector<double> _constants;
+        std::vector<std::string> _variables;
+        u32 _valueCount = 0;
+        u32 _result = 0;
+
+        friend GradientProgram compileGradient(const Program& program);
+};
+
+// throws EvaluatorError for a polygamma order that depends on a variable
+GradientProgram compileGradient(const Program& program);
+// throws EvaluatorError like compile() too
+GradientProgram compileGradient(const AST& ast, const NodeID& id);
+
+#endif
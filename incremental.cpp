@@ -0,0 +1,155 @@
+#include "incremental.h"
+
+#include <algorithm>
+
+// one past the last source char of a token
+static size_t sourceEnd(const Token& t) {
+    if (t.is(TokenType::End)) return t.pos;
+    // commands don't keep their '\' in the lexeme
+    return t.pos + t.lexeme.size() + (t.is(TokenType::Command) ? 1 : 0);
+}
+
+Result<NodeID> IncrementalParser::reset(const std::string& text) {
+    _text = text;
+    _tokens.clear();
+    _stats = EditStats{};
+
+    if (auto lexed = tryTokenize(_text, _tokens); !lexed) {
+        _valid = false;
+        return std::unexpected(std::move(lexed.error()));
+    }
+    return reparseAll();
+}
+
+Result<NodeID> IncrementalParser::reparseAll() {
+    _ast = AST();
+    _ast.reserve(_tokens.size());
+    _groups.clear();
+
+    _stats.fullReparse = true;
+    _stats.reparsedTokens = _tokens.size();
+
+    Result<NodeID> result = _parser.tryParse(_tokens, _ast, &_groups);
+    _valid = result.has_value();
+    _liveNodes = _ast.arena.size();
+    return result;
+}
+
+void IncrementalParser::shiftNodePositions(const size_t& from, const i64& delta) {
+    if (delta == 0) return;
+    for (ASTNode& node : _ast.arena) {
+        std::visit([&](auto& n) {
+            if (n.pos != UnknownPos && n.pos >= from) n.pos = (size_t)((i64)n.pos + delta);
+        }, node.kind);
+    }
+}
+
+Result<NodeID> IncrementalParser::edit(const size_t& start, const size_t& length, const std::string& replacement) {
+    size_t editStart = std::min(start, _text.size());
+    size_t oldEnd = editStart + std::min(length, _text.size() - editStart);
+    i64 delta = (i64)replacement.size() - (i64)(oldEnd - editStart);
+    size_t newEnd = editStart + replacement.size();
+
+    _text.replace(editStart, oldEnd - editStart, replacement);
+    _stats = EditStats{};
+
+    if (!_valid) return reset(_text);
+
+    // tokens that end before the edit keep their lexing (End is never one of them)
+    size_t keep = std::partition_point(_tokens.begin(), _tokens.end() - 1, [&](const Token& t) {
+        return sourceEnd(t) < editStart;
+    }) - _tokens.begin();
+    size_t lexFrom = keep > 0 ? sourceEnd(_tokens[keep - 1]) : 0;
+
+    // re-lex until a token lines up with an old one past the edit
+    Diagnostics diagnostics;
+    LexerMachine lexer(true, &diagnostics);
+    std::vector<Token> window;
+    std::optional<Token> token;
+    size_t resume = _tokens.size();
+    bool resynced = false;
+
+    for (size_t i = lexFrom; i <= _text.size() && !resynced && !lexer.finished(); i++) {
+        unsigned char c = (i < _text.size()) ? static_cast<unsigned char>(_text[i]) : '\0';
+
+        bool consumed;
+        do {
+            consumed = lexer.feed(c, i, token);
+            if (!token) continue;
+
+            if (token->pos >= newEnd) {
+                size_t oldPos = (size_t)((i64)token->pos - delta);
+                auto match = std::lower_bound(_tokens.begin() + keep, _tokens.end(), oldPos, [](const Token& t, const size_t& pos) {
+                    return t.pos < pos;
+                });
+                if (match != _tokens.end() && match->pos == oldPos) {
+                    resume = match - _tokens.begin();
+                    resynced = true;
+                    break;
+                }
+            }
+            window.push_back(std::move(*token));
+            token.reset();
+        } while (!consumed);
+    }
+    _stats.relexedTokens = window.size() + (resynced ? 1 : 0);
+
+    if (!diagnostics.empty()) {
+        _valid = false;
+        return std::unexpected(std::move(diagnostics));
+    }
+
+    // splice the window in and shift everything after it
+    i64 tokenDelta = (i64)window.size() - (i64)(resume - keep);
+    for (size_t j = resume; j < _tokens.size(); j++) {
+        _tokens[j].pos = (size_t)((i64)_tokens[j].pos + delta);
+    }
+    _tokens.erase(_tokens.begin() + keep, _tokens.begin() + resume);
+    _tokens.insert(_tokens.begin() + keep, std::make_move_iterator(window.begin()), std::make_move_iterator(window.end()));
+
+    // whitespace-only edits don't change a single token
+    if (window.empty() && resume == keep) {
+        shiftNodePositions(oldEnd, delta);
+        return _ast.root;
+    }
+
+    // smallest group whose brackets are both outside the re-lexed tokens
+    const GroupSpan* enclosing = nullptr;
+    for (const GroupSpan& g : _groups) {
+        if (g.open >= keep || g.close < resume) continue;
+        if (!enclosing || g.close - g.open < enclosing->close - enclosing->open) enclosing = &g;
+    }
+    if (!enclosing) return reparseAll();
+
+    GroupSpan group = *enclosing;
+    size_t newClose = (size_t)((i64)group.close + tokenDelta);
+
+    shiftNodePositions(oldEnd, delta);
+
+    std::vector<GroupSpan> innerGroups;
+    Result<NodeID> body = _parser.tryParseGroup(_tokens, _ast, group.open, newClose, &innerGroups);
+    if (!body) return reparseAll();
+
+    _stats.reparsedTokens = newClose - group.open + 1;
+
+    // copy the new body into the old group node so its parent doesn't need to change
+    _ast.at(group.inner) = _ast.at(*body);
+
+    // groups inside the edited one are replaced, groups after it move with the tokens
+    std::erase_if(_groups, [&](const GroupSpan& g) {
+        return g.open > group.open && g.close < group.close;
+    });
+    for (GroupSpan& g : _groups) {
+        if (g.open >= group.close) g.open = (size_t)((i64)g.open + tokenDelta);
+        if (g.close >= group.close) g.close = (size_t)((i64)g.close + tokenDelta);
+    }
+    for (GroupSpan& g : innerGroups) {
+        if (g.inner.i == body->i) g.inner = group.inner;
+        _groups.push_back(g);
+    }
+
+    // too much garbage from old group bodies, start clean
+    if (_ast.arena.size() > 4 * _liveNodes + 256) return reparseAll();
+
+    return _ast.root;
+}
@@ -0,0 +1,80 @@
+/*
+Incremental Re-Parsing
+
+When a formula is being typed, every keystroke changes
+one or two characters, but lexing and parsing from
+scratch redoes the whole thing every time. The
+IncrementalParser keeps the text, tokens, and AST from
+last time and only redoes the part an edit could've
+changed.
+
+    1. re-lex
+        tokens that end before the edit can't change, so
+        lexing restarts right after the last of them. As
+        soon as the lexer starts a new token in the
+        untouched text after the edit at the same place
+        an old token started, everything after lexes the
+        same as before (every token starts from the Start
+        state), so the rest of the old tokens are reused
+        with their positions shifted.
+
+    2. re-parse
+        the parser remembers every (...) and {...} group
+        it parsed and which node it became. The smallest
+        group around the re-lexed tokens gets its body
+        re-parsed on its own, and the new node is copied
+        into the old group node's slot, so the parent and
+        every subtree outside the group stays as it is.
+
+            "\sin(x + 1) \cdot \frac{a}{b}"
+                  ^ edit, only "x + 1" is re-parsed
+
+        if there's no such group, or the group's body no
+        longer parses to exactly its old brackets, it just
+        parses everything again.
+
+The old group contents are left behind in the arena as
+garbage, so every so often a full re-parse compacts it.
+*/
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "parser.h"
+
+struct EditStats {
+    size_t relexedTokens = 0;       // tokens produced by re-lexing the edit window
+    size_t reparsedTokens = 0;      // tokens the parser went over again
+    bool fullReparse = false;
+};
+
+class IncrementalParser {
+    public:
+        // lexes and parses text from scratch
+        Result<NodeID> reset(const std::string& text);
+
+        // replaces length chars at start with replacement and updates tokens and AST to match
+        Result<NodeID> edit(const size_t& start, const size_t& length, const std::string& replacement);
+
+        const std::string& text() const { return _text; }
+        const std::vector<Token>& tokens() const { return _tokens; }
+        const AST& ast() const { return _ast; }
+        const EditStats& lastEdit() const { return _stats; }
+
+    private:
+        std::string _text;
+        std::vector<Token> _tokens;
+        AST _ast;
+        std::vector<GroupSpan> _groups;
+        Parser _parser;
+
+        bool _valid = false;        // false after an error, the next edit starts over
+        size_t _liveNodes = 0;      // arena size right after the last full parse
+        EditStats _stats;
+
+        Result<NodeID> reparseAll();
+        // moves the source position of every node at or after from by delta
+        void shiftNodePositions(const size_t& from, const i64& delta);
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include "jit.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+JitProgram::~JitProgram() {
+#if defined(__x86_64__) && defined(__linux__)
+    if (_pages) munmap(_pages, _mappedSize);
+#endif
+}
+
+JitProgram::JitProgram(JitProgram&& other) noexcept {
+    *this = std::move(other);
+}
+
+JitProgram& JitProgram::operator=(JitProgram&& other) noexcept {
+    if (this == &other) return *this;
+#if defined(__x86_64__) && defined(__linux__)
+    if (_pages) munmap(_pages, _mappedSize);
+#endif
+    _pages = std::exchange(other._pages, nullptr);
+    _mappedSize = std::exchange(other._mappedSize, 0);
+    _codeSize = std::exchange(other._codeSize, 0);
+    _entry = std::exchange(other._entry, nullptr);
+    _variables = std::move(other._variables);
+    return *this;
+}
+
+JitProgram jitCompile(const AST& ast, const NodeID& id) {
+    return jitCompile(compile(ast, id));
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+
+namespace {
+    // everything that isn't plain SSE2 gets called, and goes through the VM's own math
+    template <OpCode op, u8 flag = 0>
+    double callOp(double a, double b) {
+        return applyOp(op, flag, a, b);
+    }
+
+    using Helper = double (*)(double, double);
+
+    Helper helperFor(const Instruction& in) {
+        switch (in.op) {
+            case OpCode::Power: return &callOp<OpCode::Power>;
+            case OpCode::PowerRoot: return in.flag ? &callOp<OpCode::PowerRoot, 1> : &callOp<OpCode::PowerRoot, 0>;
+            case OpCode::Factorial: return &callOp<OpCode::Factorial>;
+            case OpCode::Sine: return &callOp<OpCode::Sine>;
+            case OpCode::Cosine: return &callOp<OpCode::Cosine>;
+            case OpCode::Tangent: return &callOp<OpCode::Tangent>;
+            case OpCode::Atan2: return &callOp<OpCode::Atan2>;
+            case OpCode::Exponential: return &callOp<OpCode::Exponential>;
+            case OpCode::NaturalLogarithm: return &callOp<OpCode::NaturalLogarithm>;
+            case OpCode::Logarithm: return &callOp<OpCode::Logarithm>;
+            case OpCode::LogarithmBase: return &callOp<OpCode::LogarithmBase>;
+            case OpCode::Hypotenuse: return &callOp<OpCode::Hypotenuse>;
+            case OpCode::Max: return &callOp<OpCode::Max>;
+            case OpCode::Min: return &callOp<OpCode::Min>;
+            case OpCode::Polygamma: return &callOp<OpCode::Polygamma>;
+            default: return nullptr;
+        }
+    }
+
+    bool isUnaryOp(const OpCode& op) {
+        switch (op) {
+            case OpCode::Negate:
+            case OpCode::Factorial:
+            case OpCode::Percent:
+            case OpCode::Sine:
+            case OpCode::Cosine:
+            case OpCode::Tangent:
+            case OpCode::AbsoluteValue:
+            case OpCode::Exponential:
+            case OpCode::NaturalLogarithm:
+            case OpCode::Logarithm: return true;
+            default: return false;
+        }
+    }
+
+    // the data after the code: two 16-byte masks, then 8 bytes per constant
+    constexpr i32 SIGN_MASK = 0;
+    constexpr i32 ABS_MASK = 16;
+    constexpr i32 CONSTANTS = 32;
+
+    // where an operand is, an xmm register or somewhere in memory
+    struct Operand {
+        enum class Kind : u8 { Xmm, Variable, Home, Data } kind;
+        u8 xmm = 0;
+        i32 disp = 0;   // off rbx, rsp, or into the data
+
+        bool isXmm(const u8& x) const { return kind == Kind::Xmm && xmm == x; }
+        static Operand reg(const u8& x) { return { Kind::Xmm, x, 0 }; }
+    };
+
+    class Assembler {
+        public:
+            std::vector<u8> code;
+
+            // a rip-relative disp32 at code[at] pointing at data offset
+            struct Fixup {
+                size_t at;
+                i32 dataOffset;
+            };
+            std::vector<Fixup> fixups;
+
+            void byte(const u8& b) { code.push_back(b); }
+            void dword(const u32& v) { for (int i = 0; i < 4; i++) byte((u8)(v >> (8 * i))); }
+            void qword(const u64& v) { for (int i = 0; i < 8; i++) byte((u8)(v >> (8 * i))); }
+
+            // prefix 0F op with xmm reg as the destination and m as the source (or destination for stores)
+            void sse(const u8& prefix, const u8& op, const u8& reg, const Operand& m) {
+                byte(prefix);
+                u8 rex = 0x40 | ((reg & 8) ? 0x04 : 0) | ((m.kind == Operand::Kind::Xmm && (m.xmm & 8)) ? 0x01 : 0);
+                if (rex != 0x40) byte(rex);
+                byte(0x0F);
+                byte(op);
+
+                u8 r = (reg & 7) << 3;
+                switch (m.kind) {
+                    case Operand::Kind::Xmm: byte(0xC0 | r | (m.xmm & 7)); break;
+                    // [rbx + disp32]
+                    case Operand::Kind::Variable: byte(0x80 | r | 3); dword((u32)m.disp); break;
+                    // [rsp + disp32], rsp as a base needs a SIB byte
+                    case Operand::Kind::Home: byte(0x80 | r | 4); byte(0x24); dword((u32)m.disp); break;
+                    // [rip + disp32], filled in once the data has an address
+                    case Operand::Kind::Data: {
+                        byte(0x00 | r | 5);
+                        fixups.push_back({ code.size(), m.disp });
+                        dword(0);
+                        break;
+                    }
+                }
+            }
+
+            void movsd(const u8& reg, const Operand& m) {
+                if (m.isXmm(reg)) return;
+                // movapd for register copies, movsd would keep a dependency on the old upper half
+                if (m.kind == Operand::Kind::Xmm) sse(0x66, 0x28, reg, m);
+                else sse(0xF2, 0x10, reg, m);
+            }
+            void store(const Operand& m, const u8& reg) { sse(0xF2, 0x11, reg, m); }
+
+            void push_rbx() { byte(0x53); }
+            void pop_rbx() { byte(0x5B); }
+            void mov_rbx_rdi() { byte(0x48); byte(0x89); byte(0xFB); }
+            void sub_rsp(const u32& n) { byte(0x48); byte(0x81); byte(0xEC); dword(n); }
+            void add_rsp(const u32& n) { byte(0x48); byte(0x81); byte(0xC4); dword(n); }
+            void call(const void* target) {
+                // mov rax, imm64; call rax
+                byte(0x48); byte(0xB8); qword((u64)(uintptr_t)target);
+                byte(0xFF); byte(0xD0);
+            }
+            void ret() { byte(0xC3); }
+    };
+
+    class JitCompiler {
+        public:
+            JitCompiler(const Program& program)
+                : _program(program),
+                  _constantCount((u32)program.constants().size()),
+                  _tempBase(_constantCount + (u32)program.variables().size()),
+                  _regOf(program.registerCount(), -1) {}
+
+            // code and data, data still has to be placed after the code
+            void generate(std::vector<u8>& data) {
+                const std::vector<Instruction>& code = _program.code();
+                findDeaths();
+
+                u32 frame = (u32)(((program().registerCount() - _tempBase) * 8 + 15) & ~size_t(15));
+                // rsp is 8 off 16 on entry, push rbx fixes that and frame keeps it for the calls
+                _asm.push_rbx();
+                _asm.mov_rbx_rdi();
+                if (frame) _asm.sub_rsp(frame);
+
+                for (size_t i = 0; i < code.size(); i++) {
+                    if (helperFor(code[i])) emitCall(i);
+                    else emitInline(i);
+                }
+
+                _asm.movsd(0, operand(_program.result()));
+                if (frame) _asm.add_rsp(frame);
+                _asm.pop_rbx();
+                _asm.ret();
+
+                data.assign(CONSTANTS + 8 * (_constantCount + 1), 0);
+                u64 sign = 0x8000000000000000ULL;
+                u64 abs = 0x7FFFFFFFFFFFFFFFULL;
+                std::memcpy(data.data() + SIGN_MASK, &sign, 8);
+                std::memcpy(data.data() + ABS_MASK, &abs, 8);
+                std::memcpy(data.data() + ABS_MASK + 8, &abs, 8);
+                for (u32 c = 0; c < _constantCount; c++) std::memcpy(data.data() + CONSTANTS + 8 * c, &_program.constants()[c], 8);
+                double hundred = 100;
+                std::memcpy(data.data() + hundredOffset(), &hundred, 8);
+            }
+
+            Assembler& assembler() { return _asm; }
+
+        private:
+            const Program& _program;
+            u32 _constantCount;
+            u32 _tempBase;
+            Assembler _asm;
+
+            // which operands are read for the last time by each instruction
+            std::vector<bool> _dieA, _dieB;
+
+            std::vector<int> _regOf;    // Program register -> xmm, -1 if it's only in its home
+            int _holder[16] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+            bool _dirty[16] = {};       // newer than what's in its home
+
+            const Program& program() const { return _program; }
+            bool isTemp(const u32& r) const { return r >= _tempBase; }
+            i32 hundredOffset() const { return CONSTANTS + 8 * (i32)_constantCount; }
+            Operand home(const u32& r) const { return { Operand::Kind::Home, 0, (i32)(8 * (r - _tempBase)) }; }
+
+            Operand operand(const u32& r) const {
+                if (r < _constantCount) return { Operand::Kind::Data, 0, CONSTANTS + 8 * (i32)r };
+                if (r < _tempBase) return { Operand::Kind::Variable, 0, (i32)(8 * (r - _constantCount)) };
+                if (_regOf[r] >= 0) return Operand::reg((u8)_regOf[r]);
+                return home(r);
+            }
+
+            // backwards liveness, temporaries get reused so this is per definition and not per register
+            void findDeaths() {
+                const std::vector<Instruction>& code = _program.code();
+                std::vector<bool> live(_program.registerCount(), false);
+                live[_program.result()] = true;
+                _dieA.assign(code.size(), false);
+                _dieB.assign(code.size(), false);
+
+                for (size_t i = code.size(); i-- > 0;) {
+                    const Instruction& in = code[i];
+                    _dieA[i] = in.a == in.dst || !live[in.a];
+                    _dieB[i] = in.b == in.dst || !live[in.b];
+                    live[in.dst] = false;
+                    live[in.a] = true;
+                    if (!isUnaryOp(in.op)) live[in.b] = true;
+                }
+            }
+
+            void unmap(const u8& x) {
+                if (_holder[x] >= 0) _regOf[_holder[x]] = -1;
+                _holder[x] = -1;
+                _dirty[x] = false;
+            }
+
+            void writeBack(const u8& x) {
+                if (_holder[x] >= 0 && _dirty[x]) _asm.store(home((u32)_holder[x]), x);
+                _dirty[x] = false;
+            }
+
+            // a free xmm register, spilling one that isn't in exclude if there isn't any
+            u8 allocate(const u32& exclude) {
+                for (u8 x = 0; x < 16; x++) {
+                    if (_holder[x] < 0 && !(exclude & (1u << x))) return x;
+                }
+                for (u8 x = 0; x < 16; x++) {
+                    if (exclude & (1u << x)) continue;
+                    writeBack(x);
+                    unmap(x);
+                    return x;
+                }
+                return 0;
+            }
+
+            u32 maskOf(const u32& r) const {
+                return (isTemp(r) && _regOf[r] >= 0) ? (1u << _regOf[r]) : 0;
+            }
+
+            // drops operands read for the last time, except the register that's becoming dst
+            void retire(const size_t& i, const int& keep) {
+                const Instruction& in = _program.code()[i];
+                auto drop = [&](const u32& r, const bool& dies) {
+                    if (!dies || !isTemp(r) || _regOf[r] < 0) return;
+                    if (_regOf[r] == keep) _regOf[r] = -1;
+                    else unmap((u8)_regOf[r]);
+                };
+                drop(in.a, _dieA[i]);
+                if (!isUnaryOp(in.op)) drop(in.b, _dieB[i]);
+                // whatever dst held before is dead now, it's being redefined
+                if (_regOf[in.dst] >= 0 && _regOf[in.dst] != keep) unmap((u8)_regOf[in.dst]);
+            }
+
+            void define(const u32& dst, const u8& x) {
+                _regOf[dst] = x;
+                _holder[x] = (int)dst;
+                _dirty[x] = true;
+            }
+
+            void emitInline(const size_t& i) {
+                const Instruction& in = _program.code()[i];
+                bool unary = isUnaryOp(in.op);
+
+                // compute into a's register if this is a's last read, otherwise into a copy of it
+                Operand a = operand(in.a);
+                u8 r;
+                if (a.kind == Operand::Kind::Xmm && _dieA[i] && isTemp(in.a)) r = a.xmm;
+                else {
+                    r = allocate(maskOf(in.a) | (unary ? 0 : maskOf(in.b)));
+                    _asm.movsd(r, operand(in.a));
+                }
+
+                switch (in.op) {
+                    case OpCode::Add: _asm.sse(0xF2, 0x58, r, operand(in.b)); break;
+                    case OpCode::Subtract: _asm.sse(0xF2, 0x5C, r, operand(in.b)); break;
+                    case OpCode::Multiply: _asm.sse(0xF2, 0x59, r, operand(in.b)); break;
+                    case OpCode::Divide: _asm.sse(0xF2, 0x5E, r, operand(in.b)); break;
+                    // xorpd/andpd with a mask, both need the 16 byte aligned data
+                    case OpCode::Negate: _asm.sse(0x66, 0x57, r, { Operand::Kind::Data, 0, SIGN_MASK }); break;
+                    case OpCode::AbsoluteValue: _asm.sse(0x66, 0x54, r, { Operand::Kind::Data, 0, ABS_MASK }); break;
+                    case OpCode::Percent: _asm.sse(0xF2, 0x5E, r, { Operand::Kind::Data, 0, hundredOffset() }); break;
+                    default: break;
+                }
+
+                retire(i, r);
+                define(in.dst, r);
+            }
+
+            void emitCall(const size_t& i) {
+                const Instruction& in = _program.code()[i];
+                bool unary = isUnaryOp(in.op);
+
+                // the call clobbers every xmm register, so save whatever's read after it
+                for (u8 x = 0; x < 16; x++) {
+                    int t = _holder[x];
+                    if (t < 0) continue;
+                    bool dying = ((u32)t == in.a && _dieA[i]) || (!unary && (u32)t == in.b && _dieB[i]);
+                    if (!dying && (u32)t != in.dst) writeBack(x);
+                }
+
+                // a into xmm0 and b into xmm1, without either move clobbering the other's source
+                Operand a = operand(in.a);
+                Operand b = unary ? a : operand(in.b);
+                if (!unary && b.isXmm(0) && a.isXmm(1)) {
+                    _asm.movsd(2, b);
+                    _asm.movsd(0, a);
+                    _asm.movsd(1, Operand::reg(2));
+                } else if (!unary && b.isXmm(0)) {
+                    _asm.movsd(1, b);
+                    _asm.movsd(0, a);
+                } else {
+                    _asm.movsd(0, a);
+                    if (!unary) _asm.movsd(1, b);
+                }
+
+                _asm.call((const void*)helperFor(in));
+
+                for (u8 x = 0; x < 16; x++) unmap(x);
+                define(in.dst, 0);
+            }
+    };
+}
+
+JitProgram jitCompile(const Program& program) {
+    JitCompiler compiler(program);
+    std::vector<u8> data;
+    compiler.generate(data);
+    Assembler& assembler = compiler.assembler();
+
+    size_t dataStart = (assembler.code.size() + 15) & ~size_t(15);
+    size_t total = dataStart + data.size();
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (total + page - 1) / page * page;
+
+    void* pages = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) throw EvaluatorError(UnknownPos, "Couldn't map pages for JIT code");
+
+    u8* base = static_cast<u8*>(pages);
+    for (const Assembler::Fixup& f : assembler.fixups) {
+        i32 disp = (i32)((i64)(dataStart + f.dataOffset) - (i64)(f.at + 4));
+        std::memcpy(assembler.code.data() + f.at, &disp, 4);
+    }
+    std::memcpy(base, assembler.code.data(), assembler.code.size());
+    std::memcpy(base + dataStart, data.data(), data.size());
+
+    // writable until now, executable from here on
+    if (mprotect(pages, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, mapped);
+        throw EvaluatorError(UnknownPos, "Couldn't make JIT code executable");
+    }
+
+    JitProgram jit;
+    jit._pages = pages;
+    jit._mappedSize = mapped;
+    jit._codeSize = total;
+    jit._entry = reinterpret_cast<JitFunction>(pages);
+    jit._variables = program.variables();
+    return jit;
+}
+
+#else
+
+JitProgram jitCompile(const Program&) {
+    throw EvaluatorError(UnknownPos, "The JIT only supports x86-64 Linux");
+}
+
+#endif
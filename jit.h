@@ -0,0 +1,84 @@
+/*
+x86-64 JIT
+
+The bytecode VM still pays for a switch on every instruction,
+which for short formulas is most of the time spent. jitCompile()
+goes one step further and turns a Program into actual machine
+code, so running it is just calling a function pointer:
+
+    JitProgram jit = jitCompile(ast, ast.root);
+    double vars[] = { 2.0 };            // in jit.variables() order
+    double value = jit(vars);
+
+It works straight off the Program's instructions, so it gets
+the bytecode compiler's constant folding and shared subtrees
+for free. Every temporary register of the Program gets a home
+on the stack, and a linear scan over the instructions keeps as
+many as it can in xmm0-xmm15 instead, handing a register back
+as soon as the instruction that last reads it is done. Constants
+and variables are never loaded on their own, they're read
+straight out of memory as the second operand of addsd and
+friends.
+
+Add, subtract, multiply, divide, negate, abs and percent are
+plain SSE2. Everything else (sin, ln, pow, ...) is a call into
+the same applyOp the VM uses, so results match it bit for bit.
+All the xmm registers get clobbered by a call, so anything
+still needed afterwards is written to its home right before.
+
+The code goes into its own mmap'd pages, which get flipped
+from writable to executable once the code is in, never both.
+Every JitProgram has pages of its own, so it's meant for the
+few formulas that run the most. Thousands of tiny JIT'd ones
+spread over thousands of pages end up slower than the VM.
+Only x86-64 Linux (System V calling convention) is supported,
+anywhere else JIT_SUPPORTED is false and jitCompile throws.
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "bytecode.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+inline constexpr bool JIT_SUPPORTED = true;
+#else
+inline constexpr bool JIT_SUPPORTED = false;
+#endif
+
+// takes the variable values in slot order
+using JitFunction = double (*)(const double* vars);
+
+// owns the executable pages, so the function pointer is only good while this is alive
+class JitProgram {
+    public:
+        JitProgram() = default;
+        ~JitProgram();
+        JitProgram(JitProgram&& other) noexcept;
+        JitProgram& operator=(JitProgram&& other) noexcept;
+        JitProgram(const JitProgram&) = delete;
+        JitProgram& operator=(const JitProgram&) = delete;
+
+        JitFunction function() const { return _entry; }
+        double operator()(const double* vars) const { return _entry(vars); }
+
+        // variable names in slot order, same as the Program's
+        const std::vector<std::string>& variables() const { return _variables; }
+        // bytes of machine code plus its constants
+        size_t codeSize() const { return _codeSize; }
+
+    private:
+        void* _pages = nullptr;
+        size_t _mappedSize = 0;
+        size_t _codeSize = 0;
+        JitFunction _entry = nullptr;
+        std::vector<std::string> _variables;
+
+        friend JitProgram jitCompile(const Program& program);
+};
+
+// throws EvaluatorError if the JIT isn't supported here or the pages can't be mapped
+JitProgram jitCompile(const Program& program);
+JitProgram jitCompile(const AST& ast, const NodeID& id);
+
+#endif
@@ -1,157 +1,323 @@
 #include "lexer.h"
 #include "Error.h"
 
-enum class State {
-    Start,
-    Number,
-    NumberFracMark,
-    NumberFrac,
-    NumberExpMark,
-    NumberExpSign,
-    NumberExp,
-    Identifier,
-    Command
+#include <charconv>
+#include <limits>
+#include <numeric>
+#include <istream>
+#include <unistd.h>
+#include <cerrno>
+
+static constexpr i64 POWERS_OF_TEN[] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL
 };
 
-void Tokenize(const std::string& input, std::vector<Token>& tokens) {
-    State s = State::Start;
+// parses a lexeme the state machine already validated as mantissa * 10^k
+static bool exactDecimal(const std::string& lexeme, i64& outNumerator, i64& outDenominator) {
+    const char* c = lexeme.data();
+    const char* end = c + lexeme.size();
+
+    i64 mantissa = 0;
+    i64 scale = 0;          // power of ten applied to the mantissa
+    i64 pendingZeros = 0;   // zeros not yet multiplied in, so 1.500000 doesn't overflow
+    bool inFraction = false;
+
+    for (; c != end && *c != 'e' && *c != 'E'; c++) {
+        if (*c == '.') { inFraction = true; continue; }
+
+        i64 digit = *c - '0';
+        if (inFraction) scale--;
+
+        if (digit == 0) { pendingZeros++; continue; }
+
+        // multiply the held back zeros in before the next nonzero digit
+        for (; pendingZeros > 0; pendingZeros--) {
+            if (mantissa > std::numeric_limits<i64>::max() / 10) return false;
+            mantissa *= 10;
+        }
+        if (mantissa > (std::numeric_limits<i64>::max() - digit) / 10) return false;
+        mantissa = mantissa * 10 + digit;
+    }
+    // trailing zeros just shift the exponent
+    scale += pendingZeros;
+
+    if (c != end) {
+        c++; // skip 'e'
+        if (c != end && *c == '+') c++;
+        i32 exponent = 0;
+        auto [ptr, ec] = std::from_chars(c, end, exponent);
+        if (ec != std::errc() || ptr != end) return false;
+        scale += exponent;
+    }
+
+    if (mantissa == 0) {
+        outNumerator = 0;
+        outDenominator = 1;
+        return true;
+    }
+
+    if (scale >= 0) {
+        if (scale > 18 || mantissa > std::numeric_limits<i64>::max() / POWERS_OF_TEN[scale]) return false;
+        outNumerator = mantissa * POWERS_OF_TEN[scale];
+        outDenominator = 1;
+        return true;
+    }
+
+    if (-scale > 18) return false;
+    i64 denominator = POWERS_OF_TEN[-scale];
+    i64 commonDivisor = std::gcd(mantissa, denominator);
+    outNumerator = mantissa / commonDivisor;
+    outDenominator = denominator / commonDivisor;
+    return true;
+}
+
+// builds the token value for a number lexeme, exact when possible
+static Number makeNumber(const std::string& lexeme, const bool& exactNumbers) {
+    Number num;
+
+    if (exactNumbers && exactDecimal(lexeme, num.numerator, num.denominator)) {
+        num.isExact = true;
+        num.isInt = num.denominator == 1;
+        if (num.isInt) num.value = num.numerator;
+        else num.value = (double)num.numerator / (double)num.denominator;
+        return num;
+    }
+
+    // double fallback, from_chars has no '+' exponent sign so drop it
+    std::string text = lexeme;
+    if (size_t plus = text.find('+'); plus != std::string::npos) text.erase(plus, 1);
+
+    double value = 0.0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    num.value = value;
+    num.isInt = false;
+    return num;
+}
+
+void LexerMachine::reset() {
+    _state = LexerState::Start;
+    _buffer.clear();
+    _startPos = 0;
+    _finished = false;
+}
+
+void LexerMachine::begin(const LexerState& next, const size_t& pos) {
+    _state = next;
+    _buffer.clear();
+    _startPos = pos;
+}
 
-    std::string buffer; // stored lexeme
-    size_t startPos = 0;   // start of token in original string
+void LexerMachine::commit(const TokenType& type, std::string lexeme, const size_t& pos, std::optional<Token>& out) const {
+    out = Token{ type, std::move(lexeme), pos };
+}
 
-    auto commit = [&](TokenType type, std::string lexeme, size_t pos, std::optional<Number> number = std::nullopt) {
-        if (number.has_value()) tokens.push_back(Token{ type, std::move(lexeme), pos, number });
-        else { tokens.push_back(Token{ type, std::move(lexeme), pos }); }
-    };
+void LexerMachine::commitNumber(std::optional<Token>& out) {
+    out = Token{ TokenType::Number, _buffer, _startPos, makeNumber(_buffer, _exactNumbers) };
+    _state = LexerState::Start;
+}
 
-    // begin a new token
-    auto begin = [&](State next, size_t pos) {
-        s = next;
-        buffer.clear();
-        startPos = pos;
-    };
+void LexerMachine::fail(const size_t& pos, const std::string& message) {
+    if (!_diagnostics) throw LexerError(pos, message);
+    _diagnostics->push_back({ ErrorStage::Lexer, pos, message });
+    _state = LexerState::Start;
+    _buffer.clear();
+}
+
+bool LexerMachine::feed(const unsigned char& c, const size_t& i, std::optional<Token>& out) {
+    switch (_state) {
+        case LexerState::Start: {
+            if (c == '\0') {
+                // End sentinel token at the end + 1
+                commit(TokenType::End, "End", i, out);
+                _finished = true;
+                return true;
+            }
+
+            // ignore spaces at the start of a token
+            if (isspace(c)) { return true; }
+            
+            if (isdigit(c)) { begin(LexerState::Number, i); _buffer += static_cast<char>(c); return true; }
+            if (c == '.') { begin(LexerState::NumberFracMark, i); _buffer += '.'; return true; }
+            if (c == '\\') { begin(LexerState::Command, i); return true; }
+            
+            if (isalnum(c)) { begin(LexerState::Identifier, i); _buffer += static_cast<char>(c); return true; }
+            
+            if (c == '{') { commit(TokenType::LBrace, "{", i, out); return true; }
+            if (c == '}') { commit(TokenType::RBrace, "}", i, out); return true; }
+            if (c == '(') { commit(TokenType::LParenthesis, "(", i, out); return true; }
+            if (c == ')') { commit(TokenType::RParenthesis, ")", i, out); return true; }
+            if (c == '[') { commit(TokenType::LBracket, "[", i, out); return true; }
+            if (c == ']') { commit(TokenType::RBracket, "]", i, out); return true; }
+            
+            if (c == ',') { commit(TokenType::Comma, ",", i, out); return true; }
+            if (c == '+') { commit(TokenType::Plus, "+", i, out); return true; }
+            if (c == '-') { commit(TokenType::Minus, "-", i, out); return true; }
+            if (c == '*') { commit(TokenType::Star, "*", i, out); return true; }
+            if (c == '/') { commit(TokenType::Slash, "/", i, out); return true; }
+            if (c == '^') { commit(TokenType::Caret, "^", i, out); return true; }
+            if (c == '_') { commit(TokenType::Underscore, "_", i, out); return true; }
+            if (c == '=') { commit(TokenType::Equals, "=", i, out); return true; }
+
+            std::string msg = std::string("Unexpected character '") + static_cast<char>(c) + '\'';
+            fail(i, msg);
+            return true;
+        }
+
+        case LexerState::Number: {
+            if (isdigit(c)) { _buffer += c; return true; }
+            if (c == '.') { _buffer += '.'; _state = LexerState::NumberFracMark; return true; }
+
+            if (c == 'e' || c == 'E') { _buffer += static_cast<char>(c); _state = LexerState::NumberExpMark; return true; }
+            
+            commitNumber(out);
+            return false;
+        }
+        case LexerState::NumberFracMark: {
+            if (isdigit(c)) { _buffer += static_cast<char>(c); _state = LexerState::NumberFrac; return true; }
+            
+            std::string msg = std::string("Expected digit after '.', instead got '") + static_cast<char>(c) + '\'';
+            fail(i, msg);
+            return false;
+        }
+        case LexerState::NumberFrac: {
+            if (isdigit(c)) { _buffer += static_cast<char>(c); return true; }
+            if (c == 'e' || c == 'E') { _buffer += static_cast<char>(c); _state = LexerState::NumberExpMark; return true; }
+            
+            commitNumber(out);
+            return false;
+        }
+        case LexerState::NumberExpMark: {
+            if (isdigit(c)) { _buffer += static_cast<char>(c); _state = LexerState::NumberExp; return true; }
+            if (c == '-' || c == '+') { _buffer += static_cast<char>(c); _state = LexerState::NumberExpSign; return true; }
+            
+            std::string msg = std::string("Expected digit or sign after 'E', instead got '") + static_cast<char>(c) + '\'';
+            fail(i, msg);
+            return false;
+        }
+        case LexerState::NumberExpSign: {
+            if (isdigit(c)) { _buffer += static_cast<char>(c); _state = LexerState::NumberExp; return true; }
+            
+            std::string msg = std::string("Expected digit after \"E(sign)\", instead got '") + static_cast<char>(c) + '\'';
+            fail(i, msg);
+            return false;
+        }
+        case LexerState::NumberExp: {
+            if (isdigit(c)) { _buffer += static_cast<char>(c); return true; }
+            
+            commitNumber(out);
+            return false;
+        }
+        case LexerState::Identifier: {
+            if (isalnum(c)) { _buffer += c; return true; } 
+
+            commit(TokenType::Identifier, _buffer, _startPos, out);
+            _state = LexerState::Start;
+            return false;
+        }
+        case LexerState::Command: {
+            if (isalnum(c)) { _buffer += c; return true; }
+
+            commit(TokenType::Command, _buffer, _startPos, out);
+            _state = LexerState::Start;
+            return false;
+        }
+    }
+
+    std::string msg = "Internal lexer error. Unknown lexer state";
+    throw LexerError(i, msg);
+}
+
+void Tokenize(const std::string& input, std::vector<Token>& tokens, const bool& exactNumbers) {
+    LexerMachine lexer(exactNumbers);
+    std::optional<Token> token;
 
     for (size_t i = 0; i <= input.size(); i++) {
         // add a sentinel '\0' at the end of the input string
         unsigned char c = (i < input.size()) ? static_cast<unsigned char>(input[i]) : '\0';
 
-        switch (s) {
-            case State::Start: {
-                if (c == '\0') {
-                    // End sentinel token at the end + 1
-                    commit(TokenType::End, "End", input.size());
-                    return;
-                }
-
-                // ignore spaces at the start of a token
-                if (isspace(c)) { break; }
-                
-                if (isdigit(c)) { begin(State::Number, i); buffer += static_cast<char>(c); break; }
-                if (c == '.') { begin(State::NumberFracMark, i); buffer += '.'; break; }
-                if (c == '\\') { begin(State::Command, i); break; }
-                
-                if (isalnum(c)) { begin(State::Identifier, i); buffer += static_cast<char>(c); break; }
-                
-                if (c == '{') { commit(TokenType::LBrace, "{", i); break; }
-                if (c == '}') { commit(TokenType::RBrace, "}", i); break; }
-                if (c == '(') { commit(TokenType::LParenthesis, "(", i); break; }
-                if (c == ')') { commit(TokenType::RParenthesis, ")", i); break; }
-                if (c == '[') { commit(TokenType::LBracket, "[", i); break; }
-                if (c == ']') { commit(TokenType::RBracket, "]", i); break; }
-                
-                if (c == ',') { commit(TokenType::Comma, ",", i); break; }
-                if (c == '+') { commit(TokenType::Plus, "+", i); break; }
-                if (c == '-') { commit(TokenType::Minus, "-", i); break; }
-                if (c == '*') { commit(TokenType::Star, "*", i); break; }
-                if (c == '/') { commit(TokenType::Slash, "/", i); break; }
-                if (c == '^') { commit(TokenType::Caret, "^", i); break; }
-                if (c == '_') { commit(TokenType::Underscore, "_", i); break; }
-                if (c == '=') { commit(TokenType::Equals, "=", i); break; }
-
-                std::string msg = "Unexpected character '" + c + '\'';
-                throw LexerError(i, msg);
+        // a character that ends a token gets fed again from the start state
+        bool consumed;
+        do {
+            consumed = lexer.feed(c, i, token);
+            if (token) {
+                tokens.push_back(std::move(*token));
+                token.reset();
             }
+        } while (!consumed);
 
-            case State::Number: {
-                if (isdigit(c)) { buffer += c; break; }
-                if (c == '.') { buffer += '.'; s = State::NumberFracMark; break; }
-
-                if (c == 'e' || c == 'E') { buffer += static_cast<char>(c); s = State::NumberExpMark; break; }
-                
-                
-                Number num;
-                num.value = std::stoi(buffer);
-                num.isInt = true;
-                commit(TokenType::Number, buffer, startPos, num);
-                s = State::Start;
-                --i;
-                break;
-            }
-            case State::NumberFracMark: {
-                if (isdigit(c)) { buffer += static_cast<char>(c); s = State::NumberFrac; break; }
-                
-                std::string msg = "Expected digit after '.', instead got '" + c + '\'';
-                throw LexerError(i, msg);
-            }
-            case State::NumberFrac: {
-                if (isdigit(c)) { buffer += static_cast<char>(c); break; }
-                
-                //Number num{ std::stoll(buffer), false };
-                Number num;
-                num.value = std::stod(buffer);
-                num.isInt = false;
-                commit(TokenType::Number, buffer, startPos, num);
-                s = State::Start;
-                --i;
-                break;
-            }
-            case State::NumberExpMark: {
-                if (isdigit(c)) { buffer += static_cast<char>(c); s = State::NumberExp; break; }
-                if (c == '-') { buffer += '-'; s = State::NumberExpSign; break; }
-                
-                std::string msg = "Expected digit or sign after 'E', instead got '" + c + '\'';
-                throw LexerError(i, msg);
-            }
-            case State::NumberExpSign: {
-                if (isdigit(c)) { buffer += static_cast<char>(c); s = State::NumberExp; break; }
-                
-                std::string msg = "Expected digit after \"E(sign)\", instead got '" + c + '\'';
-                throw LexerError(i, msg);
-            }
-            case State::NumberExp: {
-                if (isdigit(c)) { buffer += static_cast<char>(c); break; }
-                
-                Number num{ std::stod(buffer), false };
-                commit(TokenType::Number, buffer, startPos, num);
-                s = State::Start;
-                --i;
-                break;
-            }
-            case State::Identifier: {
-                if (isalnum(c)) { buffer += c; break; } 
+        if (lexer.finished()) return;
+    }
 
-                commit(TokenType::Identifier, buffer, startPos);
-                s = State::Start;
-                --i;
-                break;
-            }
-            case State::Command: {
-                if (isalnum(c)) { buffer += c; break; }
+    std::string msg = "Internal lexer error. Reached end of input without sentinel";
+    throw LexerError(UnknownPos, msg);
+}
+
+Result<void> tryTokenize(const std::string& input, std::vector<Token>& tokens, const bool& exactNumbers) {
+    Diagnostics diagnostics;
+    LexerMachine lexer(exactNumbers, &diagnostics);
+    std::optional<Token> token;
+
+    for (size_t i = 0; i <= input.size() && !lexer.finished(); i++) {
+        unsigned char c = (i < input.size()) ? static_cast<unsigned char>(input[i]) : '\0';
 
-                commit(TokenType::Command, buffer, startPos);
-                s = State::Start;
-                --i;
-                break;
+        bool consumed;
+        do {
+            consumed = lexer.feed(c, i, token);
+            if (token) {
+                tokens.push_back(std::move(*token));
+                token.reset();
             }
-        }
+        } while (!consumed);
     }
-    // after the loop, back to the start means it all got handled
-    if (s == State::Start) {
-        return;
+
+    if (!diagnostics.empty()) return std::unexpected(std::move(diagnostics));
+    return {};
+}
+
+std::string_view IstreamSource::next() {
+    if (!_stream) return {};
+    _stream.read(_chunk.data(), _chunk.size());
+    return std::string_view(_chunk.data(), static_cast<size_t>(_stream.gcount()));
+}
+
+std::string_view FileDescriptorSource::next() {
+    while (true) {
+        ssize_t n = ::read(_fd, _chunk.data(), _chunk.size());
+        if (n > 0) return std::string_view(_chunk.data(), static_cast<size_t>(n));
+        if (n == 0) return {};
+        if (errno != EINTR) throw LexerError(UnknownPos, "Failed to read from file descriptor " + std::to_string(_fd));
     }
+}
 
-    std::string msg = "Internal lexer error. Reached end of input without sentinel";
-    throw LexerError(UnknownPos, msg);
+std::string_view MemorySource::next() {
+    size_t n = std::min(_chunkSize, _size - _offset);
+    std::string_view chunk(_data + _offset, n);
+    _offset += n;
+    return chunk;
+}
+
+bool TokenStream::next(Token& out) {
+    if (_lexer.finished()) return false;
+
+    std::optional<Token> token;
+    while (true) {
+        if (_chunkPos == _chunk.size() && !_exhausted) {
+            _chunkOffset += _chunk.size();
+            _chunk = _source.next();
+            _chunkPos = 0;
+            if (_chunk.empty()) _exhausted = true;
+        }
+
+        // same '\0' sentinel as Tokenize once the source runs dry
+        unsigned char c = _exhausted ? '\0' : static_cast<unsigned char>(_chunk[_chunkPos]);
+        if (_lexer.feed(c, _chunkOffset + _chunkPos, token) && !_exhausted) _chunkPos++;
 
-    return;
-}
\ No newline at end of file
+        if (token) {
+            out = std::move(*token);
+            return true;
+        }
+    }
+}
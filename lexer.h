@@ -32,6 +32,23 @@ that can't be in that token type is seen.
 The parser can now work with a stream of useful info,
 instead of having to sift through an ambiguous string
 of characters to extract meaning.
+
+Number literals are turned into exact rationals right
+here in the lexer. "3.14" is just the digits 314 times
+10^-2, so it becomes 314/100 = 157/50 without ever going
+through a double. Only literals that don't fit in an i64
+(or when exactNumbers is turned off) get parsed as doubles.
+
+The state machine itself lives in LexerMachine, which
+is fed one character at a time and remembers its state
+between calls. Tokenize just feeds it a whole string,
+but TokenStream feeds it chunks pulled from a ByteSource
+(an istream, a file descriptor, or an mmap'd region) and
+hands tokens out one at a time. Since the half-built
+lexeme lives in the machine and not in the chunk, a
+token like "3.14" split across two chunks as "3." and
+"14" comes out the same as if it was never split, and
+lexing a huge file only ever holds one chunk + one token.
 */
 
 #ifndef LEXER_H
@@ -40,6 +57,9 @@ of characters to extract meaning.
 #include "lookupstuff.h"
 #include "Error.h"
 
+#include <string_view>
+#include <iosfwd>
+
 enum class TokenType {
     Number,
     Identifier,
@@ -67,6 +87,115 @@ struct Token {
     bool isInt() const { return number.has_value() && number->isInt; }
 };
 
-void Tokenize(const std::string& input, std::vector<Token>& tokens);
+enum class LexerState {
+    Start,
+    Number,
+    NumberFracMark,
+    NumberFrac,
+    NumberExpMark,
+    NumberExpSign,
+    NumberExp,
+    Identifier,
+    Command
+};
+
+class LexerMachine {
+    public:
+        // with diagnostics set, errors are recorded there and the bad character is skipped instead of thrown
+        explicit LexerMachine(const bool& exactNumbers = true, Diagnostics* diagnostics = nullptr)
+            : _exactNumbers(exactNumbers), _diagnostics(diagnostics) {}
+
+        // feeds the character at absolute offset pos, '\0' marks the end of input
+        // out gets at most one finished token, returns false if c has to be fed again
+        bool feed(const unsigned char& c, const size_t& pos, std::optional<Token>& out);
+
+        // true once the End token has been produced
+        bool finished() const { return _finished; }
+
+        void reset();
+
+    private:
+        LexerState _state = LexerState::Start;
+        std::string _buffer;    // stored lexeme
+        size_t _startPos = 0;   // start of token in original input
+        bool _exactNumbers = true;
+        bool _finished = false;
+        Diagnostics* _diagnostics = nullptr;
+
+        // begin a new token
+        void begin(const LexerState& next, const size_t& pos);
+        void commit(const TokenType& type, std::string lexeme, const size_t& pos, std::optional<Token>& out) const;
+        void commitNumber(std::optional<Token>& out);
+        // throws, or records the error and drops the token in progress
+        void fail(const size_t& pos, const std::string& message);
+};
+
+void Tokenize(const std::string& input, std::vector<Token>& tokens, const bool& exactNumbers = true);
+
+// non-throwing Tokenize, collects every bad character instead of stopping at the first
+// tokens still gets everything that did lex, so the parser can look for more errors
+Result<void> tryTokenize(const std::string& input, std::vector<Token>& tokens, const bool& exactNumbers = true);
+
+// chunked input for TokenStream, each chunk stays valid until the next call
+class ByteSource {
+    public:
+        virtual ~ByteSource() = default;
+        // returns the next chunk of input, empty once the input is exhausted
+        virtual std::string_view next() = 0;
+};
+
+class IstreamSource : public ByteSource {
+    public:
+        explicit IstreamSource(std::istream& stream, const size_t& chunkSize = 1 << 16)
+            : _stream(stream), _chunk(chunkSize) {}
+        std::string_view next() override;
+
+    private:
+        std::istream& _stream;
+        std::vector<char> _chunk;
+};
+
+class FileDescriptorSource : public ByteSource {
+    public:
+        explicit FileDescriptorSource(const int& fd, const size_t& chunkSize = 1 << 16)
+            : _fd(fd), _chunk(chunkSize) {}
+        std::string_view next() override;
+
+    private:
+        int _fd;
+        std::vector<char> _chunk;
+};
+
+// already-mapped memory (an mmap'd file, a big string), handed out without copying
+class MemorySource : public ByteSource {
+    public:
+        MemorySource(const char* data, const size_t& size, const size_t& chunkSize = 1 << 20)
+            : _data(data), _size(size), _chunkSize(chunkSize) {}
+        std::string_view next() override;
+
+    private:
+        const char* _data;
+        size_t _size;
+        size_t _chunkSize;
+        size_t _offset = 0;
+};
+
+// pull-based tokenizer over a ByteSource, same tokens as Tokenize
+class TokenStream {
+    public:
+        explicit TokenStream(ByteSource& source, const bool& exactNumbers = true)
+            : _source(source), _lexer(exactNumbers) {}
+
+        // writes the next token into out, returns false after the End token
+        bool next(Token& out);
+
+    private:
+        ByteSource& _source;
+        LexerMachine _lexer;
+        std::string_view _chunk;
+        size_t _chunkPos = 0;       // next unread char in _chunk
+        size_t _chunkOffset = 0;    // absolute offset of _chunk in the input
+        bool _exhausted = false;
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,563 @@
+/*
+Compile-Time Expression Literals
+
+Formulas that are baked into the program don't need to be
+lexed and parsed every time it starts. With
+
+    constexpr auto quadratic = "\frac{x^2+1}{2}"_expr;
+
+the compiler does the lexing and parsing, and what ends up in
+the binary is just a table of nodes:
+
+    nodes: [ x, 2, x^2, 1, x^2+1, 2, (x^2+1)/2 ]
+                                      ^ root
+
+Every node only points at nodes before it (children get made
+before their parents), so loading the table into an AST is one
+pass that appends each node and offsets its child indices by
+wherever the arena was:
+
+    AST ast;
+    ast.root = quadratic.load(ast);
+
+A malformed literal can't produce a table, so it doesn't compile.
+The error shows up as a throw that isn't a constant expression,
+and the message is in the note saying where it came from:
+
+    "x + "_expr  ->  in 'constexpr' expansion of 'literal_detail::fail("Unexpected token")'
+
+The lexer and parser here are small constexpr copies of the
+runtime ones, since those build Tokens with std::string lexemes
+and std::optional<Number>s. They follow the same state machine
+and the same grammar, and the binding powers and command names
+come from the same tables in parser.h, so the two can't drift
+apart on precedence. The differences:
+    - every number has to be exact (no double fallback), so
+      something like 1e400 is a compile error instead of a real
+    - the parser recurses, compilers cap constexpr recursion at
+      a few hundred levels, which is plenty for a literal
+*/
+
+#ifndef LITERAL_H
+#define LITERAL_H
+
+#include "AST.h"
+#include "parser.h"
+
+#include <array>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+template <size_t N>
+struct FixedString {
+    char data[N] = {};
+
+    constexpr FixedString(const char (&s)[N]) {
+        for (size_t i = 0; i < N; i++) data[i] = s[i];
+    }
+
+    // without the '\0'
+    constexpr std::string_view view() const { return { data, N - 1 }; }
+};
+
+enum class StaticNodeKind : u8 {
+    Constant,
+    Rational,
+    Identifier,
+    BinaryOp,
+    UnaryOp,
+    Call
+};
+
+// one AST node, with children as indices into the same table
+struct StaticNode {
+    StaticNodeKind kind;
+    u8 subKind = 0;     // the ConstantKind, BinaryOpKind, UnaryOpKind or FunctionKind
+    i64 a = 0;          // Rational: numerator, Identifier: offset of the name in the source
+    i64 b = 0;          // Rational: denominator, Identifier: length of the name
+    u32 left = 0;       // BinaryOp: left, UnaryOp: inner, Call: first index in args
+    u32 right = 0;      // BinaryOp: right, Call: arg count
+    u32 pos = 0;        // offset in the literal
+};
+
+template <size_t N, size_t NodeCount, size_t ArgCount>
+struct StaticExpr {
+    FixedString<N> source;
+    std::array<StaticNode, NodeCount> nodes;
+    std::array<u32, ArgCount> args;     // node indices of every call's arguments
+    u32 root;
+
+    // appends every node to ast and returns the root, doesn't set ast.root
+    NodeID load(AST& ast) const {
+        size_t base = ast.arena.size();
+        ast.reserve(base + NodeCount);
+
+        for (const StaticNode& n : nodes) {
+            switch (n.kind) {
+                case StaticNodeKind::Constant:
+                    ast.addConstant(static_cast<ConstantKind>(n.subKind), n.pos);
+                    break;
+                case StaticNodeKind::Rational:
+                    ast.addRational(n.a, n.b, n.pos);
+                    break;
+                case StaticNodeKind::Identifier:
+                    ast.addIdentifier(std::string(source.view().substr(n.a, n.b)), n.pos);
+                    break;
+                case StaticNodeKind::BinaryOp:
+                    ast.addBinaryOp(static_cast<BinaryOpKind>(n.subKind), NodeID{ base + n.left }, NodeID{ base + n.right }, n.pos);
+                    break;
+                case StaticNodeKind::UnaryOp:
+                    ast.addUnaryOp(static_cast<UnaryOpKind>(n.subKind), NodeID{ base + n.left }, n.pos);
+                    break;
+                case StaticNodeKind::Call: {
+                    std::vector<NodeID> callArgs;
+                    callArgs.reserve(n.right);
+                    for (u32 i = 0; i < n.right; i++) callArgs.push_back(NodeID{ base + args[n.left + i] });
+                    ast.addCall(static_cast<FunctionKind>(n.subKind), callArgs, n.pos);
+                    break;
+                }
+            }
+        }
+        return NodeID{ base + root };
+    }
+};
+
+namespace literal_detail {
+    // not a constant expression, so reaching this during a literal is a compile error
+    // (the check is only there so the function has a path that is constant)
+    constexpr void fail(const char* message) {
+        if (message) throw message;
+    }
+
+    constexpr bool isDigit(const char& c) { return c >= '0' && c <= '9'; }
+    constexpr bool isAlnum(const char& c) { return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    constexpr bool isSpace(const char& c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+
+    constexpr i64 gcd(i64 a, i64 b) {
+        if (a < 0) a = -a;
+        if (b < 0) b = -b;
+        while (b != 0) {
+            i64 t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    struct LiteralToken {
+        TokenType type;
+        u32 pos;
+        u32 length;     // of the lexeme, without the '\' for commands
+        i64 numerator = 0;
+        i64 denominator = 1;
+    };
+
+    // same idea as exactDecimal() in lexer.cpp, but anything that doesn't fit is an error
+    constexpr void exactNumber(std::string_view text, LiteralToken& t) {
+        constexpr i64 MAX = 0x7fffffffffffffffLL;
+        i64 mantissa = 0;
+        i64 scale = 0;
+        i64 pendingZeros = 0;
+        bool inFraction = false;
+
+        size_t i = 0;
+        for (; i < text.size() && text[i] != 'e' && text[i] != 'E'; i++) {
+            if (text[i] == '.') { inFraction = true; continue; }
+            i64 digit = text[i] - '0';
+            if (inFraction) scale--;
+            if (digit == 0) { pendingZeros++; continue; }
+            for (; pendingZeros > 0; pendingZeros--) {
+                if (mantissa > MAX / 10) fail("Number literal doesn't fit in an exact rational");
+                mantissa *= 10;
+            }
+            if (mantissa > (MAX - digit) / 10) fail("Number literal doesn't fit in an exact rational");
+            mantissa = mantissa * 10 + digit;
+        }
+        scale += pendingZeros;
+
+        if (i < text.size()) {
+            i++; // skip 'e'
+            bool negative = false;
+            if (text[i] == '+' || text[i] == '-') negative = text[i++] == '-';
+            i64 exponent = 0;
+            for (; i < text.size(); i++) {
+                exponent = exponent * 10 + (text[i] - '0');
+                if (exponent > 18 + 19) fail("Number literal exponent is too big for an exact rational");
+            }
+            scale += negative ? -exponent : exponent;
+        }
+
+        if (mantissa == 0) {
+            t.numerator = 0;
+            t.denominator = 1;
+            return;
+        }
+
+        i64 power = 1;
+        for (i64 k = 0; k < (scale < 0 ? -scale : scale); k++) {
+            if (power > MAX / 10) fail("Number literal doesn't fit in an exact rational");
+            power *= 10;
+        }
+
+        if (scale >= 0) {
+            if (mantissa > MAX / power) fail("Number literal doesn't fit in an exact rational");
+            t.numerator = mantissa * power;
+            t.denominator = 1;
+            return;
+        }
+        i64 commonDivisor = gcd(mantissa, power);
+        t.numerator = mantissa / commonDivisor;
+        t.denominator = power / commonDivisor;
+    }
+
+    // the LexerMachine states, run straight over the literal
+    constexpr std::vector<LiteralToken> lex(std::string_view input) {
+        std::vector<LiteralToken> tokens;
+        size_t i = 0;
+
+        while (true) {
+            while (i < input.size() && isSpace(input[i])) i++;
+            if (i >= input.size()) {
+                tokens.push_back({ TokenType::End, (u32)i, 0 });
+                return tokens;
+            }
+
+            char c = input[i];
+            size_t start = i;
+
+            if (isDigit(c) || c == '.') {
+                // Number -> NumberFracMark -> NumberFrac -> NumberExpMark -> NumberExpSign -> NumberExp
+                while (i < input.size() && isDigit(input[i])) i++;
+                if (i < input.size() && input[i] == '.') {
+                    i++;
+                    if (i >= input.size() || !isDigit(input[i])) fail("Expected digit after '.'");
+                    while (i < input.size() && isDigit(input[i])) i++;
+                }
+                if (i < input.size() && (input[i] == 'e' || input[i] == 'E')) {
+                    i++;
+                    if (i < input.size() && (input[i] == '+' || input[i] == '-')) {
+                        i++;
+                        if (i >= input.size() || !isDigit(input[i])) fail("Expected digit after \"E(sign)\"");
+                    } else if (i >= input.size() || !isDigit(input[i])) {
+                        fail("Expected digit or sign after 'E'");
+                    }
+                    while (i < input.size() && isDigit(input[i])) i++;
+                }
+                LiteralToken t{ TokenType::Number, (u32)start, (u32)(i - start) };
+                exactNumber(input.substr(start, i - start), t);
+                tokens.push_back(t);
+                continue;
+            }
+
+            if (c == '\\') {
+                i++;
+                while (i < input.size() && isAlnum(input[i])) i++;
+                tokens.push_back({ TokenType::Command, (u32)start, (u32)(i - start - 1) });
+                continue;
+            }
+
+            if (isAlnum(c)) {
+                while (i < input.size() && isAlnum(input[i])) i++;
+                tokens.push_back({ TokenType::Identifier, (u32)start, (u32)(i - start) });
+                continue;
+            }
+
+            TokenType type = TokenType::End;
+            switch (c) {
+                case '{': type = TokenType::LBrace; break;
+                case '}': type = TokenType::RBrace; break;
+                case '(': type = TokenType::LParenthesis; break;
+                case ')': type = TokenType::RParenthesis; break;
+                case '[': type = TokenType::LBracket; break;
+                case ']': type = TokenType::RBracket; break;
+                case ',': type = TokenType::Comma; break;
+                case '+': type = TokenType::Plus; break;
+                case '-': type = TokenType::Minus; break;
+                case '*': type = TokenType::Star; break;
+                case '/': type = TokenType::Slash; break;
+                case '^': type = TokenType::Caret; break;
+                case '_': type = TokenType::Underscore; break;
+                case '=': type = TokenType::Equals; break;
+                default: fail("Unexpected character");
+            }
+            tokens.push_back({ type, (u32)start, 1 });
+            i++;
+        }
+    }
+
+    // finds key in one of the parser.h tables
+    template <class K, class V, size_t M>
+    constexpr const V* find(const TableEntry<K, V> (&table)[M], const K& key) {
+        for (const TableEntry<K, V>& e : table) {
+            if (e.key == key) return &e.value;
+        }
+        return nullptr;
+    }
+
+    struct LiteralParser {
+        std::string_view input;
+        std::vector<LiteralToken> tokens;
+        std::vector<StaticNode> nodes;
+        std::vector<u32> args;
+        size_t pos = 0;
+        u32 root = 0;
+
+        constexpr const LiteralToken& peek() const { return tokens[pos]; }
+        constexpr const LiteralToken& advance() {
+            const LiteralToken& t = tokens[pos];
+            if (t.type != TokenType::End) pos++;
+            return t;
+        }
+        constexpr const LiteralToken& expect(const TokenType& type) {
+            if (peek().type != type) fail("Unexpected token");
+            return advance();
+        }
+        constexpr std::string_view lexeme(const LiteralToken& t) const {
+            return input.substr(t.pos + (t.type == TokenType::Command ? 1 : 0), t.length);
+        }
+        constexpr bool isCommand(const std::string_view& name) const {
+            return peek().type == TokenType::Command && lexeme(peek()) == name;
+        }
+
+        constexpr u32 add(const StaticNode& n) {
+            nodes.push_back(n);
+            return (u32)(nodes.size() - 1);
+        }
+        constexpr u32 addRational(i64 numerator, i64 denominator, const size_t& p) {
+            // same reduction AST::addRational does
+            i64 commonDivisor = gcd(numerator, denominator);
+            return add({ StaticNodeKind::Rational, 0, numerator / commonDivisor, denominator / commonDivisor, 0, 0, (u32)p });
+        }
+        constexpr u32 addBinary(const BinaryOpKind& bKind, const u32& left, const u32& right, const size_t& p) {
+            return add({ StaticNodeKind::BinaryOp, (u8)bKind, 0, 0, left, right, (u32)p });
+        }
+        constexpr u32 addCall(const FunctionKind& fKind, const std::vector<u32>& callArgs, const size_t& p) {
+            u32 first = (u32)args.size();
+            for (const u32& a : callArgs) args.push_back(a);
+            return add({ StaticNodeKind::Call, (u8)fKind, 0, 0, first, (u32)callArgs.size(), (u32)p });
+        }
+
+        constexpr bool canImplicitMultiply() const {
+            const LiteralToken& t = peek();
+            switch (t.type) {
+                case TokenType::Number:
+                case TokenType::Identifier:
+                case TokenType::LParenthesis:
+                case TokenType::LBrace:
+                    return true;
+                case TokenType::Command:
+                    for (const std::string_view& name : PREFIX_COMMAND_TABLE) {
+                        if (name == lexeme(t)) return true;
+                    }
+                    return false;
+                default:
+                    return false;
+            }
+        }
+
+        constexpr void parseRoot() {
+            root = parseExpression(0);
+            if (peek().type != TokenType::End) fail("Expression doesn't reach the end of the literal");
+        }
+
+        constexpr u32 parseExpression(const u8& minBP) {
+            u32 left = parsePrefix();
+
+            while (true) {
+                const LiteralToken& t = peek();
+
+                if (const InfixInfo* info = find(INFIX_OP_TABLE, t.type)) {
+                    if (info->leftBP < minBP) break;
+                    size_t p = advance().pos;
+                    u32 right = parseExpression(info->rightBP);
+                    left = addBinary(info->opKind, left, right, p);
+                    continue;
+                }
+
+                if (t.type == TokenType::Command) {
+                    if (const InfixInfo* info = find(INFIX_COMMAND_TABLE, lexeme(t))) {
+                        if (info->leftBP < minBP) break;
+                        size_t p = advance().pos;
+                        u32 right = parseExpression(info->rightBP);
+                        left = addBinary(info->opKind, left, right, p);
+                        continue;
+                    }
+                }
+
+                if (canImplicitMultiply()) {
+                    if (IMPLICIT_MULTIPLY.leftBP < minBP) break;
+                    size_t p = peek().pos;
+                    u32 right = parseExpression(IMPLICIT_MULTIPLY.rightBP);
+                    left = addBinary(IMPLICIT_MULTIPLY.opKind, left, right, p);
+                    continue;
+                }
+
+                break;
+            }
+            return left;
+        }
+
+        constexpr u32 parseGroup(const TokenType& open, const TokenType& close) {
+            expect(open);
+            u32 inner = parseExpression(0);
+            expect(close);
+            return inner;
+        }
+
+        constexpr std::vector<u32> parseArgList() {
+            std::vector<u32> callArgs;
+            expect(TokenType::LParenthesis);
+            callArgs.push_back(parseExpression(0));
+            while (peek().type == TokenType::Comma) {
+                advance();
+                callArgs.push_back(parseExpression(0));
+            }
+            expect(TokenType::RParenthesis);
+            return callArgs;
+        }
+
+        constexpr u32 parsePrefix() {
+            const LiteralToken& t = peek();
+
+            switch (t.type) {
+                case TokenType::Number: {
+                    advance();
+                    return addRational(t.numerator, t.denominator, t.pos);
+                }
+                case TokenType::Identifier: {
+                    advance();
+                    return add({ StaticNodeKind::Identifier, 0, t.pos, t.length, 0, 0, t.pos });
+                }
+                case TokenType::Minus: {
+                    size_t p = advance().pos;
+                    u32 inner = parseExpression(PREFIX_UNARY_RBP);
+                    return add({ StaticNodeKind::UnaryOp, (u8)UnaryOpKind::Negate, 0, 0, inner, 0, (u32)p });
+                }
+                case TokenType::LParenthesis: return parseGroup(TokenType::LParenthesis, TokenType::RParenthesis);
+                case TokenType::LBrace: return parseGroup(TokenType::LBrace, TokenType::RBrace);
+                case TokenType::Command: return parseCommand();
+                default: fail("Unexpected token");
+            }
+            return 0;
+        }
+
+        constexpr u32 parseCommand() {
+            const LiteralToken& t = advance();
+            std::string_view cmd = lexeme(t);
+            size_t p = t.pos;
+
+            if (const ConstantKind* c = find(CONSTANT_TABLE, cmd)) {
+                return add({ StaticNodeKind::Constant, (u8)*c, 0, 0, 0, 0, (u32)p });
+            }
+
+            if (const FunctionKind* f = find(FUNCTION_KIND_TABLE, cmd)) {
+                u32 arg;
+                if (peek().type == TokenType::LBrace) arg = parseGroup(TokenType::LBrace, TokenType::RBrace);
+                else if (peek().type == TokenType::LParenthesis) arg = parseGroup(TokenType::LParenthesis, TokenType::RParenthesis);
+                else arg = parseExpression(PREFIX_UNARY_RBP);
+                return addCall(*f, { arg }, p);
+            }
+
+            if (const FunctionKind* f = find(MULTI_ARG_FUNCTION_TABLE, cmd)) {
+                return addCall(*f, parseArgList(), p);
+            }
+
+            if (cmd == "operatorname") {
+                expect(TokenType::LBrace);
+                const FunctionKind* f = find(MULTI_ARG_FUNCTION_TABLE, lexeme(expect(TokenType::Identifier)));
+                expect(TokenType::RBrace);
+                if (!f) fail("Unknown operatorname");
+                return addCall(*f, parseArgList(), p);
+            }
+
+            if (cmd == "frac") {
+                // fast path, \frac{n}{d} of plain numbers folds into one rational
+                size_t saved = pos;
+                i64 n, nd, d, dd;
+                i64 top = 0, bottom = 0;
+                // falls back to a Divide if the product doesn't fit in an i64
+                if (signedNumberGroup(n, nd) && signedNumberGroup(d, dd) && d != 0
+                    && !__builtin_mul_overflow(dd, n, &top) && !__builtin_mul_overflow(nd, d, &bottom)
+                    && top != std::numeric_limits<i64>::min() && bottom != std::numeric_limits<i64>::min()) {
+                    if (bottom < 0) {
+                        top = -top;
+                        bottom = -bottom;
+                    }
+                    return addRational(top, bottom, p);
+                }
+                pos = saved;
+
+                u32 numerator = parseGroup(TokenType::LBrace, TokenType::RBrace);
+                u32 denominator = parseGroup(TokenType::LBrace, TokenType::RBrace);
+                return addBinary(BinaryOpKind::Divide, numerator, denominator, p);
+            }
+
+            if (cmd == "sqrt") {
+                // sqrt(x) = x^(1/2)
+                u32 inner = parseGroup(TokenType::LBrace, TokenType::RBrace);
+                u32 half = addRational(1, 2, p);
+                return addBinary(BinaryOpKind::Power, inner, half, p);
+            }
+
+            if (cmd == "left") {
+                expect(TokenType::LParenthesis);
+                u32 inner = parseExpression(0);
+                if (!isCommand("right")) fail("Expected \"right\"");
+                advance();
+                expect(TokenType::RParenthesis);
+                return inner;
+            }
+
+            fail("Unknown command");
+            return 0;
+        }
+
+        // "{number}" or "{-number}", leaves pos wherever it stopped if it isn't one
+        constexpr bool signedNumberGroup(i64& numerator, i64& denominator) {
+            if (peek().type != TokenType::LBrace) return false;
+            advance();
+            bool negative = peek().type == TokenType::Minus;
+            if (negative) advance();
+            if (peek().type != TokenType::Number) return false;
+            const LiteralToken& t = advance();
+            if (peek().type != TokenType::RBrace) return false;
+            advance();
+            numerator = negative ? -t.numerator : t.numerator;
+            denominator = t.denominator;
+            return true;
+        }
+    };
+
+    constexpr LiteralParser parse(std::string_view input) {
+        LiteralParser parser{ input, lex(input), {}, {}, 0, 0 };
+        parser.parseRoot();
+        return parser;
+    }
+
+    struct Sizes {
+        size_t nodes;
+        size_t args;
+    };
+
+    constexpr Sizes measure(std::string_view input) {
+        LiteralParser parser = parse(input);
+        return { parser.nodes.size(), parser.args.size() };
+    }
+}
+
+// "x^2 + 1"_expr, see the top of the file
+template <FixedString S>
+consteval auto operator""_expr() {
+    constexpr literal_detail::Sizes sizes = literal_detail::measure(S.view());
+
+    // parsed a second time, the vectors can't leave constant evaluation
+    literal_detail::LiteralParser parser = literal_detail::parse(S.view());
+    StaticExpr<sizeof(S.data), sizes.nodes, sizes.args> out{ S, {}, {}, 0 };
+    for (size_t i = 0; i < sizes.nodes; i++) out.nodes[i] = parser.nodes[i];
+    for (size_t i = 0; i < sizes.args; i++) out.args[i] = parser.args[i];
+    out.root = parser.root;
+    return out;
+}
+
+#endif
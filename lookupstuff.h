@@ -6,6 +6,8 @@
 #include <optional>
 #include <stdint.h>
 #include <variant>
+#include <cmath>
+#include <algorithm>
 
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -22,6 +24,11 @@ static constexpr size_t UnknownPos = (size_t)-1;
 struct Number {
     std::variant<double, i64> value;
     bool isInt = false;
+
+    // exact value of the literal as numerator / denominator, only valid if isExact
+    i64 numerator = 0;
+    i64 denominator = 1;
+    bool isExact = false;
 };
 
 // the supported latex commands that follow a '\'
@@ -47,55 +54,89 @@ enum class SupportedCommands {
     operatorname    // custom ops
 };
 
-// stern brocot search for a fraction approx of a double
+/*
+best rational approximation of a double using continued fractions
+
+The old version walked the Stern-Brocot tree one mediant at
+a time, which is a LOT of steps for stuff like 0.00001 or
+2.9999. The mediants it visits are exactly the semiconvergents
+of the continued fraction of the input though, so we can jump
+straight from one convergent to the next:
+
+    x = a0 + 1/(a1 + 1/(a2 + ...))
+    h(n) = a(n) * h(n-1) + h(n-2)
+    k(n) = a(n) * k(n-1) + k(n-2)
+
+Between two convergents, the semiconvergents
+(h(n-2) + t * h(n-1)) / (k(n-2) + t * k(n-1)) for t = 1..a(n)
+creep monotonically toward x, so a binary search over t finds
+the smallest denominator within maxError. That's the same
+answer the tree walk gave, in O(log maxDenominator) steps.
+*/
 inline bool doubleToRational(const double& input, i64& outNumerator, i64& outDenominator) {
-    // easier for sign stuff
-    double value = input;
-    
-    bool canRationalize = false;
-    bool isNegative = false;
-
     const double maxError = 1e-10;
-    const u32 maxDenominator = 100000;
+    const i64 maxDenominator = 100000;
 
-    if (value < 0) {
-        isNegative = true;
-        value = -value;
-    }
-
-    i64 wholePart = (i64)value;
-    double fractionalPart = (double)(value - wholePart);
+    // whole part has to fit in an i64 with room to spare
+    if (!std::isfinite(input) || std::abs(input) > 9e15) return false;
 
-    i64 numL = 0;   i64 numR = 1;
-    i64 denL = 1;   i64 denR = 1;
+    // easier for sign stuff
+    bool isNegative = input < 0;
+    double value = std::abs(input);
+
+    // h(n-2)/k(n-2) and h(n-1)/k(n-1), seeded with 0/1 and 1/0
+    i64 numPrev = 0;    i64 denPrev = 1;
+    i64 numCur = 1;     i64 denCur = 0;
+
+    auto error = [&](i64 t) {
+        return std::abs(value - (double)(numPrev + t * numCur) / (double)(denPrev + t * denCur));
+    };
+
+    double remainder = value;
+    for (u8 term = 0; term < 64; term++) {
+        double wholeTerm = std::floor(remainder);
+        i64 a = (i64)wholeTerm;
+
+        // largest t that keeps the denominator in bounds
+        i64 tMax = a;
+        if (denCur > 0) tMax = std::min(a, (maxDenominator - denPrev) / denCur);
+
+        // semiconvergents get closer as t grows, so find the first one that's close enough
+        if (tMax >= 1 && error(tMax) <= maxError) {
+            i64 lo = 1;
+            i64 hi = tMax;
+            while (lo < hi) {
+                i64 mid = lo + (hi - lo) / 2;
+                if (error(mid) <= maxError) hi = mid;
+                else lo = mid + 1;
+            }
+            outNumerator = numPrev + lo * numCur;
+            outDenominator = denPrev + lo * denCur;
+            if (isNegative) outNumerator = -outNumerator;
+            return true;
+        }
 
-    while (denL + denR <= maxDenominator) {
+        // the next convergent's denominator would be too big
+        if (tMax < a) return false;
 
-        // calculate the mediant as fraction and double
-        i64 numMediant = numL + numR;
-        i64 denMediant = denL + denR;
-        double mediant = (double)numMediant / (double)denMediant;
+        i64 numNext = numPrev + a * numCur;
+        i64 denNext = denPrev + a * denCur;
+        numPrev = numCur;   denPrev = denCur;
+        numCur = numNext;   denCur = denNext;
 
-        // determine if the mediant is close enough to the input
-        if (std::abs(fractionalPart - mediant) <= maxError) {
-            outDenominator = denMediant;
-            outNumerator = numMediant + wholePart * outDenominator;
-            if (isNegative) outNumerator = -outNumerator;
-            canRationalize = true;
-            break;
+        // only reachable for a0 = 0, the convergent 0/1 itself
+        if (std::abs(value - (double)numCur / (double)denCur) <= maxError) {
+            outNumerator = isNegative ? -numCur : numCur;
+            outDenominator = denCur;
+            return true;
         }
 
-        // set bounds based on mediant
-        if (mediant < fractionalPart) {
-            numL = numMediant;
-            denL = denMediant;
-        } else if (mediant > fractionalPart) {
-            numR = numMediant;
-            denR = denMediant;
-        }
+        double fractionalPart = remainder - wholeTerm;
+        if (fractionalPart <= 0.0) return false;
+        remainder = 1.0 / fractionalPart;
     }
-    
-    return canRationalize;
+
+    return false;
 }
 
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "lexer.h"
 #include "parser.h"
 #include "transformer.h"
+#include "evaluator.h"
+#include "cse.h"
 #include <iostream>
 
 bool getInputString(std::string& input) {
@@ -11,6 +13,19 @@ bool getInputString(std::string& input) {
     return true;
 }
 
+void printErrors(const Diagnostics& errors) {
+    for (const Diagnostic& e : errors) {
+        switch (e.stage) {
+            case ErrorStage::Lexer: std::cerr << "Tokenize error"; break;
+            case ErrorStage::Parser: std::cerr << "Parser error"; break;
+            case ErrorStage::Transformer: std::cerr << "Transformer error"; break;
+            case ErrorStage::Evaluator: std::cerr << "Evaluator error"; break;
+        }
+        if (e.pos != UnknownPos) std::cerr << " at position " << e.pos;
+        std::cerr << ": " << e.message << "\n";
+    }
+}
+
 int main(void) {
     std::cout << "Math Compiler v0.1.0 by Adam Punch\n\n";
     
@@ -19,15 +34,11 @@ int main(void) {
         AST ast;
         Parser p;
         std::vector<Token> tokens;
-        
-        try {
-            Tokenize(input, tokens);
-        } catch (LexerError& e) {
-            std::cerr << "Tokenize error at position " << e.pos << ": " << e.what() << "\n";
-            continue;
-        } catch (std::exception& e) {
-            std::cerr << "Unexpected error " << e.what() << "\n";
-            continue;
+        Diagnostics errors;
+
+        // keep parsing after lexer errors to report as much as possible in one go
+        if (auto lexed = tryTokenize(input, tokens); !lexed) {
+            errors = std::move(lexed.error());
         }
 
         std::cout << "\nTokens:\n[ ";
@@ -38,30 +49,33 @@ int main(void) {
         }
         std::cout << "]\n";
 
-        try {
-            p.parse(tokens, ast);
-        } catch (ParserError& e) {
-            std::cerr << "Parser error at position " << e.pos << ": " << e.what() << "\n";
-            continue;
-        } catch (std::exception& e) {
-            std::cerr << "Unexpected error: " << e.what() << "\n";
+        if (auto parsed = p.tryParse(tokens, ast); !parsed) {
+            errors.insert(errors.end(), parsed.error().begin(), parsed.error().end());
+        }
+
+        if (!errors.empty()) {
+            printErrors(errors);
             continue;
         }
 
         std::cout << "Parsed AST:\n" << ast.toString() << "\n";
 
         AST transformed;
-        try {
-            transform(ast, transformed);
-        } catch (TransformerError& e) {
-            std::cerr << "Transformer error: " << e.what() << "\n";
-            continue;
-        } catch (std::exception& e) {
-            std::cerr << "Unexpected error: " << e.what() << "\n";
+        if (auto result = tryTransform(ast, transformed); !result) {
+            printErrors(result.error());
             continue;
         }
 
         std::cout << "Transformed AST:\n" << transformed.toString() << "\n";
+
+        // repeated subterms only get worked out once
+        AST shared;
+        eliminateCommonSubexpressions(transformed, transformed.root, shared);
+
+        // only has a value if there's nothing left to bind
+        if (auto value = tryEvaluate(shared, shared.root)) {
+            std::cout << "Value: " << *value << "\n";
+        }
     }
 
     return 0;
@@ -6,6 +6,7 @@
 #include <set>
 #include <algorithm>
 #include <map>
+#include <bit>
 
 #pragma region IS_TYPE_METHODS
 inline bool isConstant(const AST& ast, const NodeID& id) {
@@ -430,6 +431,80 @@ inline bool structurallyEqual(const AST& ast, const NodeID& idA, const NodeID& i
     return structurallyEqual(ast, idA, ast, idB);
 }
 
+// folds v into seed, order matters so a - b and b - a hash differently
+inline u64 hashCombine(const u64& seed, const u64& v) {
+    u64 x = seed ^ (v + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 29;
+    return x;
+}
+
+// hashes one node given its children's hashes
+inline u64 nodeHash(const ASTNode& node, const u64* children) {
+    u64 h = hashCombine(0, node.kind.index());
+    return std::visit([&](const auto& n) -> u64 {
+        using T = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<T, ConstantNode>) return hashCombine(h, (u64)n.cKind);
+        if constexpr (std::is_same_v<T, RealNode>) {
+            // 0.0 == -0.0 in structurallyEqual, so they need the same hash
+            double v = n.value == 0.0 ? 0.0 : n.value;
+            return hashCombine(h, std::bit_cast<u64>(v));
+        }
+        if constexpr (std::is_same_v<T, RationalNode>) return hashCombine(hashCombine(h, (u64)n.numerator), (u64)n.denominator);
+        if constexpr (std::is_same_v<T, IdentifierNode>) return hashCombine(h, std::hash<std::string>{}(n.name));
+        if constexpr (std::is_same_v<T, BinaryOpNode>) return hashCombine(hashCombine(hashCombine(h, (u64)n.bKind), children[0]), children[1]);
+        if constexpr (std::is_same_v<T, UnaryOpNode>) return hashCombine(hashCombine(h, (u64)n.uKind), children[0]);
+        if constexpr (std::is_same_v<T, CallNode>) {
+            h = hashCombine(hashCombine(h, (u64)n.fKind), n.args.size());
+            for (size_t i = 0; i < n.args.size(); i++) h = hashCombine(h, children[i]);
+            return h;
+        }
+        return h;
+    }, node.kind);
+}
+
+// fills in the hash and subtree size of every node under id, indexed by NodeID::i
+// equal whenever structurallyEqual is, positions don't count
+// one pass instead of rehashing each subtree from scratch, and a node that already has
+// a size is done, so a DAG's shared nodes are only hashed once (start with both empty)
+inline u64 structuralHashes(const AST& ast, const NodeID& id, std::vector<u64>& hashes, std::vector<u32>& sizes) {
+    if (id.isNone()) return 0;
+    if (hashes.size() < ast.arena.size()) {
+        hashes.resize(ast.arena.size());
+        sizes.resize(ast.arena.size());
+    }
+    if (sizes[id.i] != 0) return hashes[id.i];
+
+    // a DAG can stand for a tree bigger than u32, so it saturates
+    u64 size = 1;
+    std::vector<u64> children;
+    if (auto b = getBinaryOp(ast, id)) {
+        children = { structuralHashes(ast, b->left, hashes, sizes), structuralHashes(ast, b->right, hashes, sizes) };
+        size += (u64)sizes[b->left.i] + sizes[b->right.i];
+    } else if (auto u = getUnaryOp(ast, id)) {
+        children = { structuralHashes(ast, u->inner, hashes, sizes) };
+        size += sizes[u->inner.i];
+    } else if (auto c = getCall(ast, id)) {
+        for (const NodeID& arg : c->args) {
+            children.push_back(structuralHashes(ast, arg, hashes, sizes));
+            size += sizes[arg.i];
+        }
+    }
+
+    hashes[id.i] = nodeHash(ast.at(id), children.data());
+    sizes[id.i] = (u32)(size < 0xFFFFFFFF ? size : 0xFFFFFFFF);
+    return hashes[id.i];
+}
+
+// the hash of id alone, the same as structuralHashes gives it
+inline u64 structuralHash(const AST& ast, const NodeID& id) {
+    std::vector<u64> hashes;
+    std::vector<u32> sizes;
+    return structuralHashes(ast, id, hashes, sizes);
+}
+
 // walks a chain of add nodes and turns all coefficients into a flat vector of terms
 inline void flattenSum(const AST& ast, const NodeID& id, std::vector<NodeID>& terms) {
     if (id.isNone()) return;
@@ -596,7 +671,7 @@ inline std::optional<i64> polynomialDegree(const AST& ast, const NodeID& id, con
 std::optional<std::map<i64, NodeID>> collectPolynomialTerms(const AST& ast, const NodeID& id, const std::string& varName);  
 
 // substitutes all occurrences of varname with valueID in a new ast
-NodeID substituteIdentifier(const AST& input, const NodeID& id, const std::string& varName, const NodeID& valueID, AST& out) {
+inline NodeID substituteIdentifier(const AST& input, const NodeID& id, const std::string& varName, const NodeID& valueID, AST& out) {
     if (id.isNone()) return NodeID::None();
     
     if (!containsIdentifier(input, id, varName)) return cloneSubtree(input, id, out);
@@ -2,124 +2,442 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <bit>
+#include <limits>
 
 void Parser::parse(const std::vector<Token>& tokens, AST& ast) {
+    run(tokens, ast, nullptr);
+}
+
+void Parser::parse(const std::string& input, AST& ast) {
+    run(input, 0, input.size(), ast, nullptr);
+}
+
+Result<NodeID> Parser::tryParse(const std::string& input, AST& ast) {
+    Diagnostics diagnostics;
+    NodeID root = run(input, 0, input.size(), ast, &diagnostics);
+    if (!diagnostics.empty()) return std::unexpected(std::move(diagnostics));
+    return root;
+}
+
+Result<NodeID> Parser::tryParse(const std::string& input, const size_t& first, const size_t& last, AST& ast, LeafTable* leaves) {
+    Diagnostics diagnostics;
+    _leaves = leaves;
+    NodeID root = run(input, first, last, ast, &diagnostics);
+    _leaves = nullptr;
+    if (!diagnostics.empty()) return std::unexpected(std::move(diagnostics));
+    return root;
+}
+
+Result<NodeID> Parser::tryParse(const std::vector<Token>& tokens, AST& ast, std::vector<GroupSpan>* groups) {
+    Diagnostics diagnostics;
+    _groups = groups;
+    NodeID root = run(tokens, ast, &diagnostics);
+    _groups = nullptr;
+    if (!diagnostics.empty()) return std::unexpected(std::move(diagnostics));
+    return root;
+}
+
+Result<NodeID> Parser::tryParseGroup(const std::vector<Token>& tokens, AST& ast, const size_t& open, const size_t& close, std::vector<GroupSpan>* groups) {
+    Diagnostics diagnostics;
+    _tokens = &tokens;
+    _input = nullptr;
+    _ast = &ast;
+    _pos = open + 1;
+    _diagnostics = &diagnostics;
+    _failed = false;
+    _groups = groups;
+    _frames.clear();
+    _argStack.clear();
+
+    bool matched = close < tokens.size() && ((tokens[open].is(TokenType::LParenthesis) && tokens[close].is(TokenType::RParenthesis))
+        || (tokens[open].is(TokenType::LBrace) && tokens[close].is(TokenType::RBrace)));
+
+    NodeID inner = NodeID::None();
+    if (!matched) fail("Group brackets don't match");
+    else inner = parseExpression(0);
+
+    // the body has to stop exactly at the old closing bracket
+    if (!_failed && _pos != close) fail("Group doesn't close where it used to");
+
+    _groups = nullptr;
+    if (!diagnostics.empty()) return std::unexpected(std::move(diagnostics));
+    return inner;
+}
+
+void Parser::recordGroup(const size_t& open, const size_t& close, const NodeID& inner) {
+    if (!_groups) return;
+    if (_failed) return;
+    _groups->push_back({ open, close, inner });
+}
+
+NodeID Parser::run(const std::vector<Token>& tokens, AST& ast, Diagnostics* diagnostics) {
     _tokens = &tokens;
+    _input = nullptr;
+    _ast = &ast;
+    _pos = 0;
+    _diagnostics = diagnostics;
+    _failed = false;
+    _frames.clear();
+    _argStack.clear();
+
+    if (tokens.empty() || !tokens.back().is(TokenType::End)) {
+        fail("Token stream doesn't end with an End token");
+        return NodeID::None();
+    }
+
+    // every token makes at most about one node
+    reserveNodes(tokens.size());
+
+    return parseRoot();
+}
+
+NodeID Parser::run(const std::string& input, const size_t& first, const size_t& last, AST& ast, Diagnostics* diagnostics) {
+    _tokens = nullptr;
+    _input = &input;
+    _inputPos = first;
+    _inputEnd = last;
+    _lexer = LexerMachine(true, diagnostics);
+    _window.clear();
+    _windowBase = 0;
     _ast = &ast;
+    _pos = 0;
+    _diagnostics = diagnostics;
+    _failed = false;
+    _frames.clear();
+    _argStack.clear();
+
+    // there's no token count yet, but formulas come out to about one node per two chars
+    reserveNodes((last - first) / 2 + 8);
+
+    pullToken();
+    return parseRoot();
+}
+
+NodeID Parser::leafIdentifier(const std::string& name, const size_t& pos) {
+    if (!_leaves) return _ast->addIdentifier(name, pos);
+    auto [it, inserted] = _leaves->identifiers.try_emplace(name, NodeID::None());
+    if (inserted) it->second = _ast->addIdentifier(name, pos);
+    return it->second;
+}
+
+NodeID Parser::leafRational(const i64& numerator, const i64& denominator, const size_t& pos) {
+    if (!_leaves) return _ast->addRational(numerator, denominator, pos);
+    // same reduction addRational does, so 2/4 and 1/2 share
+    i64 commonDivisor = std::gcd(std::abs(numerator), std::abs(denominator));
+    if (commonDivisor == 0) return _ast->addRational(numerator, denominator, pos);
+    auto [it, inserted] = _leaves->rationals.try_emplace({ numerator / commonDivisor, denominator / commonDivisor }, NodeID::None());
+    if (inserted) it->second = _ast->addRational(numerator, denominator, pos);
+    return it->second;
+}
+
+NodeID Parser::leafReal(const double& value, const size_t& pos) {
+    if (!_leaves) return _ast->addReal(value, pos);
+    // by bits, so -0.0 and NaNs don't get mixed up with anything
+    auto [it, inserted] = _leaves->reals.try_emplace(std::bit_cast<u64>(value), NodeID::None());
+    if (inserted) it->second = _ast->addReal(value, pos);
+    return it->second;
+}
 
+NodeID Parser::leafConstant(const ConstantKind& cKind, const size_t& pos) {
+    if (!_leaves) return _ast->addConstant(cKind, pos);
+    auto [it, inserted] = _leaves->constants.try_emplace(cKind, NodeID::None());
+    if (inserted) it->second = _ast->addConstant(cKind, pos);
+    return it->second;
+}
+
+void LeafTable::clear() {
+    identifiers.clear();
+    rationals.clear();
+    reals.clear();
+    constants.clear();
+}
+
+void LeafTable::forget(const size_t& mark) {
+    std::erase_if(identifiers, [&](const auto& kv) { return kv.second.i >= mark; });
+    std::erase_if(rationals, [&](const auto& kv) { return kv.second.i >= mark; });
+    std::erase_if(reals, [&](const auto& kv) { return kv.second.i >= mark; });
+    std::erase_if(constants, [&](const auto& kv) { return kv.second.i >= mark; });
+}
+
+void Parser::reserveNodes(const size_t& extra) {
+    // grows geometrically, so parsing many expressions into one arena doesn't reallocate every time
+    size_t needed = _ast->arena.size() + extra;
+    if (needed <= _ast->arena.capacity()) return;
+    _ast->reserve(std::max(needed, _ast->arena.capacity() * 2));
+}
+
+NodeID Parser::parseRoot() {
     _ast->root = parseExpression(0);
 
-    if (peek().is(TokenType::End)) return;
-    else {
+    if (!peek().is(TokenType::End)) {
         std::string msg = "Function parseExpression() didn't reach end of token stream";
-        throw ParserError(_pos, msg);
+        fail(msg);
+    }
+    return _ast->root;
+}
+
+NodeID Parser::fail(const std::string& message) {
+    size_t pos = (_input || _pos < _tokens->size()) ? peek().pos : UnknownPos;
+    if (!_diagnostics) throw ParserError(pos, message);
+
+    // only the first error is recorded, the rest just fall out of it
+    if (!_failed) _diagnostics->push_back({ ErrorStage::Parser, pos, message });
+    _failed = true;
+
+    // jump to End so every loop and group above bails out without unwinding
+    if (!_input) {
+        _pos = _tokens->size() - 1;
+    } else if (!peek().is(TokenType::End)) {
+        _window.push_back(Token{ TokenType::End, "End", _inputEnd, std::nullopt });
+        _pos = _windowBase + _window.size() - 1;
     }
+    return NodeID::None();
 }
 
+void Parser::pullToken() {
+    std::optional<Token> token;
+    while (!token) {
+        unsigned char c = (_inputPos < _inputEnd) ? static_cast<unsigned char>((*_input)[_inputPos]) : '\0';
+        if (_lexer.feed(c, _inputPos, token)) _inputPos++;
+    }
+    _window.push_back(std::move(*token));
+}
 
 const Token& Parser::peek() const {
+    if (_input) return _window[_pos - _windowBase];
     return (*_tokens)[_pos];
 }
 
 const Token& Parser::advance() {
-    const Token& t = (*_tokens)[_pos];
-    if (!t.is(TokenType::End)) _pos++;
+    const Token& t = peek();
+    if (t.is(TokenType::End)) return t;
+    _pos++;
+
+    if (_input) {
+        // one token of lookahead, plus a few behind for \frac to back up into
+        if (_pos - _windowBase == _window.size()) pullToken();
+        while (_pos - _windowBase > WINDOW_BEHIND) {
+            _window.pop_front();
+            _windowBase++;
+        }
+    }
     return t;
 }
 
 const Token& Parser::expect(const TokenType& type) {
-    if ((*_tokens)[_pos].type == type) {
+    if (peek().type == type) {
         return advance();
     }
 
     std::string msg = "Expected " + std::to_string((int)type) + ", got \"" + peek().lexeme + "\"";
-    throw ParserError(_pos, msg);
+    fail(msg);
+    return peek();
+}
+
+void Parser::pushExpression(const u8& minBP) {
+    Frame f;
+    f.kind = FrameKind::Expression;
+    f.minBP = minBP;
+    _frames.push_back(f);
+}
+
+void Parser::pushFrame(const FrameKind& kind, const size_t& pos) {
+    Frame f;
+    f.kind = kind;
+    f.pos = pos;
+    _frames.push_back(f);
+}
+
+void Parser::openGroup(const TokenType& close, const bool& record) {
+    Frame f;
+    f.kind = FrameKind::Group;
+    f.closeType = close;
+    f.open = _pos;
+    f.record = record;
+    advance();
+    _frames.push_back(f);
+    pushExpression(0);
 }
 
 NodeID Parser::parseExpression(const u8& minBP) {
-    NodeID leftSide = parsePrefix();
+    size_t base = _frames.size();
+    pushExpression(minBP);
+
+    NodeID value = NodeID::None();
+    bool haveValue = false;
 
-    size_t iteration = 0;
-    size_t MAX_ITERATIONS = 10000;
     while (true) {
-        if (++iteration >= MAX_ITERATIONS) {
-            std::string msg = "Infinite Loop on Token: \"" + peek().lexeme + "\", Type: " + std::to_string(static_cast<int>(peek().type));
-            throw ParserError(_pos, msg);
+        if (_failed) {
+            _frames.resize(base);
+            return NodeID::None();
+        }
+
+        // prefix position, either a whole operand comes back or frames get pushed for one
+        if (!haveValue) {
+            std::optional<NodeID> operand = parsePrefix();
+            if (!operand) continue;
+            value = *operand;
+            haveValue = true;
+            continue;
         }
 
+        // hand the finished value to whatever was waiting on it
+        Frame& top = _frames.back();
+        switch (top.kind) {
+            case FrameKind::Expression: {
+                if (top.left.isNone()) top.left = value;
+                else top.left = _ast->addBinaryOp(top.op, top.left, value, top.pos);
+
+                if (continueExpression(top)) {
+                    haveValue = false;
+                    continue;
+                }
+                value = top.left;
+                break;
+            }
+            case FrameKind::Negate: {
+                value = _ast->addUnaryOp(UnaryOpKind::Negate, value, top.pos);
+                break;
+            }
+            case FrameKind::Group: {
+                size_t close = _pos;
+                size_t open = top.open;
+                bool record = top.record;
+                expect(top.closeType);
+                if (record) recordGroup(open, close, value);
+                break;
+            }
+            case FrameKind::Sqrt: {
+                // sqrt(x) = x^(1/2)
+                NodeID half = leafRational(1, 2, top.pos);
+                value = _ast->addBinaryOp(BinaryOpKind::Power, value, half, top.pos);
+                break;
+            }
+            case FrameKind::FractionNumerator: {
+                // the numerator waits in the frame while the denominator gets parsed
+                top.kind = FrameKind::FractionDenominator;
+                top.left = value;
+                // not recorded, editing these could flip the fraction onto the fast path
+                if (!peek().is(TokenType::LBrace)) expect(TokenType::LBrace);
+                else openGroup(TokenType::RBrace, false);
+                haveValue = false;
+                continue;
+            }
+            case FrameKind::FractionDenominator: {
+                value = _ast->addBinaryOp(BinaryOpKind::Divide, top.left, value, top.pos);
+                break;
+            }
+            case FrameKind::SingleArgFunction: {
+                value = _ast->addCall(top.fKind, {value}, top.pos);
+                break;
+            }
+            case FrameKind::ArgList: {
+                _argStack.push_back(value);
+                if (peek().is(TokenType::Comma)) {
+                    advance();
+                    pushExpression(0);
+                    haveValue = false;
+                    continue;
+                }
+                expect(TokenType::RParenthesis);
+                std::vector<NodeID> args(_argStack.begin() + top.argBase, _argStack.end());
+                _argStack.resize(top.argBase);
+                value = _ast->addCall(top.fKind, args, top.pos);
+                break;
+            }
+            case FrameKind::LeftRight: {
+                if (!(peek().is(TokenType::Command) && peek().lexeme == "right")) {
+                    std::string msg = "Expected \"right\", got \"" + peek().lexeme + "\"";
+                    fail(msg);
+                    continue;
+                }
+                advance();
+                expect(TokenType::RParenthesis);
+                break;
+            }
+        }
+
+        _frames.pop_back();
+        if (_frames.size() == base) return value;
+    }
+}
+
+bool Parser::continueExpression(Frame& top) {
+    while (true) {
         const Token& t = peek();
 
         // postfix ops
         if (t.is(TokenType::Identifier) && t.lexeme == "!") {
-            if (POSTFIX_LBP < minBP) break;
+            if (POSTFIX_LBP < top.minBP) return false;
             size_t p = advance().pos;
-            leftSide = _ast->addUnaryOp(UnaryOpKind::Factorial, leftSide, p);
+            top.left = _ast->addUnaryOp(UnaryOpKind::Factorial, top.left, p);
             continue;
         }
 
         // infix ops
         if (auto it = INFIX_OPS.find(t.type); it != INFIX_OPS.end()) {
             auto [leftBP, rightBP, opKind] = it->second;
-            if (leftBP < minBP) break;
-            const Token& op = advance();
-            NodeID rightSide = parseExpression(rightBP);
-            leftSide = _ast->addBinaryOp(opKind, leftSide, rightSide, op.pos);
-            continue;
+            if (leftBP < top.minBP) return false;
+            top.op = opKind;
+            top.pos = advance().pos;
+            // top is dead after this push, the frames vector can move
+            pushExpression(rightBP);
+            return true;
         }
 
         // infix commands
         if (auto it = INFIX_COMMAND_OPS.find(t.lexeme); it != INFIX_COMMAND_OPS.end()) {
-            if (5 < minBP) break;
-            BinaryOpKind kind = (t.lexeme == "div") ? BinaryOpKind::Divide : BinaryOpKind::Multiply;
-            size_t p = advance().pos;
-            NodeID rightSide = parseExpression(6);
-            leftSide = _ast->addBinaryOp(kind, leftSide, rightSide, p);
-            continue;
+            auto [leftBP, rightBP, opKind] = it->second;
+            if (leftBP < top.minBP) return false;
+            top.op = opKind;
+            top.pos = advance().pos;
+            pushExpression(rightBP);
+            return true;
         }
 
         // implicit multiplication
         if (canImplicitMultiply()) {
-            u8 leftBP = 5;
-            u8 rightBP = 6;
-            if (leftBP < minBP) break;
-            size_t p = peek().pos;
-            NodeID rightSide = parseExpression(rightBP);
-            leftSide = _ast->addBinaryOp(BinaryOpKind::Multiply, leftSide, rightSide, p);
-            continue;
+            auto [leftBP, rightBP, opKind] = IMPLICIT_MULTIPLY;
+            if (leftBP < top.minBP) return false;
+            top.op = opKind;
+            top.pos = peek().pos;
+            pushExpression(rightBP);
+            return true;
         }
 
-        break;
+        return false;
     }
-
-    return leftSide;
 }
 
 // numbers, identifiers, unary '-', groups, commands
-NodeID Parser::parsePrefix() {
+std::optional<NodeID> Parser::parsePrefix() {
     const Token& t = peek();
 
     if (t.is(TokenType::Number)) return parseNumber();
 
     if (t.is(TokenType::Identifier)) {
         const Token& t = advance();
-        return _ast->addIdentifier(t.lexeme, t.pos);
+        return leafIdentifier(t.lexeme, t.pos);
     }
 
     if (t.is(TokenType::Minus)) {
         size_t p = advance().pos;
-        NodeID inner = parseExpression(PREFIX_UNARY_RBP);
-        return _ast->addUnaryOp(UnaryOpKind::Negate, inner, p);
+        pushFrame(FrameKind::Negate, p);
+        pushExpression(PREFIX_UNARY_RBP);
+        return std::nullopt;
     }
 
     if (t.is(TokenType::LParenthesis)) {
-        advance();
-        NodeID inner = parseExpression(0);
-        expect(TokenType::RParenthesis);
-        return inner;
+        openGroup(TokenType::RParenthesis, true);
+        return std::nullopt;
     }
 
-    if (t.is(TokenType::RBrace)) {
-        return parseBraceGroup();
+    if (t.is(TokenType::LBrace)) {
+        openGroup(TokenType::RBrace, true);
+        return std::nullopt;
     }
 
     if (t.is(TokenType::Command)) {
@@ -127,88 +445,120 @@ NodeID Parser::parsePrefix() {
     }
 
     std::string msg = "Unexpected token: \"" + t.lexeme + "\"";
-    throw ParserError(_pos, msg);
+    return fail(msg);
 }
 
 NodeID Parser::parseNumber() {
     const Token& t = advance();
-    if (t.isInt()) {
-        return _ast->addRational(std::get<i64>(t.number->value), 1, t.pos);
-    }
-    double val = std::get<double>(t.number->value);
     i64 num, den;
-    if (doubleToRational(val, num, den)) {
-        return _ast->addRational(num, den, t.pos);
+    if (numberAsRational(t, num, den)) {
+        return leafRational(num, den, t.pos);
     }
-    return _ast->addReal(std::get<double>(t.number->value), t.pos);
+    return leafReal(std::get<double>(t.number->value), t.pos);
 }
 
-NodeID Parser::parseCommand() {
+bool Parser::numberAsRational(const Token& t, i64& outNumerator, i64& outDenominator) const {
+    // the lexer already did the work for plain decimals
+    if (t.number->isExact) {
+        outNumerator = t.number->numerator;
+        outDenominator = t.number->denominator;
+        return true;
+    }
+    if (t.isInt()) {
+        outNumerator = std::get<i64>(t.number->value);
+        outDenominator = 1;
+        return true;
+    }
+    return doubleToRational(std::get<double>(t.number->value), outNumerator, outDenominator);
+}
+
+std::optional<NodeID> Parser::parseCommand() {
     const Token& t = peek();
     const std::string& cmd = t.lexeme;
 
     if (auto it = CONSTANT_MAP.find(cmd); it != CONSTANT_MAP.end()) {
         size_t p = advance().pos;
-        return _ast->addConstant(it->second, p);
+        return leafConstant(it->second, p);
     }
 
+    // \sin{x}, \sin(x), or \sin x
     if (auto it = FUNCTION_KIND_MAP.find(cmd); it != FUNCTION_KIND_MAP.end()) {
-        return parseSingleArgFunction();
+        pushFrame(FrameKind::SingleArgFunction, advance().pos);
+        _frames.back().fKind = it->second;
+        if (peek().is(TokenType::LBrace)) openGroup(TokenType::RBrace, true);
+        else if (peek().is(TokenType::LParenthesis)) openGroup(TokenType::RParenthesis, true);
+        else pushExpression(PREFIX_UNARY_RBP);
+        return std::nullopt;
     }
 
+    // \max(a, b, c)
     if (auto it = MULTI_ARG_FUNCTION_KIND_MAP.find(cmd); it != MULTI_ARG_FUNCTION_KIND_MAP.end()) {
-        return parseMultiArgFunction();
+        FunctionKind fKind = it->second;
+        size_t p = advance().pos;
+        expect(TokenType::LParenthesis);
+        openArgList(fKind, p);
+        return std::nullopt;
     }
 
+    // \operatorname{name}(args...)
     if (cmd == "operatorname") {
-        return parseOperatorName();
+        size_t p = advance().pos;
+
+        expect(TokenType::LBrace);
+        const Token& name = expect(TokenType::Identifier);
+        auto it = OPERATOR_NAME_MAP.find(name.lexeme);
+        expect(TokenType::RBrace);
+
+        if (it == OPERATOR_NAME_MAP.end()) {
+            std::string msg = "Unknown operatorname: \"" + name.lexeme + "\"";
+            return fail(msg);
+        }
+
+        expect(TokenType::LParenthesis);
+        openArgList(it->second, p);
+        return std::nullopt;
     }
 
+    // \frac{n}{d}
     if (cmd == "frac") {
-        return parseFraction();
+        size_t p = advance().pos;
+        if (auto folded = parseRationalFraction(p)) return *folded;
+
+        // slow path for whatever else
+        pushFrame(FrameKind::FractionNumerator, p);
+        if (!peek().is(TokenType::LBrace)) expect(TokenType::LBrace);
+        else openGroup(TokenType::RBrace, false);
+        return std::nullopt;
     }
 
+    // \sqrt{x}
     if (cmd == "sqrt") {
-        size_t p = advance().pos;
-        NodeID inner = parseBraceGroup();
-
-        // sqrt(x) = x^(1/2)
-        NodeID half = _ast->addRational(1, 2, p);
-        return _ast->addBinaryOp(BinaryOpKind::Power, inner, half, p);
+        pushFrame(FrameKind::Sqrt, advance().pos);
+        if (!peek().is(TokenType::LBrace)) expect(TokenType::LBrace);
+        else openGroup(TokenType::RBrace, true);
+        return std::nullopt;
     }
 
+    // \left( expr \right)
     if (cmd == "left") {
-        return parseLeftRight();
+        pushFrame(FrameKind::LeftRight, advance().pos);
+        expect(TokenType::LParenthesis);
+        pushExpression(0);
+        return std::nullopt;
     }
 
     std::string msg = "Unknown command: " + cmd;
-    throw ParserError(_pos, msg);
+    return fail(msg);
 }
 
-NodeID Parser::parseBraceGroup() {
-    expect(TokenType::LBrace);
-    NodeID inner = parseExpression(0);
-    expect(TokenType::RBrace);
-    return inner;
+void Parser::openArgList(const FunctionKind& fKind, const size_t& pos) {
+    pushFrame(FrameKind::ArgList, pos);
+    _frames.back().fKind = fKind;
+    _frames.back().argBase = _argStack.size();
+    pushExpression(0);
 }
 
-NodeID Parser::parseLeftRight() {
-    advance();
-    expect(TokenType::LParenthesis);
-    NodeID inner = parseExpression(0);
-    if (!(peek().is(TokenType::Command) && peek().lexeme != "right")) {
-        std::string msg = "Expected \"right\", got \"" + peek().lexeme + "\"";
-        throw ParserError(_pos, msg);
-    }
-    advance();
-    expect(TokenType::RParenthesis);
-    return inner;
-}
-
-NodeID Parser::parseFraction() {
-    // consume "\frac"
-    size_t p = advance().pos;
-
+std::optional<NodeID> Parser::parseRationalFraction(const size_t& p) {
     // store the original pos so we can use advance freely
     size_t saved = _pos;
 
@@ -218,114 +568,48 @@ NodeID Parser::parseFraction() {
         bool negativeNumerator = peek().is(TokenType::Minus);
         if (negativeNumerator) advance();
         if (peek().is(TokenType::Number)) {
-            i64 n_numerator, n_denominator = 1;
-            bool gotNumerator = false;
-            if (peek().isInt()) {
-                n_numerator = std::get<i64>(advance().number->value);
-                gotNumerator = true;
-            } else {
-                double val = std::get<double>(advance().number->value);
-                gotNumerator = doubleToRational(val, n_numerator, n_denominator);
-            }
+            i64 n_numerator, n_denominator;
+            bool gotNumerator = numberAsRational(advance(), n_numerator, n_denominator);
 
             if (negativeNumerator) n_numerator = -n_numerator;
 
+            // "}{" between the numerator and denominator
             if (gotNumerator && peek().is(TokenType::RBrace)) {
                 advance();
-                bool negativeDenominator = peek().is(TokenType::Minus);
-                if (negativeDenominator) advance();
-                if (peek().is(TokenType::Number)) {
-                    i64 d_numerator, d_denominator = 1;
-                    bool gotDenominator = false;
-                    if (peek().isInt()) {
-                        d_numerator = std::get<i64>(advance().number->value);
-                        gotDenominator = true;
-                    } else {
-                        double val = std::get<double>(advance().number->value);
-                        gotDenominator = doubleToRational(val, d_numerator, d_denominator);
-                    }
-
-                    if (negativeDenominator) d_numerator = -d_numerator;
-
-                    if (gotDenominator && peek().is(TokenType::RBrace)) {
-                        advance();
-                        i64 final_numerator = d_denominator * n_numerator;
-                        i64 final_denominator = n_denominator * d_numerator;
-                        return _ast->addRational(final_numerator, final_denominator, p);
+                if (peek().is(TokenType::LBrace)) {
+                    advance();
+                    bool negativeDenominator = peek().is(TokenType::Minus);
+                    if (negativeDenominator) advance();
+                    if (peek().is(TokenType::Number)) {
+                        i64 d_numerator, d_denominator;
+                        bool gotDenominator = numberAsRational(advance(), d_numerator, d_denominator);
+
+                        if (negativeDenominator) d_numerator = -d_numerator;
+
+                        if (gotDenominator && d_numerator != 0 && peek().is(TokenType::RBrace)) {
+                            advance();
+                            // if it doesn't fit in an i64 it's left to the slow path as a Divide
+                            i64 final_numerator, final_denominator;
+                            bool overflow = __builtin_mul_overflow(d_denominator, n_numerator, &final_numerator)
+                                         || __builtin_mul_overflow(n_denominator, d_numerator, &final_denominator)
+                                         || final_numerator == std::numeric_limits<i64>::min()
+                                         || final_denominator == std::numeric_limits<i64>::min();
+                            if (!overflow) {
+                                if (final_denominator < 0) {
+                                    final_numerator = -final_numerator;
+                                    final_denominator = -final_denominator;
+                                }
+                                return leafRational(final_numerator, final_denominator, p);
+                            }
+                        }
                     }
-                } 
+                }
             }
         }
     }
 
-    // slow path for whatever else
     _pos = saved;
-    NodeID numerator = parseBraceGroup();
-    NodeID denominator = parseBraceGroup();
-    return _ast->addBinaryOp(BinaryOpKind::Divide, numerator, denominator, p);
-}
-
-NodeID Parser::parseSingleArgFunction() {
-    const Token& t = advance();
-    FunctionKind fKind = FUNCTION_KIND_MAP.at(t.lexeme);
-    size_t p = t.pos;
-
-    NodeID arg;
-    if (peek().is(TokenType::LBrace)) {
-        arg = parseBraceGroup();
-    } else if (peek().is(TokenType::LParenthesis)) {
-        advance();
-        arg = parseExpression(0);
-        expect(TokenType::RParenthesis);
-    } else {
-        arg = parseExpression(PREFIX_UNARY_RBP);
-    }
-
-    return _ast->addCall(fKind, {arg}, p); 
-}
-
-NodeID Parser::parseMultiArgFunction() {
-    const Token& t = advance();
-    FunctionKind fKind = MULTI_ARG_FUNCTION_KIND_MAP.at(t.lexeme);
-    size_t p = t.pos;
-
-    expect(TokenType::LParenthesis);
-    std::vector<NodeID> args = parseArgList();
-    expect(TokenType::RParenthesis);
-
-    return _ast->addCall(fKind, args, p);
-}
-
-NodeID Parser::parseOperatorName() {
-    size_t p = advance().pos;
-
-    expect(TokenType::LBrace);
-    const Token& name = expect(TokenType::Identifier);
-    expect(TokenType::RBrace);
-
-    auto it = OPERATOR_NAME_MAP.find(name.lexeme);
-    if (it == OPERATOR_NAME_MAP.end()) {
-
-        std::string msg = "Unknown operatorname: \"" + name.lexeme + "\"";
-        throw ParserError(_pos, msg);
-    }
-
-    expect(TokenType::LParenthesis);
-    std::vector<NodeID> args = parseArgList();
-    expect(TokenType::RParenthesis);
-
-    return _ast->addCall(it->second, args, p);
-}
-
-std::vector<NodeID> Parser::parseArgList() {
-    std::vector<NodeID> args;
-    args.push_back(parseExpression(0));
-    while (peek().is(TokenType::Comma)) {
-        advance();
-        args.push_back(parseExpression(0));
-    }
-
-    return args;
+    return std::nullopt;
 }
 
 bool Parser::canImplicitMultiply() const {
@@ -61,6 +61,27 @@ The core loop:
 Recursion with right_bp is what creates the tree structure.
 It determines how much of the remaining tokens the right
 side can consume.
+
+--
+The recursion doesn't actually happen on the call stack though.
+"((((((((...x...))))))))" or a million terms of "1+1+1+..." would
+need a native stack frame per level, and that eventually segfaults.
+Instead every place that would recurse pushes a Frame onto _frames
+and goes back around the loop:
+
+    Expression      a parseExpression(minBP) call, holding left_side
+                    and the op waiting for its right side
+    Negate, Sqrt    wrap whatever value comes back
+    Group           expects the closing ')' or '}' after the value
+    Fraction...     \frac holds the numerator while parsing the denominator
+    ArgList         collects comma separated args on _argStack
+    LeftRight       expects "\right)" after the value
+
+parsePrefix() either returns a finished value (numbers, identifiers,
+constants) or pushes frames and lets the loop parse what's inside.
+When a value finishes, it's handed to the top frame, which either
+wants more (pushes another Expression) or finishes its own value
+and pops. Depth is only limited by memory now.
 */
 
 #ifndef PARSER_H
@@ -71,16 +92,75 @@ side can consume.
 
 #include <unordered_map>
 #include <unordered_set>
+#include <deque>
+#include <optional>
+#include <map>
+#include <string_view>
+
+// where a (...) or {...} group sits in the token stream and what it parsed to
+struct GroupSpan {
+    size_t open;    // token index of the opening bracket
+    size_t close;   // token index of the matching closing bracket
+    NodeID inner;   // the node the group's contents became
+};
+
+// identical leaves (identifiers, numbers, constants) already in an arena, so parsing
+// can hand back the existing node instead of making a new one
+struct LeafTable {
+    std::unordered_map<std::string, NodeID> identifiers;
+    std::map<std::pair<i64, i64>, NodeID> rationals;   // reduced numerator, denominator
+    std::unordered_map<u64, NodeID> reals;             // bit pattern of the double
+    std::map<ConstantKind, NodeID> constants;
+
+    void clear();
+    // drops every entry for nodes at or past mark, for when the arena gets cut back
+    void forget(const size_t& mark);
+};
 
 class Parser {
     public:
         void parse(const std::vector<Token>& tokens, AST& ast);
+        // lexes as it parses, without ever building the whole token vector
+        void parse(const std::string& input, AST& ast);
+        Result<NodeID> tryParse(const std::string& input, AST& ast);
+        // non-throwing parse, errors come back as Diagnostics with their source position
+        // groups (if set) gets every re-parseable group, inner groups before outer ones
+        Result<NodeID> tryParse(const std::vector<Token>& tokens, AST& ast, std::vector<GroupSpan>* groups = nullptr);
+        // parses only input[first, last), token and node positions stay relative to all of input
+        // leaves (if set) makes identical leaves share one node, see LeafTable
+        Result<NodeID> tryParse(const std::string& input, const size_t& first, const size_t& last, AST& ast, LeafTable* leaves = nullptr);
+        // parses only the contents of the group between tokens open and close, doesn't touch ast.root
+        Result<NodeID> tryParseGroup(const std::vector<Token>& tokens, AST& ast, const size_t& open, const size_t& close, std::vector<GroupSpan>* groups = nullptr);
 
     private:
         // object state
         const std::vector<Token>* _tokens = nullptr;
         AST* _ast = nullptr;
         size_t _pos = 0;
+        Diagnostics* _diagnostics = nullptr;   // set when errors are collected instead of thrown
+        bool _failed = false;
+        std::vector<GroupSpan>* _groups = nullptr;
+        LeafTable* _leaves = nullptr;
+
+        // lexer-fused parsing pulls tokens into a small window instead of using _tokens
+        const std::string* _input = nullptr;
+        size_t _inputPos = 0;
+        size_t _inputEnd = 0;       // lexing stops here, like it's the end of the string
+        LexerMachine _lexer;
+        std::deque<Token> _window;
+        size_t _windowBase = 0;     // token index of _window.front()
+        static constexpr size_t WINDOW_BEHIND = 16;
+
+        NodeID run(const std::vector<Token>& tokens, AST& ast, Diagnostics* diagnostics);
+        NodeID run(const std::string& input, const size_t& first, const size_t& last, AST& ast, Diagnostics* diagnostics);
+        NodeID parseRoot();
+        // makes room for extra more nodes in the arena
+        void reserveNodes(const size_t& extra);
+        // lexes the next token onto the end of _window
+        void pullToken();
+        // throws a ParserError, or records it and skips to the End token
+        NodeID fail(const std::string& message);
+        void recordGroup(const size_t& open, const size_t& close, const NodeID& inner);
 
         // returns a reference to the token at pos
         const Token& peek() const;
@@ -89,31 +169,85 @@ class Parser {
         // asserts the current token matches, then advances past it
         const Token& expect(const TokenType& type);
 
+        // what a pending parse step is waiting on, see the top of the file
+        enum class FrameKind : u8 {
+            Expression,
+            Negate,
+            Group,
+            Sqrt,
+            FractionNumerator,
+            FractionDenominator,
+            SingleArgFunction,
+            ArgList,
+            LeftRight
+        };
+
+        struct Frame {
+            FrameKind kind;
+            u8 minBP = 0;
+            BinaryOpKind op = BinaryOpKind::Add;
+            FunctionKind fKind = FunctionKind::Sine;
+            TokenType closeType = TokenType::End;
+            bool record = false;
+            size_t pos = 0;
+            size_t open = 0;            // Group: token index of the opening bracket
+            size_t argBase = 0;         // ArgList: where this call's args start in _argStack
+            NodeID left = NodeID::None();
+        };
+
+        std::vector<Frame> _frames;
+        std::vector<NodeID> _argStack;
+
         NodeID parseExpression(const u8& minBP);
+        // runs the postfix/infix loop for top, returns true if it pushed a frame for a right side
+        bool continueExpression(Frame& top);
+        void pushExpression(const u8& minBP);
+        void pushFrame(const FrameKind& kind, const size_t& pos);
+        // consumes the opening bracket and pushes a Group + Expression for its contents
+        void openGroup(const TokenType& close, const bool& record);
+        void openArgList(const FunctionKind& fKind, const size_t& pos);
 
-        NodeID parsePrefix();
-        NodeID parseNumber();               // rational or real
-        NodeID parseCommand();              // \sqrt{}, \pi
-        NodeID parseBraceGroup();           // {...}
-        NodeID parseLeftRight();            // \left(expr \right)
-        NodeID parseFraction();             // \frac{n}{d}
-        //NodeID parseFunctionArg();          // \sin{x}, \sin x, or \sin(x + 1)
-        NodeID parseSingleArgFunction();    // sin(), ln()
-        NodeID parseMultiArgFunction();     // max(), min(), atan2(), etc.
-        NodeID parseOperatorName();         // \operatorname{name}(args...)
-        std::vector<NodeID> parseArgList(); // \max{arg1, arg2, arg3, etc}
+        // nullopt means frames were pushed and the value comes later
+        std::optional<NodeID> parsePrefix();
+        std::optional<NodeID> parseCommand();   // \sqrt{}, \pi, functions
+        NodeID parseNumber();                   // rational or real
+        // AST add* calls that go through _leaves when it's set
+        NodeID leafIdentifier(const std::string& name, const size_t& pos);
+        NodeID leafRational(const i64& numerator, const i64& denominator, const size_t& pos);
+        NodeID leafReal(const double& value, const size_t& pos);
+        NodeID leafConstant(const ConstantKind& cKind, const size_t& pos);
+        bool numberAsRational(const Token& t, i64& outNumerator, i64& outDenominator) const;
+        // \frac{n}{d} with plain numbers folds straight into a rational, otherwise rewinds
+        std::optional<NodeID> parseRationalFraction(const size_t& p);
         
         bool canImplicitMultiply() const;
 };
 
+// the tables below are constexpr arrays so the compile-time parser in literal.h
+// can use them too, the maps the runtime parser looks things up in are built from them
+
 struct InfixInfo {
     u8 leftBP;
     u8 rightBP;
     BinaryOpKind opKind;
 };
 
+template <class K, class V>
+struct TableEntry {
+    K key;
+    V value;
+};
+
+// builds a lookup map out of one of the tables
+template <class Map, class K, class V, size_t N>
+Map mapFromTable(const TableEntry<K, V> (&table)[N]) {
+    Map map;
+    for (const TableEntry<K, V>& e : table) map.emplace(e.key, e.value);
+    return map;
+}
+
 // infix ops
-inline const std::unordered_map<TokenType, InfixInfo> INFIX_OPS = {
+inline constexpr TableEntry<TokenType, InfixInfo> INFIX_OP_TABLE[] = {
     { TokenType::Equals,    { 1, 2, BinaryOpKind::Equals } },
     { TokenType::Plus,      { 3, 4, BinaryOpKind::Add } },
     { TokenType::Minus,     { 3, 4, BinaryOpKind::Subtract } },
@@ -121,13 +255,20 @@ inline const std::unordered_map<TokenType, InfixInfo> INFIX_OPS = {
     { TokenType::Slash,     { 5, 6, BinaryOpKind::Divide } },
     { TokenType::Caret,     { 12, 11, BinaryOpKind::Power } }
 };
+inline const std::unordered_map<TokenType, InfixInfo> INFIX_OPS =
+    mapFromTable<std::unordered_map<TokenType, InfixInfo>>(INFIX_OP_TABLE);
 
 // commands that act as infix ops
-inline const std::unordered_map<std::string, InfixInfo> INFIX_COMMAND_OPS = {
+inline constexpr TableEntry<std::string_view, InfixInfo> INFIX_COMMAND_TABLE[] = {
     { "cdot",   { 5, 6, BinaryOpKind::Multiply } },
     { "times",  { 5, 6, BinaryOpKind::Multiply } },
     { "div",    { 5, 6, BinaryOpKind::Divide } }
 };
+inline const std::unordered_map<std::string, InfixInfo> INFIX_COMMAND_OPS =
+    mapFromTable<std::unordered_map<std::string, InfixInfo>>(INFIX_COMMAND_TABLE);
+
+// implicit multiplication binds like '*'
+inline constexpr InfixInfo IMPLICIT_MULTIPLY = { 5, 6, BinaryOpKind::Multiply };
 
 // prefix unary operators only need a right binding power
 inline constexpr u8 PREFIX_UNARY_RBP = 9;
@@ -136,7 +277,7 @@ inline constexpr u8 PREFIX_UNARY_RBP = 9;
 inline constexpr u8 POSTFIX_LBP = 13;
 
 // maps commands to FunctionKind for single-arg functions
-inline const std::unordered_map<std::string, FunctionKind> FUNCTION_KIND_MAP = {
+inline constexpr TableEntry<std::string_view, FunctionKind> FUNCTION_KIND_TABLE[] = {
     { "sin",    FunctionKind::Sine },
     { "cos",    FunctionKind::Cosine },
     { "tan",    FunctionKind::Tangent },
@@ -144,40 +285,45 @@ inline const std::unordered_map<std::string, FunctionKind> FUNCTION_KIND_MAP = {
     { "log",    FunctionKind::Logarithm },
     { "exp",    FunctionKind::Exponential }
 };
+inline const std::unordered_map<std::string, FunctionKind> FUNCTION_KIND_MAP =
+    mapFromTable<std::unordered_map<std::string, FunctionKind>>(FUNCTION_KIND_TABLE);
 
-// maps multi-arg functions \operatorname{name} tp FunctionKind
-inline const std::unordered_map<std::string, FunctionKind> OPERATOR_NAME_MAP = {
-    { "max",    FunctionKind::Max },
-    { "min",    FunctionKind::Min },
-    { "atan2",  FunctionKind::Atan2 },
-    { "hypot",  FunctionKind::Hypotenuse },
-    { "abs",    FunctionKind::AbsoluteValue }
-};
-
-// maps commands to FunctionKind for multi-arg functions (e.g. \max, \min)
-inline const std::unordered_map<std::string, FunctionKind> MULTI_ARG_FUNCTION_KIND_MAP = {
+// maps multi-arg functions, both \operatorname{name} and \name, to FunctionKind
+inline constexpr TableEntry<std::string_view, FunctionKind> MULTI_ARG_FUNCTION_TABLE[] = {
     { "max",    FunctionKind::Max },
     { "min",    FunctionKind::Min },
     { "atan2",  FunctionKind::Atan2 },
     { "hypot",  FunctionKind::Hypotenuse },
-    { "abs",    FunctionKind::AbsoluteValue }
+    { "abs",    FunctionKind::AbsoluteValue },
+    { "polygamma", FunctionKind::Polygamma }
 };
+inline const std::unordered_map<std::string, FunctionKind> OPERATOR_NAME_MAP =
+    mapFromTable<std::unordered_map<std::string, FunctionKind>>(MULTI_ARG_FUNCTION_TABLE);
+inline const std::unordered_map<std::string, FunctionKind> MULTI_ARG_FUNCTION_KIND_MAP =
+    mapFromTable<std::unordered_map<std::string, FunctionKind>>(MULTI_ARG_FUNCTION_TABLE);
 
 // maps commands to ConstantKind
-inline const std::unordered_map<std::string, ConstantKind> CONSTANT_MAP = {
+inline constexpr TableEntry<std::string_view, ConstantKind> CONSTANT_TABLE[] = {
     { "pi",     ConstantKind::PI },
     { "e",      ConstantKind::E }
 };
+inline const std::unordered_map<std::string, ConstantKind> CONSTANT_MAP =
+    mapFromTable<std::unordered_map<std::string, ConstantKind>>(CONSTANT_TABLE);
 
 // commands that can start a new expression for implicit multiplication
-inline const std::unordered_set<std::string> PREFIX_COMMANDS = {
+inline constexpr std::string_view PREFIX_COMMAND_TABLE[] = {
     "sin", "cos", "tan",
     "ln", "log", "exp",
     "pi", "e",
     "sqrt", "frac",
     "left", "operatorname",
     "arcsin", "arccos", "arctan",
-    "max", "min", "atan2", "hypot", "abs",
+    "max", "min", "atan2", "hypot", "abs", "polygamma",
 };
+inline const std::unordered_set<std::string> PREFIX_COMMANDS = [] {
+    std::unordered_set<std::string> set;
+    for (const std::string_view& name : PREFIX_COMMAND_TABLE) set.emplace(name);
+    return set;
+}();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,307 @@
+#include "printer.h"
+
+#include <charconv>
+#include <cstdio>
+
+// flush to the stream once this much is buffered
+static constexpr size_t STREAM_CHUNK = 1 << 16;
+
+// binding levels, same numbers as the parser's binding powers
+static constexpr size_t LEVEL_EQUALS = 1;
+static constexpr size_t LEVEL_ADD = 3;
+static constexpr size_t LEVEL_MULTIPLY = 5;
+static constexpr size_t LEVEL_NEGATE = 9;
+static constexpr size_t LEVEL_POWER = 12;
+static constexpr size_t LEVEL_POSTFIX = 13;
+static constexpr size_t LEVEL_ATOM = 14;
+
+template <class I>
+static void appendInt(std::string& out, const I& value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+// shortest text that reads back as the same double
+static void appendReal(std::string& out, const double& value) {
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+// matches RealNode::toString, which the tree dump has always used
+static void appendFixed(std::string& out, const double& value) {
+    char buf[512];
+    int n = std::snprintf(buf, sizeof(buf), "%f", value);
+    if (n > 0 && (size_t)n < sizeof(buf)) out.append(buf, n);
+    else out += std::to_string(value);
+}
+
+static std::string_view constantName(const ConstantKind& cKind, const bool& latex) {
+    switch (cKind) {
+        case ConstantKind::PI: return latex ? "\\pi" : "pi";
+        // the parser reads \e, a plain e would come back as an identifier
+        case ConstantKind::E: return latex ? "\\e" : "e";
+        case ConstantKind::I: return "i";
+    }
+    return "?";
+}
+
+// the parser reads \sin(x) and \max(a, b), but there's no \atan2 in real LaTeX
+static std::string_view latexFunctionName(const FunctionKind& fKind) {
+    switch (fKind) {
+        case FunctionKind::Sine: return "\\sin";
+        case FunctionKind::Cosine: return "\\cos";
+        case FunctionKind::Tangent: return "\\tan";
+        case FunctionKind::Exponential: return "\\exp";
+        case FunctionKind::NaturalLogarithm: return "\\ln";
+        case FunctionKind::Logarithm: return "\\log";
+        case FunctionKind::Max: return "\\max";
+        case FunctionKind::Min: return "\\min";
+        case FunctionKind::Atan2: return "\\operatorname{atan2}";
+        case FunctionKind::Hypotenuse: return "\\operatorname{hypot}";
+        case FunctionKind::AbsoluteValue: return "\\operatorname{abs}";
+        case FunctionKind::Polygamma: return "\\operatorname{polygamma}";
+    }
+    return "\\operatorname{unknown}";
+}
+
+static std::string_view functionName(const FunctionKind& fKind) {
+    switch (fKind) {
+        case FunctionKind::Sine: return "sin";
+        case FunctionKind::Cosine: return "cos";
+        case FunctionKind::Tangent: return "tan";
+        case FunctionKind::Atan2: return "atan2";
+        case FunctionKind::AbsoluteValue: return "abs";
+        case FunctionKind::Exponential: return "exp";
+        case FunctionKind::NaturalLogarithm: return "ln";
+        case FunctionKind::Logarithm: return "log";
+        case FunctionKind::Hypotenuse: return "hypot";
+        case FunctionKind::Max: return "max";
+        case FunctionKind::Min: return "min";
+        case FunctionKind::Polygamma: return "polygamma";
+    }
+    return "unknown";
+}
+
+static std::string_view binaryOpText(const BinaryOpKind& bKind, const bool& latex) {
+    switch (bKind) {
+        case BinaryOpKind::Add: return " + ";
+        case BinaryOpKind::Subtract: return " - ";
+        case BinaryOpKind::Multiply: return latex ? " \\cdot " : " * ";
+        case BinaryOpKind::Divide: return " / ";
+        case BinaryOpKind::Power: return "^";
+        case BinaryOpKind::Equals: return " = ";
+    }
+    return " ? ";
+}
+
+// level of the operator itself, and the levels its left and right children need
+static void binaryLevels(const BinaryOpKind& bKind, size_t& self, size_t& left, size_t& right) {
+    switch (bKind) {
+        case BinaryOpKind::Equals: self = LEVEL_EQUALS; left = LEVEL_EQUALS; right = LEVEL_EQUALS + 1; break;
+        case BinaryOpKind::Add:
+        case BinaryOpKind::Subtract: self = LEVEL_ADD; left = LEVEL_ADD; right = LEVEL_ADD + 1; break;
+        case BinaryOpKind::Multiply:
+        case BinaryOpKind::Divide: self = LEVEL_MULTIPLY; left = LEVEL_MULTIPLY; right = LEVEL_MULTIPLY + 1; break;
+        // right associative, so it's the other way around
+        case BinaryOpKind::Power: self = LEVEL_POWER; left = LEVEL_POWER + 1; right = LEVEL_POWER - 1; break;
+    }
+}
+
+// a literal number, maybe negated, which is what \frac{}{} takes as a shortcut
+static bool isNumber(const AST& ast, NodeID id) {
+    if (const UnaryOpNode* u = std::get_if<UnaryOpNode>(&ast.at(id).kind); u && u->uKind == UnaryOpKind::Negate) id = u->inner;
+    if (const RationalNode* r = std::get_if<RationalNode>(&ast.at(id).kind)) return r->denominator == 1;
+    return std::holds_alternative<RealNode>(ast.at(id).kind);
+}
+
+void Printer::print(const AST& ast, const NodeID& id, std::string& out, const PrintStyle& style) {
+    if (style == PrintStyle::Tree) printTree(ast, id, out, nullptr);
+    else printInfix(ast, id, out, nullptr, style == PrintStyle::LaTeX);
+}
+
+void Printer::print(const AST& ast, const NodeID& id, std::ostream& out, const PrintStyle& style) {
+    _buffer.clear();
+    if (style == PrintStyle::Tree) printTree(ast, id, _buffer, &out);
+    else printInfix(ast, id, _buffer, &out, style == PrintStyle::LaTeX);
+    out.write(_buffer.data(), (std::streamsize)_buffer.size());
+    _buffer.clear();
+}
+
+void Printer::printTree(const AST& ast, const NodeID& id, std::string& out, std::ostream* stream) {
+    _stack.clear();
+    if (!id.isNone()) pushNode(id, 0);
+
+    while (!_stack.empty()) {
+        Item item = _stack.back();
+        _stack.pop_back();
+
+        if (stream && out.size() >= STREAM_CHUNK) {
+            stream->write(out.data(), (std::streamsize)out.size());
+            out.clear();
+        }
+
+        out.append(2 * item.level, ' ');
+
+        // children go on in reverse so the first one comes off first
+        std::visit([&](const auto& node) {
+            using T = std::decay_t<decltype(node)>;
+            if constexpr (std::is_same_v<T, RationalNode>) {
+                appendInt(out, node.numerator);
+                if (node.denominator != 1) {
+                    out += '/';
+                    appendInt(out, node.denominator);
+                }
+            } else if constexpr (std::is_same_v<T, RealNode>) {
+                appendFixed(out, node.value);
+            } else if constexpr (std::is_same_v<T, IdentifierNode>) {
+                out += node.name;
+            } else if constexpr (std::is_same_v<T, ConstantNode>) {
+                out += node.toString();
+            } else if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                out += node.toString();
+                pushNode(node.right, item.level + 1);
+                pushNode(node.left, item.level + 1);
+            } else if constexpr (std::is_same_v<T, UnaryOpNode>) {
+                out += node.toString();
+                pushNode(node.inner, item.level + 1);
+            } else if constexpr (std::is_same_v<T, CallNode>) {
+                out += functionName(node.fKind);
+                for (size_t i = node.args.size(); i-- > 0;) pushNode(node.args[i], item.level + 1);
+            }
+        }, ast.at(item.id).kind);
+
+        out += '\n';
+    }
+}
+
+void Printer::printInfix(const AST& ast, const NodeID& id, std::string& out, std::ostream* stream, const bool& latex) {
+    const std::string_view open = latex ? "\\left(" : "(";
+    const std::string_view close = latex ? "\\right)" : ")";
+
+    _stack.clear();
+    if (!id.isNone()) pushNode(id, 0);
+
+    while (!_stack.empty()) {
+        Item item = _stack.back();
+        _stack.pop_back();
+
+        if (stream && out.size() >= STREAM_CHUNK) {
+            stream->write(out.data(), (std::streamsize)out.size());
+            out.clear();
+        }
+
+        if (item.id.isNone()) {
+            out += item.text;
+            continue;
+        }
+
+        // wraps the node in parentheses if it binds looser than its spot needs
+        auto wrap = [&](const size_t& level) {
+            if (level >= item.level) return;
+            out += open;
+            pushText(close);
+        };
+
+        std::visit([&](const auto& node) {
+            using T = std::decay_t<decltype(node)>;
+            if constexpr (std::is_same_v<T, RationalNode>) {
+                bool negative = node.numerator < 0;
+                if (node.denominator == 1) {
+                    wrap(negative ? LEVEL_NEGATE : LEVEL_ATOM);
+                    appendInt(out, node.numerator);
+                } else if (latex) {
+                    // minus inside the braces, so the parser's \frac fast path reads it back as one rational
+                    out += "\\frac{";
+                    appendInt(out, node.numerator);
+                    out += "}{";
+                    appendInt(out, node.denominator);
+                    out += '}';
+                } else {
+                    wrap(LEVEL_MULTIPLY);
+                    appendInt(out, node.numerator);
+                    out += '/';
+                    appendInt(out, node.denominator);
+                }
+            } else if constexpr (std::is_same_v<T, RealNode>) {
+                wrap(std::signbit(node.value) ? LEVEL_NEGATE : LEVEL_ATOM);
+                appendReal(out, node.value);
+            } else if constexpr (std::is_same_v<T, IdentifierNode>) {
+                out += node.name;
+            } else if constexpr (std::is_same_v<T, ConstantNode>) {
+                out += constantName(node.cKind, latex);
+            } else if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                // \frac of two plain numbers would get folded into a rational by the parser
+                if (latex && node.bKind == BinaryOpKind::Divide && !(isNumber(ast, node.left) && isNumber(ast, node.right))) {
+                    // braces group it, so neither side needs parentheses
+                    out += "\\frac{";
+                    pushText("}");
+                    pushNode(node.right, 0);
+                    pushText("}{");
+                    pushNode(node.left, 0);
+                    return;
+                }
+                if (latex && node.bKind == BinaryOpKind::Power) {
+                    const RationalNode* exponent = std::get_if<RationalNode>(&ast.at(node.right).kind);
+                    if (exponent && exponent->numerator == 1 && exponent->denominator == 2) {
+                        out += "\\sqrt{";
+                        pushText("}");
+                        pushNode(node.left, 0);
+                        return;
+                    }
+                    wrap(LEVEL_POWER);
+                    pushText("}");
+                    pushNode(node.right, 0);
+                    pushText("^{");
+                    pushNode(node.left, LEVEL_POWER + 1);
+                    return;
+                }
+
+                size_t self = 0, left = 0, right = 0;
+                binaryLevels(node.bKind, self, left, right);
+                wrap(self);
+                pushNode(node.right, right);
+                pushText(binaryOpText(node.bKind, latex));
+                pushNode(node.left, left);
+            } else if constexpr (std::is_same_v<T, UnaryOpNode>) {
+                if (node.uKind == UnaryOpKind::Negate) {
+                    wrap(LEVEL_NEGATE);
+                    out += '-';
+                    pushNode(node.inner, LEVEL_NEGATE);
+                    return;
+                }
+                wrap(LEVEL_POSTFIX);
+                if (node.uKind == UnaryOpKind::Factorial) pushText("!");
+                else pushText(latex ? "\\%" : "%");
+                pushNode(node.inner, LEVEL_POSTFIX);
+            } else if constexpr (std::is_same_v<T, CallNode>) {
+                out += latex ? latexFunctionName(node.fKind) : functionName(node.fKind);
+                out += '(';
+                pushText(")");
+                for (size_t i = node.args.size(); i-- > 0;) {
+                    pushNode(node.args[i], 0);
+                    if (i > 0) pushText(", ");
+                }
+            }
+        }, ast.at(item.id).kind);
+    }
+}
+
+void printTree(const AST& ast, const NodeID& id, std::string& out) {
+    Printer().print(ast, id, out, PrintStyle::Tree);
+}
+
+void printInfix(const AST& ast, const NodeID& id, std::string& out) {
+    Printer().print(ast, id, out, PrintStyle::Infix);
+}
+
+void printLatex(const AST& ast, const NodeID& id, std::string& out) {
+    Printer().print(ast, id, out, PrintStyle::LaTeX);
+}
+
+const std::string AST::toString() const {
+    std::string out;
+    Printer().print(*this, root, out, PrintStyle::Tree);
+    return out;
+}
@@ -0,0 +1,82 @@
+/*
+AST Printers
+
+Three ways to turn a tree back into text:
+
+    Tree    the indented dump AST::toString has always made,
+            one node per line, children two spaces further in
+    Infix   plain math, "x^2 + 3 * x - 1/2"
+    LaTeX   what the parser reads, "x^{2} + 3 \cdot x - \frac{1}{2}"
+
+None of them recurse. A Printer keeps its own stack of things
+left to write (a node, or a bit of text like ")" or ", "), pops
+one at a time and appends straight onto the output, so a
+million-deep tree prints fine and every character is written
+exactly once. The old toString built a string per node and
+glued them together on the way back up, which copied the deep
+parts of the tree over and over.
+
+Output always gets appended to a caller's std::string, so the
+same buffer can be cleared and reused for thousands of
+expressions without reallocating. Printing to a std::ostream
+goes through the Printer's own buffer and gets flushed to the
+stream in big chunks.
+
+Infix and LaTeX only add parentheses where leaving them out
+would parse back into a different tree. Binding powers match
+the parser's: "a - (b - c)" keeps its parentheses and
+"(a - b) - c" loses them, "(x^2)^3" keeps them and "x^(2^3)"
+doesn't, and "-x^2" is already -(x^2) so it needs none.
+
+The LaTeX form is written so the parser reads it back: \frac
+keeps rationals exact, x^(1/2) comes out as \sqrt{x}, and pi
+and e are \pi and \e. Only negative whole numbers change shape,
+-4 comes back as a Negate of 4, which prints the same again.
+Infix is just for reading, it isn't LaTeX.
+*/
+
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include "AST.h"
+
+#include <ostream>
+#include <string_view>
+
+enum class PrintStyle {
+    Tree,
+    Infix,
+    LaTeX
+};
+
+class Printer {
+    public:
+        // appends the subtree at id to out
+        void print(const AST& ast, const NodeID& id, std::string& out, const PrintStyle& style = PrintStyle::Infix);
+        void print(const AST& ast, const NodeID& id, std::ostream& out, const PrintStyle& style = PrintStyle::Infix);
+
+    private:
+        // either a node to print or, if id is None, text to write as is
+        struct Item {
+            NodeID id;
+            size_t level;   // depth for Tree, weakest binding allowed without parentheses otherwise
+            std::string_view text;
+        };
+
+        std::vector<Item> _stack;
+        std::string _buffer;
+
+        // out is flushed to stream whenever it gets big, if there is one
+        void printTree(const AST& ast, const NodeID& id, std::string& out, std::ostream* stream);
+        void printInfix(const AST& ast, const NodeID& id, std::string& out, std::ostream* stream, const bool& latex);
+
+        void pushText(const std::string_view& text) { _stack.push_back({ NodeID::None(), 0, text }); }
+        void pushNode(const NodeID& id, const size_t& level) { _stack.push_back({ id, level, {} }); }
+};
+
+// one-off versions, each appends to out
+void printTree(const AST& ast, const NodeID& id, std::string& out);
+void printInfix(const AST& ast, const NodeID& id, std::string& out);
+void printLatex(const AST& ast, const NodeID& id, std::string& out);
+
+#endif
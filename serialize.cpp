@@ -0,0 +1,594 @@
+#include "serialize.h"
+
+#include <bit>
+#include <limits>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void writeVarint(std::string& out, u64 value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool readVarint(std::string_view in, size_t& pos, u64& value) {
+    value = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size()) return false;
+        u8 byte = static_cast<u8>(in[pos++]);
+        value |= (u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static u64 zigzag(const i64& v) { return ((u64)v << 1) ^ (u64)(v >> 63); }
+static i64 unzigzag(const u64& v) { return (i64)(v >> 1) ^ -(i64)(v & 1); }
+
+// the node's tag and everything after it except where its children are
+static std::string nodeHead(const ASTNode& node) {
+    std::string head;
+    u8 index = (u8)node.kind.index();
+
+    std::visit([&](const auto& n) {
+        using T = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<T, ConstantNode>) {
+            head += static_cast<char>(index | ((u8)n.cKind << 3));
+        }
+        if constexpr (std::is_same_v<T, RealNode>) {
+            head += static_cast<char>(index);
+            u64 bits = std::bit_cast<u64>(n.value);
+            for (int i = 0; i < 8; i++) head += static_cast<char>((bits >> (8 * i)) & 0xff);
+        }
+        if constexpr (std::is_same_v<T, RationalNode>) {
+            head += static_cast<char>(index);
+            writeVarint(head, zigzag(n.numerator));
+            writeVarint(head, (u64)n.denominator);
+        }
+        if constexpr (std::is_same_v<T, IdentifierNode>) {
+            head += static_cast<char>(index);
+            writeVarint(head, n.name.size());
+            head += n.name;
+        }
+        if constexpr (std::is_same_v<T, BinaryOpNode>) head += static_cast<char>(index | ((u8)n.bKind << 3));
+        if constexpr (std::is_same_v<T, UnaryOpNode>) head += static_cast<char>(index | ((u8)n.uKind << 3));
+        if constexpr (std::is_same_v<T, CallNode>) {
+            head += static_cast<char>(index | ((u8)n.fKind << 3));
+            writeVarint(head, n.args.size());
+        }
+    }, node.kind);
+    return head;
+}
+
+template <class F>
+static void forEachChild(const ASTNode& node, F f) {
+    std::visit([&](const auto& n) {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr (std::is_same_v<T, BinaryOpNode>) {
+            f(n.left);
+            f(n.right);
+        }
+        if constexpr (std::is_same_v<T, UnaryOpNode>) f(n.inner);
+        if constexpr (std::is_same_v<T, CallNode>) {
+            for (const NodeID& arg : n.args) f(arg);
+        }
+    }, node.kind);
+}
+
+void serializeSubtree(const AST& ast, const NodeID& id, std::string& out) {
+    std::string body;
+    u64 count = 0;
+
+    // post-order without recursing, every node (and every repeat of the same structure) written once
+    std::unordered_map<size_t, u64> written;
+    std::unordered_map<std::string, u64> records;
+    struct Task {
+        NodeID id;
+        bool expanded;
+    };
+    std::vector<Task> tasks;
+    if (!id.isNone()) tasks.push_back({ id, false });
+
+    std::vector<NodeID> children;
+    std::vector<u64> indices;
+    while (!tasks.empty()) {
+        Task task = tasks.back();
+        if (written.contains(task.id.i)) {
+            tasks.pop_back();
+            continue;
+        }
+        const ASTNode& node = ast.at(task.id);
+
+        children.clear();
+        forEachChild(node, [&](const NodeID& child) { children.push_back(child); });
+
+        if (!task.expanded) {
+            tasks.back().expanded = true;
+            // pushed backwards so the first child comes out first
+            for (size_t k = children.size(); k-- > 0;) {
+                if (!written.contains(children[k].i)) tasks.push_back({ children[k], false });
+            }
+            continue;
+        }
+        tasks.pop_back();
+
+        // with the children as indices it's the same key for the same structure, every child having been deduplicated first
+        std::string head = nodeHead(node);
+        std::string key = head;
+        indices.clear();
+        for (const NodeID& child : children) {
+            indices.push_back(written.at(child.i));
+            writeVarint(key, indices.back());
+        }
+
+        auto [it, added] = records.try_emplace(std::move(key), count);
+        written[task.id.i] = it->second;
+        if (!added) continue;
+
+        body += head;
+        for (const u64& index : indices) writeVarint(body, count - index);
+        count++;
+    }
+
+    writeVarint(out, count);
+    out += body;
+}
+
+std::optional<NodeID> deserializeSubtree(std::string_view in, AST& ast, size_t* consumed) {
+    size_t pos = 0;
+    u64 count;
+    if (!readVarint(in, pos, count)) return std::nullopt;
+    // every node is at least one byte, so this also stops absurd counts
+    if (count == 0 || count > in.size() - pos) return std::nullopt;
+
+    std::vector<NodeID> ids;
+    ids.reserve(count);
+
+    // distance back from node self, has to land on a node that's already been read
+    auto back = [&](const u64& self, NodeID& out) -> bool {
+        u64 distance;
+        if (!readVarint(in, pos, distance) || distance == 0 || distance > self) return false;
+        out = ids[self - distance];
+        return true;
+    };
+
+    for (u64 self = 0; self < count; self++) {
+        if (pos >= in.size()) return std::nullopt;
+        u8 tag = static_cast<u8>(in[pos++]);
+        u8 index = tag & 0x7;
+        u8 kind = tag >> 3;
+
+        switch (index) {
+            case 0: {
+                if (kind > (u8)ConstantKind::I) return std::nullopt;
+                ids.push_back(ast.addConstant((ConstantKind)kind));
+                break;
+            }
+            case 1: {
+                if (in.size() - pos < 8) return std::nullopt;
+                u64 bits = 0;
+                for (int i = 0; i < 8; i++) bits |= (u64)static_cast<u8>(in[pos++]) << (8 * i);
+                ids.push_back(ast.addReal(std::bit_cast<double>(bits)));
+                break;
+            }
+            case 2: {
+                u64 numerator, denominator;
+                if (!readVarint(in, pos, numerator) || !readVarint(in, pos, denominator)) return std::nullopt;
+                if (denominator == 0 || denominator > (u64)std::numeric_limits<i64>::max()) return std::nullopt;
+                ids.push_back(ast.addRational(unzigzag(numerator), (i64)denominator));
+                break;
+            }
+            case 3: {
+                u64 length;
+                if (!readVarint(in, pos, length) || length > in.size() - pos) return std::nullopt;
+                ids.push_back(ast.addIdentifier(std::string(in.substr(pos, length))));
+                pos += length;
+                break;
+            }
+            case 4: {
+                if (kind > (u8)BinaryOpKind::Equals) return std::nullopt;
+                NodeID left, right;
+                if (!back(self, left) || !back(self, right)) return std::nullopt;
+                ids.push_back(ast.addBinaryOp((BinaryOpKind)kind, left, right));
+                break;
+            }
+            case 5: {
+                if (kind > (u8)UnaryOpKind::Percent) return std::nullopt;
+                NodeID inner;
+                if (!back(self, inner)) return std::nullopt;
+                ids.push_back(ast.addUnaryOp((UnaryOpKind)kind, inner));
+                break;
+            }
+            case 6: {
+                if (kind > (u8)FunctionKind::Polygamma) return std::nullopt;
+                u64 argCount;
+                if (!readVarint(in, pos, argCount) || argCount > in.size() - pos) return std::nullopt;
+                std::vector<NodeID> args(argCount);
+                for (NodeID& arg : args) {
+                    if (!back(self, arg)) return std::nullopt;
+                }
+                ids.push_back(ast.addCall((FunctionKind)kind, args));
+                break;
+            }
+            default:
+                return std::nullopt;
+        }
+    }
+
+    if (consumed) *consumed = pos;
+    return ids.back();
+}
+
+// arena format
+
+static constexpr u64 ARENA_MAGIC = 0x00414e4552414d4dULL;  // "MMARENA\0" in little endian
+static constexpr size_t ARENA_HEADER_SIZE = 64;
+static constexpr size_t ARENA_NODE_SIZE = 32;
+static constexpr u64 NO_ROOT = ~0ULL;
+
+static void putLE64(std::string& out, const u64& v) {
+    for (int i = 0; i < 8; i++) out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+static void putLE32(std::string& out, const u32& v) {
+    for (int i = 0; i < 4; i++) out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+static u64 loadLE64(const u8* p) {
+    u64 v;
+    std::memcpy(&v, p, 8);
+    if constexpr (std::endian::native == std::endian::big) v = std::byteswap(v);
+    return v;
+}
+
+static u32 loadLE32(const u8* p) {
+    u32 v;
+    std::memcpy(&v, p, 4);
+    if constexpr (std::endian::native == std::endian::big) v = std::byteswap(v);
+    return v;
+}
+
+// reads 8 little endian bytes at a time, so it comes out the same on any machine
+static u64 checksum64(const u8* p, const size_t& n) {
+    u64 h = 0x9e3779b97f4a7c15ULL ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        u64 w = loadLE64(p + i) * 0xff51afd7ed558ccdULL;
+        h = std::rotl(h ^ w, 29) * 0xc4ceb9fe1a85ec53ULL;
+    }
+    u64 tail = 0;
+    for (size_t k = 0; i + k < n; k++) tail |= (u64)p[i + k] << (8 * k);
+    h = std::rotl(h ^ (tail * 0xff51afd7ed558ccdULL), 29) * 0xc4ceb9fe1a85ec53ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// arena index -> index in the file, children always before their parents so a reader can insist on it
+// a freshly built AST already is in that order, an IncrementalParser's can point forward once a group's been replaced
+static std::vector<u64> childrenFirstOrder(const AST& ast) {
+    size_t count = ast.arena.size();
+    std::vector<u64> index(count);
+    bool inOrder = true;
+    for (size_t i = 0; i < count && inOrder; i++) {
+        forEachChild(ast.arena[i], [&](const NodeID& child) {
+            if (!child.isNone() && child.i >= i) inOrder = false;
+        });
+    }
+    if (inOrder) {
+        for (size_t i = 0; i < count; i++) index[i] = i;
+        return index;
+    }
+
+    // post-order over everything, every node is numbered once all its children are
+    const u64 unvisited = NodeID::noPosition;
+    std::fill(index.begin(), index.end(), unvisited);
+    std::vector<bool> expanded(count, false);
+    std::vector<size_t> stack;
+    u64 next = 0;
+    for (size_t start = 0; start < count; start++) {
+        if (index[start] != unvisited) continue;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            size_t i = stack.back();
+            if (index[i] != unvisited) {
+                stack.pop_back();
+                continue;
+            }
+            if (!expanded[i]) {
+                expanded[i] = true;
+                forEachChild(ast.arena[i], [&](const NodeID& child) {
+                    if (!child.isNone() && child.i < count && !expanded[child.i]) stack.push_back(child.i);
+                });
+                continue;
+            }
+            stack.pop_back();
+            index[i] = next++;
+        }
+    }
+    return index;
+}
+
+void serializeArena(const AST& ast, std::string& out) {
+    std::string nodes, args, symbols;
+    nodes.reserve(ast.arena.size() * ARENA_NODE_SIZE);
+    std::unordered_map<std::string, u64> symbolOffsets;
+
+    std::vector<u64> index = childrenFirstOrder(ast);
+    std::vector<size_t> order(ast.arena.size());
+    for (size_t i = 0; i < ast.arena.size(); i++) order[index[i]] = i;
+    auto remap = [&](const NodeID& child) { return child.isNone() ? child.i : index[child.i]; };
+
+    for (const size_t& i : order) {
+        const ASTNode& node = ast.arena[i];
+        u8 subKind = 0;
+        u64 a = 0, b = 0, pos = 0;
+
+        std::visit([&](const auto& n) {
+            using T = std::decay_t<decltype(n)>;
+            pos = n.pos;
+
+            if constexpr (std::is_same_v<T, ConstantNode>) subKind = (u8)n.cKind;
+            if constexpr (std::is_same_v<T, RealNode>) a = std::bit_cast<u64>(n.value);
+            if constexpr (std::is_same_v<T, RationalNode>) {
+                a = (u64)n.numerator;
+                b = (u64)n.denominator;
+            }
+            if constexpr (std::is_same_v<T, IdentifierNode>) {
+                auto [it, inserted] = symbolOffsets.try_emplace(n.name, symbols.size());
+                if (inserted) symbols += n.name;
+                a = it->second;
+                b = n.name.size();
+            }
+            if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                subKind = (u8)n.bKind;
+                a = remap(n.left);
+                b = remap(n.right);
+            }
+            if constexpr (std::is_same_v<T, UnaryOpNode>) {
+                subKind = (u8)n.uKind;
+                a = remap(n.inner);
+            }
+            if constexpr (std::is_same_v<T, CallNode>) {
+                subKind = (u8)n.fKind;
+                a = args.size() / 8;
+                b = n.args.size();
+                for (const NodeID& arg : n.args) putLE64(args, remap(arg));
+            }
+        }, node.kind);
+
+        nodes += static_cast<char>(node.kind.index());
+        nodes += static_cast<char>(subKind);
+        nodes.append(6, '\0');
+        putLE64(nodes, a);
+        putLE64(nodes, b);
+        putLE64(nodes, pos);
+    }
+
+    // pad symbols so a file of arenas back to back stays aligned
+    symbols.append((8 - symbols.size() % 8) % 8, '\0');
+
+    std::string body = nodes + args + symbols;
+    size_t start = out.size();
+
+    putLE64(out, ARENA_MAGIC);
+    putLE32(out, ARENA_FORMAT_VERSION);
+    putLE32(out, 0);    // flags, none yet
+    putLE64(out, ast.arena.size());
+    putLE64(out, args.size() / 8);
+    putLE64(out, symbols.size());
+    putLE64(out, ast.root.isNone() ? NO_ROOT : index[ast.root.i]);
+    putLE64(out, checksum64(reinterpret_cast<const u8*>(body.data()), body.size()));
+    putLE64(out, checksum64(reinterpret_cast<const u8*>(out.data() + start), 56));
+    out += body;
+}
+
+std::optional<ArenaView> ArenaView::open(std::string_view bytes) {
+    if (bytes.size() < ARENA_HEADER_SIZE) return std::nullopt;
+    const u8* p = reinterpret_cast<const u8*>(bytes.data());
+
+    if (loadLE64(p) != ARENA_MAGIC) return std::nullopt;
+    if (checksum64(p, 56) != loadLE64(p + 56)) return std::nullopt;
+    if (loadLE32(p + 8) != ARENA_FORMAT_VERSION) return std::nullopt;
+
+    u64 nodeCount = loadLE64(p + 16);
+    u64 argCount = loadLE64(p + 24);
+    u64 symbolBytes = loadLE64(p + 32);
+    u64 root = loadLE64(p + 40);
+
+    // sizes checked one at a time so a huge count can't overflow the sum
+    u64 room = bytes.size() - ARENA_HEADER_SIZE;
+    if (nodeCount > room / ARENA_NODE_SIZE) return std::nullopt;
+    room -= nodeCount * ARENA_NODE_SIZE;
+    if (argCount > room / 8) return std::nullopt;
+    room -= argCount * 8;
+    if (symbolBytes > room) return std::nullopt;
+    u64 bodySize = nodeCount * ARENA_NODE_SIZE + argCount * 8 + symbolBytes;
+
+    if (checksum64(p + ARENA_HEADER_SIZE, bodySize) != loadLE64(p + 48)) return std::nullopt;
+    if (root != NO_ROOT && root >= nodeCount) return std::nullopt;
+
+    ArenaView view;
+    view._nodes = p + ARENA_HEADER_SIZE;
+    view._args = view._nodes + nodeCount * ARENA_NODE_SIZE;
+    view._symbols = reinterpret_cast<const char*>(view._args + argCount * 8);
+    view._nodeCount = nodeCount;
+    view._argCount = argCount;
+    view._symbolBytes = symbolBytes;
+    view._root = root == NO_ROOT ? NodeID::None() : NodeID{ root };
+
+    // every index and range gets checked here, once, so the accessors don't have to
+    for (u64 i = 0; i < nodeCount; i++) {
+        NodeID id{ i };
+        u8 subKind = view._nodes[i * ARENA_NODE_SIZE + 1];
+        u64 a = view.field(id, 8);
+        u64 b = view.field(id, 16);
+
+        // a child index of NodeID::noPosition is a None child, anything else has to come before
+        // its parent, which also rules out a node being its own descendant
+        auto child = [&](const u64& c) { return c == NodeID::noPosition || c < i; };
+
+        bool ok = false;
+        switch (view.kind(id)) {
+            case 0: ok = subKind <= (u8)ConstantKind::I; break;
+            case 1: ok = true; break;
+            case 2: ok = b != 0; break;
+            case 3: ok = a <= symbolBytes && b <= symbolBytes - a; break;
+            case 4: ok = subKind <= (u8)BinaryOpKind::Equals && child(a) && child(b); break;
+            case 5: ok = subKind <= (u8)UnaryOpKind::Percent && child(a); break;
+            case 6: {
+                ok = subKind <= (u8)FunctionKind::Polygamma && a <= argCount && b <= argCount - a;
+                for (u64 k = 0; ok && k < b; k++) ok = child(view.arg(a + k).i);
+                break;
+            }
+        }
+        if (!ok) return std::nullopt;
+    }
+    return view;
+}
+
+u64 ArenaView::field(const NodeID& id, const size_t& offset) const {
+    return loadLE64(_nodes + id.i * ARENA_NODE_SIZE + offset);
+}
+
+NodeID ArenaView::arg(const u64& i) const {
+    return NodeID{ loadLE64(_args + i * 8) };
+}
+
+u8 ArenaView::kind(const NodeID& id) const {
+    return _nodes[id.i * ARENA_NODE_SIZE];
+}
+
+std::string_view ArenaView::name(const NodeID& id) const {
+    if (kind(id) != 3) return {};
+    return { _symbols + field(id, 8), field(id, 16) };
+}
+
+ASTNode ArenaView::node(const NodeID& id) const {
+    u8 subKind = _nodes[id.i * ARENA_NODE_SIZE + 1];
+    u64 a = field(id, 8);
+    u64 b = field(id, 16);
+    size_t pos = field(id, 24);
+
+    switch (kind(id)) {
+        case 0: return ConstantNode{ (ConstantKind)subKind, pos };
+        case 1: return RealNode{ std::bit_cast<double>(a), pos };
+        case 2: return RationalNode{ (i64)a, (i64)b, pos };
+        case 3: return IdentifierNode{ std::string(name(id)), pos };
+        case 4: return BinaryOpNode{ (BinaryOpKind)subKind, NodeID{ a }, NodeID{ b }, pos };
+        case 5: return UnaryOpNode{ (UnaryOpKind)subKind, NodeID{ a }, pos };
+        default: {
+            std::vector<NodeID> args;
+            args.reserve(b);
+            for (u64 k = 0; k < b; k++) args.push_back(arg(a + k));
+            return CallNode{ (FunctionKind)subKind, std::move(args), pos };
+        }
+    }
+}
+
+NodeID ArenaView::load(AST& ast) const {
+    size_t base = ast.arena.size();
+    ast.reserve(base + _nodeCount);
+
+    auto shift = [&](const NodeID& id) { return id.isNone() ? id : NodeID{ base + id.i }; };
+
+    for (u64 i = 0; i < _nodeCount; i++) {
+        ASTNode n = node(NodeID{ i });
+        // children point into the view, move them to wherever this arena put them
+        std::visit([&](auto& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, BinaryOpNode>) {
+                v.left = shift(v.left);
+                v.right = shift(v.right);
+            }
+            if constexpr (std::is_same_v<T, UnaryOpNode>) v.inner = shift(v.inner);
+            if constexpr (std::is_same_v<T, CallNode>) {
+                for (NodeID& arg : v.args) arg = shift(arg);
+            }
+        }, n.kind);
+        ast.arena.push_back(std::move(n));
+    }
+    return shift(_root);
+}
+
+bool deserializeArena(std::string_view bytes, AST& ast) {
+    std::optional<ArenaView> view = ArenaView::open(bytes);
+    if (!view) return false;
+
+    ast.arena.clear();
+    ast.root = view->load(ast);
+    return true;
+}
+
+MappedArena::~MappedArena() {
+    close();
+}
+
+bool MappedArena::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    ::close(fd);
+    if (base == MAP_FAILED) return false;
+
+    _base = base;
+    _size = (size_t)st.st_size;
+    _view = ArenaView::open(std::string_view(static_cast<const char*>(_base), _size));
+    if (!_view) close();
+    return _view.has_value();
+}
+
+void MappedArena::close() {
+    _view.reset();
+    if (_base) munmap(_base, _size);
+    _base = nullptr;
+    _size = 0;
+}
+
+bool writeArenaFile(const AST& ast, const std::string& path) {
+    std::string bytes;
+    serializeArena(ast, bytes);
+
+    // written next to it and renamed over, so a reader never maps half a file
+    std::string temp = path + ".tmp" + std::to_string(getpid());
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += (size_t)n;
+    }
+
+    bool ok = written == bytes.size() && fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (ok) ok = rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(temp.c_str());
+    return ok;
+}
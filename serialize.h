@@ -0,0 +1,174 @@
+/*
+Binary Subtree Format
+
+A compact way to write one subtree out as bytes and read it
+back into any AST, used by the on-disk transform cache.
+
+Nodes are written children first (post-order), so every child
+is already there by the time its parent shows up, and a parent
+only needs to say how far back its children are:
+
+    "x^2 + 1"   ->   count=5
+                     [x] [2] [^ back 2, back 1] [1] [+ back 2, back 1]
+
+A subtree that's already been written isn't written again, the
+next parent that needs it just points further back. That goes for
+a node shared by several parents (a DAG out of cse.h or a
+derivative) and for two copies of the same structure alike, so a
+DAG takes as many records as it has distinct nodes:
+
+    "x^2 + x^2" ->   count=4
+                     [x] [2] [^ back 2, back 1] [+ back 1, back 1]
+
+Each node starts with one tag byte, the node's variant index in
+the low 3 bits and its kind (ConstantKind, BinaryOpKind, ...) in
+the rest. Everything after that is LEB128 varints, which keeps
+the common small numbers to a byte each:
+
+    Constant    nothing else
+    Real        8 bytes, little endian bits of the double
+    Rational    zigzag numerator, denominator
+    Identifier  length, then the name's bytes
+    BinaryOp    distance back to left, distance back to right
+    UnaryOp     distance back to inner
+    Call        arg count, then each arg's distance back
+
+Positions aren't written, they'd be meaningless in another AST.
+That also means two subtrees with the same structure always
+serialize to the same bytes, shared or not, so comparing blobs is
+as good as structurallyEqual. Writing walks its own stack instead
+of recursing, so depth doesn't matter either.
+
+Reading never trusts the bytes. Anything truncated, out of range
+or pointing forward makes deserializeSubtree give up and return
+nullopt, leaving whatever nodes it already added in the AST. What
+it reads back shares nodes the same way the records do.
+
+--
+Binary Arena Format
+
+The subtree format is small but has to be read node by node.
+For shipping whole ASTs between pipeline stages there's a second
+format that's just the arena laid out flat, so a file can be
+mmap'd and read in place through an ArenaView:
+
+    header   64 bytes    magic, version, counts, root, checksum
+    nodes    32 bytes each, children before their parents
+    args     8 bytes each, the arg lists of every call back to back
+    symbols  identifier names, each distinct name stored once
+
+Every node record is the same size, so node i is at a fixed
+offset and there's nothing to parse:
+
+    kind u8 | subKind u8 | pad 6 | a u64 | b u64 | pos u64
+
+    Constant    subKind = ConstantKind
+    Real        a = bits of the double
+    Rational    a = numerator, b = denominator
+    Identifier  a = offset into symbols, b = length
+    BinaryOp    subKind = BinaryOpKind, a = left, b = right
+    UnaryOp     subKind = UnaryOpKind, a = inner
+    Call        subKind = FunctionKind, a = first arg, b = arg count
+
+Everything is fixed-width little endian no matter what machine
+wrote it, and the view reads it back that way. The header has a
+checksum of itself and one of everything after it. ArenaView::open
+checks both plus every index and symbol range once, so after that
+the accessors can't read out of bounds. A format change bumps
+ARENA_FORMAT_VERSION, and older readers refuse the file.
+
+Every child index has to be smaller than its parent's, the way
+the AST's add*()s build an arena anyway, so a corrupt file can't
+sneak a cycle past open() and send whoever walks it around in
+circles. Nodes are written in arena order when that already holds,
+which is almost always. An IncrementalParser's arena can point
+forward after a group gets replaced in place, and then it's
+renumbered children first on the way out (root included).
+*/
+
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "AST.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// appends the subtree at id to out
+void serializeSubtree(const AST& ast, const NodeID& id, std::string& out);
+
+// reads one subtree from the front of in into ast, returns its root
+// consumed (if set) gets how many bytes it took
+std::optional<NodeID> deserializeSubtree(std::string_view in, AST& ast, size_t* consumed = nullptr);
+
+// little endian varint helpers, shared with anything else that writes this format
+void writeVarint(std::string& out, u64 value);
+bool readVarint(std::string_view in, size_t& pos, u64& value);
+
+inline constexpr u32 ARENA_FORMAT_VERSION = 1;
+
+// writes every node of ast (not only what's under root) in the arena format, renumbered if a child comes after its parent
+void serializeArena(const AST& ast, std::string& out);
+
+// read-only access to a serialized arena without copying it
+class ArenaView {
+    public:
+        // checks the header, checksums and every index, nullopt if anything is off
+        // bytes has to stay alive (and 8-byte aligned is fastest) for as long as the view is used
+        static std::optional<ArenaView> open(std::string_view bytes);
+
+        size_t size() const { return _nodeCount; }
+        NodeID root() const { return _root; }
+
+        // the ASTNode::Kind variant index of node id
+        u8 kind(const NodeID& id) const;
+        // builds node id, children are NodeIDs in this view
+        ASTNode node(const NodeID& id) const;
+        // the name of an identifier node, pointing into the view's bytes
+        std::string_view name(const NodeID& id) const;
+
+        // appends every node to ast, returns where the root ended up (doesn't set ast.root)
+        NodeID load(AST& ast) const;
+
+    private:
+        const u8* _nodes = nullptr;
+        const u8* _args = nullptr;
+        const char* _symbols = nullptr;
+        size_t _nodeCount = 0;
+        size_t _argCount = 0;
+        size_t _symbolBytes = 0;
+        NodeID _root = NodeID::None();
+
+        u64 field(const NodeID& id, const size_t& offset) const;
+        NodeID arg(const u64& i) const;
+};
+
+// replaces ast's arena and root with a serialized arena, false if it doesn't check out
+bool deserializeArena(std::string_view bytes, AST& ast);
+
+// a serialized arena file mapped read-only
+class MappedArena {
+    public:
+        MappedArena() = default;
+        ~MappedArena();
+        MappedArena(const MappedArena&) = delete;
+        MappedArena& operator=(const MappedArena&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+
+        // only valid while the file is open
+        const ArenaView& view() const { return *_view; }
+        bool isOpen() const { return _view.has_value(); }
+
+    private:
+        void* _base = nullptr;
+        size_t _size = 0;
+        std::optional<ArenaView> _view;
+};
+
+// serializeArena straight to a file, false on any write error
+bool writeArenaFile(const AST& ast, const std::string& path);
+
+#endif
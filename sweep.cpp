@@ -0,0 +1,194 @@
+#include "sweep.h"
+#include "columns.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace {
+    // the chunks [begin, end) one worker still has, packed so a take or a steal is one CAS
+    struct alignas(64) ChunkRange {
+        std::atomic<u64> bounds = 0;
+    };
+
+    u64 pack(const u64& begin, const u64& end) { return begin << 32 | end; }
+    u32 beginOf(const u64& bounds) { return (u32)(bounds >> 32); }
+    u32 endOf(const u64& bounds) { return (u32)bounds; }
+
+    bool takeFront(ChunkRange& range, size_t& chunk) {
+        u64 current = range.bounds.load(std::memory_order_acquire);
+        while (true) {
+            u32 begin = beginOf(current), end = endOf(current);
+            if (begin >= end) return false;
+            if (range.bounds.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                chunk = begin;
+                return true;
+            }
+        }
+    }
+
+    // the victim keeps the front half, into (which has to be empty) gets the back
+    bool stealHalf(ChunkRange& victim, ChunkRange& into) {
+        u64 current = victim.bounds.load(std::memory_order_acquire);
+        while (true) {
+            u32 begin = beginOf(current), end = endOf(current);
+            if (begin >= end) return false;
+            u32 middle = begin + (end - begin) / 2;
+            if (victim.bounds.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                into.bounds.store(pack(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // calls work(chunk, worker) once for every chunk in [0, chunks)
+    template <class F>
+    void runChunks(const size_t& chunks, const size_t& threads, F work) {
+        if (threads == 1) {
+            for (size_t chunk = 0; chunk < chunks; chunk++) work(chunk, 0);
+            return;
+        }
+
+        std::vector<ChunkRange> ranges(threads);
+        for (size_t t = 0; t < threads; t++) {
+            ranges[t].bounds.store(pack(chunks * t / threads, chunks * (t + 1) / threads), std::memory_order_relaxed);
+        }
+
+        auto worker = [&](const size_t& t) {
+            size_t chunk = 0;
+            while (true) {
+                while (takeFront(ranges[t], chunk)) work(chunk, t);
+
+                // out of its own, nothing left anywhere means done
+                bool stole = false;
+                for (size_t k = 1; k < threads && !stole; k++) stole = stealHalf(ranges[(t + k) % threads], ranges[t]);
+                if (!stole) return;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (size_t t = 1; t < threads; t++) workers.emplace_back(worker, t);
+        worker(0);
+        for (std::thread& w : workers) w.join();
+    }
+
+    size_t workerCount(const size_t& threadCount, const size_t& chunks) {
+        size_t threads = threadCount == 0 ? std::thread::hardware_concurrency() : threadCount;
+        return std::max<size_t>(1, std::min(threads, chunks));
+    }
+
+    size_t chunkCount(const size_t& points) {
+        size_t chunks = (points + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+        if (chunks > 0xFFFFFFFF) throw EvaluatorError(UnknownPos, "Too many points to sweep");
+        return chunks;
+    }
+}
+
+size_t gridSize(std::span<const GridAxis> axes) {
+    if (axes.empty()) return 0;
+    size_t size = 1;
+    for (const GridAxis& axis : axes) {
+        if (axis.count != 0 && size > SIZE_MAX / axis.count) throw EvaluatorError(UnknownPos, "Grid is too big");
+        size *= axis.count;
+    }
+    return size;
+}
+
+void evaluateGrid(const Program& program, std::span<const GridAxis> axes, const Bindings& fixed, double* out, const size_t& threadCount) {
+    size_t total = gridSize(axes);
+    const std::vector<std::string>& variables = program.variables();
+
+    // each variable's axis, or none if it has a fixed value
+    constexpr size_t NO_AXIS = (size_t)-1;
+    std::vector<size_t> axisOf(variables.size(), NO_AXIS);
+    std::vector<double> fixedValue(variables.size(), 0.0);
+    for (size_t a = 0; a < axes.size(); a++) {
+        for (size_t b = 0; b < a; b++) {
+            if (axes[a].variable == axes[b].variable) throw EvaluatorError(UnknownPos, "Variable on two axes: \"" + axes[a].variable + "\"");
+        }
+        if (auto slot = program.slot(axes[a].variable)) axisOf[*slot] = a;
+    }
+    for (size_t v = 0; v < variables.size(); v++) {
+        if (axisOf[v] != NO_AXIS) continue;
+        auto it = fixed.find(variables[v]);
+        if (it == fixed.end()) throw EvaluatorError(UnknownPos, "Unbound variable: \"" + variables[v] + "\"");
+        fixedValue[v] = it->second;
+    }
+    if (total == 0) return;
+
+    // every coordinate worked out once, from its own index
+    std::vector<std::vector<double>> values(axes.size());
+    for (size_t a = 0; a < axes.size(); a++) {
+        values[a].resize(axes[a].count);
+        for (size_t i = 0; i < axes[a].count; i++) values[a][i] = axes[a].at(i);
+    }
+
+    size_t chunks = chunkCount(total);
+    size_t threads = workerCount(threadCount, chunks);
+
+    // a column tile per variable and worker, the fixed ones never change
+    size_t width = variables.size();
+    std::vector<std::vector<double>> columns(threads * width);
+    for (size_t t = 0; t < threads; t++) {
+        for (size_t v = 0; v < width; v++) columns[t * width + v].assign(SWEEP_CHUNK, fixedValue[v]);
+    }
+    std::vector<std::vector<const double*>> pointers(threads, std::vector<const double*>(width));
+    std::vector<std::vector<size_t>> indices(threads, std::vector<size_t>(axes.size()));
+
+    runChunks(chunks, threads, [&](const size_t& chunk, const size_t& t) {
+        size_t start = chunk * SWEEP_CHUNK;
+        size_t count = std::min(SWEEP_CHUNK, total - start);
+
+        // where start is on every axis, the last one changes fastest
+        std::vector<size_t>& index = indices[t];
+        size_t rest = start;
+        for (size_t a = axes.size(); a-- > 0;) {
+            index[a] = rest % axes[a].count;
+            rest /= axes[a].count;
+        }
+
+        std::vector<const double*>& cols = pointers[t];
+        for (size_t v = 0; v < width; v++) cols[v] = columns[t * width + v].data();
+
+        for (size_t r = 0; r < count; r++) {
+            for (size_t v = 0; v < width; v++) {
+                if (axisOf[v] != NO_AXIS) columns[t * width + v][r] = values[axisOf[v]][index[axisOf[v]]];
+            }
+            // on to the next point, carrying into the axes before
+            for (size_t a = axes.size(); a-- > 0;) {
+                if (++index[a] < axes[a].count) break;
+                index[a] = 0;
+            }
+        }
+
+        evaluateColumns(program, std::span<const double* const>(cols), out + start, count);
+    });
+}
+
+void evaluatePoints(const Program& program, std::span<const double> points, double* out, const size_t& rows, const size_t& threadCount) {
+    size_t width = program.variables().size();
+    if (width != 0 && points.size() / width < rows) throw EvaluatorError(UnknownPos, "Not enough point values");
+    if (rows == 0) return;
+
+    size_t chunks = chunkCount(rows);
+    size_t threads = workerCount(threadCount, chunks);
+
+    std::vector<std::vector<double>> columns(threads * width, std::vector<double>(SWEEP_CHUNK));
+    std::vector<std::vector<const double*>> pointers(threads, std::vector<const double*>(width));
+
+    runChunks(chunks, threads, [&](const size_t& chunk, const size_t& t) {
+        size_t start = chunk * SWEEP_CHUNK;
+        size_t count = std::min(SWEEP_CHUNK, rows - start);
+
+        // rows to columns
+        std::vector<const double*>& cols = pointers[t];
+        for (size_t v = 0; v < width; v++) {
+            double* column = columns[t * width + v].data();
+            const double* point = points.data() + start * width + v;
+            for (size_t r = 0; r < count; r++) column[r] = point[r * width];
+            cols[v] = column;
+        }
+        evaluateColumns(program, std::span<const double* const>(cols), out + start, count);
+    });
+}
@@ -0,0 +1,79 @@
+/*
+Parameter Sweeps
+
+The usual way a formula gets run a hundred million times is a
+sweep: every combination of a few variables over a range each,
+
+    GridAxis axes[] = { { "x", 0, 1, 1000 }, { "y", -5, 5, 1000 }, { "t", 0, 10, 100 } };
+    std::vector<double> out(gridSize(axes));
+    evaluateGrid(program, axes, {}, out.data(), 0);
+
+or a list of points someone already picked. Both go across every
+core and write into a buffer the caller already has. A grid's
+results are in row-major order, the last axis changes fastest:
+
+    out[(i * 1000 + j) * 100 + k]  =  f(x_i, y_j, t_k)
+
+Points are split into chunks of SWEEP_CHUNK, and each chunk runs
+through evaluateColumns() like any other batch of rows, with the
+coordinates for the chunk worked out into column tiles first.
+
+--
+Scheduling
+
+Every worker starts off owning an equal, contiguous range of
+chunks and takes them from the front. Once its own range is
+empty it goes looking through the others and steals the back
+half of whatever one has left:
+
+    worker 0   [ 0 1 2 3 | 4 5 6 7 ]     worker 3 is done and takes 4..7
+    worker 3   [ ]
+
+so a worker that got stuck on the slow part of the grid (where
+everything overflows into libm's slow paths, say) gets helped
+out instead of holding everyone up. A range is a (begin, end)
+pair packed into one atomic word, so taking one and stealing
+half are both a single compare-and-swap.
+
+Which thread gets which chunk changes from run to run, but no
+point's value depends on that: a coordinate is worked out from
+its own index (lo + i * step, never by adding up steps), and
+every row of a column tile is computed on its own. Results are
+the same bits for any thread count, and the same as running
+program.run() on each point.
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "bytecode.h"
+
+#include <span>
+
+// points per chunk, the unit that gets handed out and stolen
+inline constexpr size_t SWEEP_CHUNK = 4096;
+
+// count evenly spaced values from lo to hi, both included
+struct GridAxis {
+    std::string variable;
+    double lo = 0;
+    double hi = 0;
+    size_t count = 0;
+
+    double at(const size_t& i) const {
+        if (i + 1 >= count) return count <= 1 ? lo : hi;
+        return lo + (double)i * ((hi - lo) / (double)(count - 1));
+    }
+};
+
+// points in the whole grid, throws EvaluatorError if that doesn't fit in a size_t
+size_t gridSize(std::span<const GridAxis> axes);
+
+// program at every point of the grid into out[0..gridSize(axes)), variables not on an axis come from fixed
+// threadCount 0 means one per core, throws EvaluatorError if a variable has no value
+void evaluateGrid(const Program& program, std::span<const GridAxis> axes, const Bindings& fixed, double* out, const size_t& threadCount);
+
+// points holds rows rows of program.variables().size() values each, in slot order
+void evaluatePoints(const Program& program, std::span<const double> points, double* out, const size_t& rows, const size_t& threadCount);
+
+#endif
@@ -1,14 +1,26 @@
 #include "transformer.h"
 #include <cmath>
 
-NodeID transform(const AST& input, AST& output) {
-    AST current;
-    current.root = cloneSubtree(input, input.root, current);
+NodeID transform(const AST& input, AST& output, TransformCache* cache) {
+    Result<NodeID> result = tryTransform(input, output, cache);
+    if (!result) {
+        const Diagnostic& d = result.error().front();
+        throw TransformerError(d.pos, d.message);
+    }
+    return *result;
+}
 
-    for (size_t iterations = 0; iterations < 64; iterations++) {
-        u8 pass = 0;
-        AST a, b, c, d, e, f, g, h, i, next;
-        try {
+// the fixed-point loop on the subtree at id, the result is cloned into output but output.root isn't set
+static Result<NodeID> runPasses(const AST& input, const NodeID& id, AST& output) {
+    AST current;
+    current.root = cloneSubtree(input, id, current);
+
+    // one handler around the whole loop, the passes only throw on internal errors
+    u8 pass = 0;
+    try {
+        for (size_t iterations = 0; iterations < 64; iterations++) {
+            AST a, b, c, d, e, f, g, h, i, next;
+            pass = 0;
             ++pass;
             a.root = eliminateNegate(current, current.root, a);
             ++pass;
@@ -29,36 +41,55 @@ NodeID transform(const AST& input, AST& output) {
             i.root = canonicalizeLogExp(h, h.root, i);
             ++pass;
             next.root = canonicalOrder(i, i.root, next);
-        } catch(const std::exception& e) {
-            std::string msg = "In pass: ";
-            switch (pass) {
-                case 0: msg = "In initialization\n"; break;
-                case 1: msg += "eliminateNegate\n"; break;
-                case 2: msg += "foldConstants\n"; break;
-                case 3: msg += "eliminateSubtraction\n"; break;
-                case 4: msg += "eliminateDivision\n"; break;
-                case 5: msg += "simplifyIdentities\n"; break;
-                case 6: msg += "combineLikeTerms\n"; break;
-                case 7: msg += "collectExponent\n"; break;
-                case 8: msg += "applyTrigIdentities\n"; break;
-                case 9: msg += "canonicalizeLogExp\n"; break;
-                case 10: msg += "canonicalOrder\n"; break;
-                default: msg = "Idk man you fucked up tho\n";
-            }
-            throw TransformerError(UnknownPos, msg);
-        }
-        
-        if (structurallyEqual(current, current.root, next, next.root)) {
+            pass = 0;
+
+            bool converged = structurallyEqual(current, current.root, next, next.root);
             current = std::move(next);
-            break;
+
+            if (converged) {
+                return cloneSubtree(current, current.root, output);
+            }
         }
+    } catch(const std::exception& e) {
+        std::string msg = "In pass: ";
+        switch (pass) {
+            case 0: msg = "In initialization\n"; break;
+            case 1: msg += "eliminateNegate\n"; break;
+            case 2: msg += "foldConstants\n"; break;
+            case 3: msg += "eliminateSubtraction\n"; break;
+            case 4: msg += "eliminateDivision\n"; break;
+            case 5: msg += "simplifyIdentities\n"; break;
+            case 6: msg += "combineLikeTerms\n"; break;
+            case 7: msg += "collectExponent\n"; break;
+            case 8: msg += "applyTrigIdentities\n"; break;
+            case 9: msg += "canonicalizeLogExp\n"; break;
+            case 10: msg += "canonicalOrder\n"; break;
+            default: msg = "Idk man you fucked up tho\n";
+        }
+        return std::unexpected(Diagnostics{ { ErrorStage::Transformer, UnknownPos, msg } });
+    }
+
+    return std::unexpected(Diagnostics{ { ErrorStage::Transformer, UnknownPos, "Transform did not converge" } });
+}
+
+Result<NodeID> tryTransform(const AST& input, AST& output, TransformCache* cache) {
+    Result<NodeID> result;
+    if (!cache || input.root.isNone()) {
+        result = runPasses(input, input.root, output);
+    } else {
+        std::vector<u64> hashes;
+        std::vector<u32> sizes;
+        u64 hash = structuralHashes(input, input.root, hashes, sizes);
 
-        current = std::move(next);
-        if (iterations == 63) throw TransformerError(UnknownPos, "Transform did not converge");
+        if (auto hit = cache->lookup(hash, input, input.root, output)) result = *hit;
+        else {
+            result = runPasses(input, input.root, output);
+            if (result) cache->insert(hash, input, input.root, output, *result);
+        }
     }
 
-    output.root = cloneSubtree(current, current.root, output);
-    return output.root;
+    if (result) output.root = *result;
+    return result;
 }
 
 NodeID eliminateNegate(const AST& input, const NodeID& id, AST& output) {
@@ -89,15 +89,33 @@ sequence is repeated using a fixed-point loop until the AST
 stops changing between iterations. This is because something
 like 2 * sin(pi) might expand into 2 * 0, which should be
 folded by another iteration of the sequence.
+
+--
+With a TransformCache, transform() looks the whole input up by
+its structural hash first, and only runs the loop on a miss.
+Only whole inputs are cached, never their subtrees: the passes
+look across subtree boundaries (combineLikeTerms cancelling an
+ln(x^2) against another one, canonicalOrder sorting the terms a
+subtree's result gets mixed into), so a subtree transformed on
+its own and spliced back in can come out in a different shape
+than the same subtree transformed in place. With or without a
+cache, the output is the same.
 */
 
 #ifndef TRANSFORMER_H
 #define TRANSFORMER_H
 
 #include "nodetools.h"
+#include "cache.h"
+
+// bump whenever a pass changes what transform() gives back for some input,
+// persisted TransformCache files written under another version get turned away
+inline constexpr u32 TRANSFORM_RULES_VERSION = 1;
 
-// returns a transformed AST
-NodeID transform(const AST& input, AST& output);
+// returns a transformed AST, cache (if set) is consulted for the whole tree
+NodeID transform(const AST& input, AST& output, TransformCache* cache = nullptr);
+// non-throwing transform, a failed pass or no convergence comes back as a Diagnostic
+Result<NodeID> tryTransform(const AST& input, AST& output, TransformCache* cache = nullptr);
 
 // removes negate as a unary op and instead stores it directly or by (-1) * x
 NodeID eliminateNegate(const AST& input, const NodeID& id, AST& output);